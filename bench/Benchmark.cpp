@@ -0,0 +1,27 @@
+#include <random>
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+#include "Benchmark.h"
+
+#define RANDOM_CHUNK_SIZE 1048576 // 1 MiB
+
+/**
+ * Creates a file of the given size filled with pseudo-random data, the
+ * same for every run, e.g. the source of a synthetic Torrent.
+ */
+void writeRandomFile(const std::string& path, size_t size)
+{
+    std::string data(RANDOM_CHUNK_SIZE, '\0');
+    std::mt19937_64 random(42);
+    std::ofstream file(path, std::ofstream::binary | std::ofstream::trunc);
+    for (size_t written = 0; written < size; written += data.size())
+    {
+        for (char& byte : data)
+            byte = (char) random();
+        file.write(data.data(), (std::streamsize) std::min(data.size(), size - written));
+    }
+    if (!file)
+        throw std::runtime_error("Cannot write " + path);
+}
@@ -0,0 +1,50 @@
+#ifndef BITTORRENTCLIENT_BENCHMARK_H
+#define BITTORRENTCLIENT_BENCHMARK_H
+
+#include <chrono>
+#include <string>
+
+/**
+ * The parameters shared by the benchmarks.
+ */
+struct BenchmarkOptions
+{
+    // Size in MiB of the data hashed or written by each measurement
+    size_t sizeMb = 256;
+    // Number of times each measurement is repeated, the fastest run being reported
+    int repetitions = 3;
+    // Directory in which the files written by the benchmarks are created
+    std::string directory = ".";
+};
+
+/**
+ * Runs the given function the given number of times.
+ * @return the duration in seconds of the fastest run.
+ */
+template <typename Function>
+double fastestRun(int repetitions, Function function)
+{
+    double fastest = 0;
+    for (int i = 0; i < repetitions; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        function();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (i == 0 || seconds < fastest)
+            fastest = seconds;
+    }
+    return fastest;
+}
+
+void writeRandomFile(const std::string& path, size_t size);
+
+void benchmarkBitfield(const BenchmarkOptions& options);
+void benchmarkDiskWriter(const BenchmarkOptions& options);
+void benchmarkCheck(const BenchmarkOptions& options);
+void benchmarkCorruption(const BenchmarkOptions& options);
+void benchmarkHash(const BenchmarkOptions& options);
+void benchmarkMemory(const BenchmarkOptions& options);
+void benchmarkStorage(const BenchmarkOptions& options);
+void benchmarkTorrentCreator(const BenchmarkOptions& options);
+
+#endif //BITTORRENTCLIENT_BENCHMARK_H
@@ -0,0 +1,105 @@
+#include <cmath>
+#include <random>
+#include <string>
+#include <iostream>
+#include <iomanip>
+
+#include "Benchmark.h"
+#include "Bitfield.h"
+
+#define BITFIELD_PIECES 100000
+#define BITFIELD_ITERATIONS 1000
+#define MISSING_PERCENTAGE 1 // part of the pieces, at the end, still missing
+
+/**
+ * Checks if the given piece is set in a BitField kept as a string, as the
+ * peers' BitFields were before the Bitfield class.
+ */
+static bool hasPiece(const std::string& bitField, int index)
+{
+    int byteIndex = floor(index / 8);
+    int offset = index % 8;
+    return (bitField[byteIndex] >> (7 - offset) & 1) != 0;
+}
+
+/**
+ * Prints the time taken by one operation, with the string BitFields and
+ * with the Bitfield class.
+ */
+static void report(const std::string& operation, double stringSeconds, double bitfieldSeconds)
+{
+    std::cout << std::left << std::setw(36) << operation << std::right << std::fixed << std::setprecision(2)
+              << std::setw(12) << stringSeconds / BITFIELD_ITERATIONS * 1e6 << " us"
+              << std::setw(12) << bitfieldSeconds / BITFIELD_ITERATIONS * 1e6 << " us"
+              << std::setw(10) << std::setprecision(0) << stringSeconds / bitfieldSeconds << "x" << std::endl;
+}
+
+/**
+ * Compares the operations of the piece picker on the BitFields of a
+ * Torrent with BITFIELD_PIECES pieces, near the end of the download:
+ * the peer has half of the pieces, at random, and only the last
+ * MISSING_PERCENTAGE percent of the pieces are still missing.
+ */
+void benchmarkBitfield(const BenchmarkOptions& options)
+{
+    std::mt19937_64 random(42);
+    std::string peerBytes(BITFIELD_PIECES / 8, '\0');
+    std::string haveBytes(BITFIELD_PIECES / 8, '\0');
+    for (char& byte : peerBytes)
+        byte = (char) random();
+    for (size_t i = 0; i < haveBytes.size(); i++)
+        haveBytes[i] = i < haveBytes.size() / 100 * (100 - MISSING_PERCENTAGE) ? (char) 0xFF : '\0';
+    Bitfield peerPieces = Bitfield::fromBytes(peerBytes, BITFIELD_PIECES);
+    Bitfield missingPieces = Bitfield(BITFIELD_PIECES, true).andNot(Bitfield::fromBytes(haveBytes, BITFIELD_PIECES));
+
+    std::cout << "Bitfield of " << BITFIELD_PIECES << " pieces, " << MISSING_PERCENTAGE
+              << "% missing (time per operation)" << std::endl;
+    std::cout << std::left << std::setw(36) << "operation" << std::right << std::setw(15) << "string"
+              << std::setw(15) << "Bitfield" << std::setw(11) << "speedup" << std::endl;
+    size_t total = 0;
+
+    double stringSeconds = fastestRun(options.repetitions, [&]
+    {
+        for (int i = 0; i < BITFIELD_ITERATIONS; i++)
+            for (int index = 0; index < BITFIELD_PIECES; index++)
+                total += hasPiece(peerBytes, index) && !hasPiece(haveBytes, index);
+    });
+    double bitfieldSeconds = fastestRun(options.repetitions, [&]
+    {
+        for (int i = 0; i < BITFIELD_ITERATIONS; i++)
+            total += peerPieces.countAnd(missingPieces);
+    });
+    report("count missing pieces of the peer", stringSeconds, bitfieldSeconds);
+
+    stringSeconds = fastestRun(options.repetitions, [&]
+    {
+        for (int i = 0; i < BITFIELD_ITERATIONS; i++)
+        {
+            int index = 0;
+            while (index < BITFIELD_PIECES && !(hasPiece(peerBytes, index) && !hasPiece(haveBytes, index)))
+                index++;
+            total += index;
+        }
+    });
+    bitfieldSeconds = fastestRun(options.repetitions, [&]
+    {
+        for (int i = 0; i < BITFIELD_ITERATIONS; i++)
+            total += peerPieces.findNextAnd(missingPieces);
+    });
+    report("find a missing piece of the peer", stringSeconds, bitfieldSeconds);
+
+    stringSeconds = fastestRun(options.repetitions, [&]
+    {
+        for (int i = 0; i < BITFIELD_ITERATIONS; i++)
+            for (int index = 0; index < BITFIELD_PIECES; index++)
+                total += hasPiece(peerBytes, index);
+    });
+    bitfieldSeconds = fastestRun(options.repetitions, [&]
+    {
+        for (int i = 0; i < BITFIELD_ITERATIONS; i++)
+            total += peerPieces.count();
+    });
+    report("count pieces of the peer", stringSeconds, bitfieldSeconds);
+    // Keeps the results alive, so that the loops are not optimised away
+    std::cout << "(checksum " << total << ")" << std::endl;
+}
@@ -0,0 +1,126 @@
+#include <random>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <thread>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <crypto/sha1_engine.h>
+
+#include "Benchmark.h"
+#include "PieceChecker.h"
+
+#define CHECKED_PIECE_LENGTH 262144 // 256 KiB, the default piece length of the Torrents created
+#define BYTES_PER_MIB 1048576
+#define WRITTEN_PIECES_INTERVAL 10 // one piece out of 10 has been downloaded
+#define SPARSE_FILE_NAME "check.sparse.bench"
+#define DENSE_FILE_NAME "check.dense.bench"
+
+/**
+ * Creates the file of a partial download, in which only one piece out of
+ * WRITTEN_PIECES_INTERVAL has been written. The other pieces are holes in
+ * the sparse file, and zeros written to disk in the dense one.
+ */
+static void writePartialFile(const std::string& path, const std::vector<std::string>& pieces, bool isSparse)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw std::runtime_error("Cannot create " + path);
+    std::string zeros(CHECKED_PIECE_LENGTH, '\0');
+    bool isWritten = ftruncate(fd, (off_t) (pieces.size() * CHECKED_PIECE_LENGTH)) == 0;
+    for (size_t index = 0; index < pieces.size() && isWritten; index++)
+    {
+        bool isDownloaded = index % WRITTEN_PIECES_INTERVAL == 0;
+        if (!isDownloaded && isSparse)
+            continue;
+        const std::string& data = isDownloaded ? pieces[index] : zeros;
+        isWritten = pwrite(fd, data.data(), data.size(), (off_t) (index * CHECKED_PIECE_LENGTH)) ==
+                    (ssize_t) data.size();
+    }
+    close(fd);
+    if (!isWritten)
+        throw std::runtime_error("Cannot write " + path);
+}
+
+/**
+ * Checks the pieces of the given file, with the progress of the
+ * PieceChecker discarded.
+ * @return the number of valid pieces.
+ */
+static size_t checkFile(const BenchmarkOptions& options, const std::string& name,
+                        const std::vector<std::string>& pieceHashes)
+{
+    std::vector<TorrentFile> torrentFiles = { { name, (long) (pieceHashes.size() * CHECKED_PIECE_LENGTH), 0, false } };
+    int threadCount = (int) std::max(1u, std::thread::hardware_concurrency());
+    std::stringstream discarded;
+    std::streambuf* output = std::cout.rdbuf(discarded.rdbuf());
+    size_t validPieces = 0;
+    try
+    {
+        PieceChecker checker(options.directory, torrentFiles, CHECKED_PIECE_LENGTH, pieceHashes, threadCount);
+        validPieces = checker.check().count();
+    }
+    catch (...)
+    {
+        std::cout.rdbuf(output);
+        throw;
+    }
+    std::cout.rdbuf(output);
+    return validPieces;
+}
+
+/**
+ * Measures the check (--check) of a partial download of 'sizeMb' MiB, in
+ * pieces of CHECKED_PIECE_LENGTH bytes, of which one out of
+ * WRITTEN_PIECES_INTERVAL has been downloaded: in a sparse file, whose
+ * holes are skipped without being read, and in a file of the same content
+ * whose missing pieces are zeros on disk, which is hashed whole. Both
+ * files are checked from the page cache, so reading them from the disk
+ * would only widen the gap.
+ */
+void benchmarkCheck(const BenchmarkOptions& options)
+{
+    size_t pieceCount = std::max((size_t) 1, options.sizeMb * BYTES_PER_MIB / CHECKED_PIECE_LENGTH);
+    std::vector<std::string> pieces(pieceCount);
+    std::vector<std::string> pieceHashes;
+    std::mt19937_64 random(42);
+    for (std::string& piece : pieces)
+    {
+        piece.resize(CHECKED_PIECE_LENGTH);
+        for (char& byte : piece)
+            byte = (char) random();
+        unsigned char digest[SHA1_DIGEST_LENGTH];
+        SHA1Engine::hash(piece.data(), piece.size(), digest);
+        pieceHashes.emplace_back((const char*) digest, SHA1_DIGEST_LENGTH);
+    }
+    writePartialFile(options.directory + SPARSE_FILE_NAME, pieces, true);
+    writePartialFile(options.directory + DENSE_FILE_NAME, pieces, false);
+    pieces.clear();
+
+    std::cout << "Checking " << pieceCount * CHECKED_PIECE_LENGTH / BYTES_PER_MIB << " MiB in pieces of "
+              << CHECKED_PIECE_LENGTH / 1024 << " KiB, 1 piece out of " << WRITTEN_PIECES_INTERVAL
+              << " downloaded" << std::endl;
+    std::cout << std::left << std::setw(32) << "file" << std::right << std::setw(14) << "valid pieces"
+              << std::setw(12) << "time" << std::setw(14) << "speedup" << std::endl;
+    size_t validPieces = 0;
+    double denseSeconds = fastestRun(options.repetitions, [&]
+    {
+        validPieces = checkFile(options, DENSE_FILE_NAME, pieceHashes);
+    });
+    std::cout << std::left << std::setw(32) << "zeros on disk (hashed whole)" << std::right << std::setw(14)
+              << validPieces << std::fixed << std::setprecision(3) << std::setw(10) << denseSeconds << " s"
+              << std::endl;
+    double sparseSeconds = fastestRun(options.repetitions, [&]
+    {
+        validPieces = checkFile(options, SPARSE_FILE_NAME, pieceHashes);
+    });
+    std::cout << std::left << std::setw(32) << "sparse file (holes skipped)" << std::right << std::setw(14)
+              << validPieces << std::fixed << std::setprecision(3) << std::setw(10) << sparseSeconds << " s"
+              << std::setprecision(1) << std::setw(13) << denseSeconds / sparseSeconds << "x" << std::endl;
+    unlink((options.directory + SPARSE_FILE_NAME).c_str());
+    unlink((options.directory + DENSE_FILE_NAME).c_str());
+}
@@ -0,0 +1,128 @@
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <numeric>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <unistd.h>
+
+#include "Benchmark.h"
+#include "DiskWriter.h"
+
+#define WRITTEN_PIECE_LENGTH 262144 // 256 KiB, the default piece length of the Torrents created
+#define WRITTEN_BLOCK_LENGTH 16384  // 16 KiB, the size of the Blocks requested from the peers
+#define BYTES_PER_MIB 1048576
+#define WRITER_FILE_NAME "writer.bench"
+
+/**
+ * The result of writing the whole file once through the DiskWriter.
+ */
+struct WriterRun
+{
+    double seconds;
+    unsigned long writeCalls;
+};
+
+/**
+ * Queues the given writes, as (offset, length) pairs, to a DiskWriter on
+ * a new file, then waits for them to be written and flushes the file. The
+ * time covers the queueing, the writes and the flush.
+ */
+static WriterRun writeQueued(const BenchmarkOptions& options, const std::vector<std::pair<long, size_t>>& writes,
+                             const std::string& data, size_t coalesceLimit)
+{
+    std::string path = options.directory + WRITER_FILE_NAME;
+    unlink(path.c_str());
+    std::vector<TorrentFile> torrentFiles = { { WRITER_FILE_NAME, (long) data.size(), 0, false } };
+    // Copied before the measurement, as the writer takes the data over
+    std::vector<std::string> buffers;
+    for (auto const& [offset, length] : writes)
+        buffers.push_back(data.substr(offset, length));
+    WriterRun run {};
+    {
+        Storage storage(options.directory, torrentFiles);
+        MemoryBudget budget(0);
+        DiskWriter writer(storage, budget, coalesceLimit, [](Piece*, bool) {});
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < writes.size(); i++)
+            writer.write(nullptr, writes[i].first, std::move(buffers[i]));
+        writer.drain();
+        storage.flush();
+        run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        run.writeCalls = writer.getWriteCalls();
+    }
+    unlink(path.c_str());
+    return run;
+}
+
+/**
+ * Prints the throughput and the number of write calls of a run, without
+ * and with merging of the writes.
+ */
+static void report(const std::string& workload, size_t bytes, const WriterRun& separate, const WriterRun& merged)
+{
+    std::cout << std::left << std::setw(28) << workload << std::right << std::fixed << std::setprecision(0)
+              << std::setw(8) << (double) bytes / separate.seconds / BYTES_PER_MIB << " MiB/s"
+              << std::setw(10) << separate.writeCalls
+              << std::setw(8) << (double) bytes / merged.seconds / BYTES_PER_MIB << " MiB/s"
+              << std::setw(10) << merged.writeCalls << std::endl;
+}
+
+/**
+ * Measures the DiskWriter on 'sizeMb' MiB, without merging the writes and
+ * with merged writes of up to 'coalesceLimit' bytes (the default of
+ * --write-coalesce): whole pieces of WRITTEN_PIECE_LENGTH bytes, written
+ * once they are verified, and Blocks of WRITTEN_BLOCK_LENGTH bytes, as
+ * written with --write-through, with the pieces in order and at random.
+ */
+void benchmarkDiskWriter(const BenchmarkOptions& options)
+{
+    size_t coalesceLimit = 1024 * 1024;
+    size_t pieceCount = std::max((size_t) 1, options.sizeMb * BYTES_PER_MIB / WRITTEN_PIECE_LENGTH);
+    std::string data(pieceCount * WRITTEN_PIECE_LENGTH, '\0');
+    std::mt19937_64 random(42);
+    for (char& byte : data)
+        byte = (char) random();
+    std::vector<size_t> pieceOrder(pieceCount);
+    std::iota(pieceOrder.begin(), pieceOrder.end(), 0);
+
+    std::vector<std::pair<long, size_t>> pieceWrites;
+    std::vector<std::pair<long, size_t>> blockWrites;
+    for (size_t index : pieceOrder)
+    {
+        pieceWrites.emplace_back((long) (index * WRITTEN_PIECE_LENGTH), WRITTEN_PIECE_LENGTH);
+        for (size_t offset = 0; offset < WRITTEN_PIECE_LENGTH; offset += WRITTEN_BLOCK_LENGTH)
+            blockWrites.emplace_back((long) (index * WRITTEN_PIECE_LENGTH + offset), WRITTEN_BLOCK_LENGTH);
+    }
+    std::shuffle(pieceOrder.begin(), pieceOrder.end(), random);
+    std::vector<std::pair<long, size_t>> randomBlockWrites;
+    for (size_t index : pieceOrder)
+        for (size_t offset = 0; offset < WRITTEN_PIECE_LENGTH; offset += WRITTEN_BLOCK_LENGTH)
+            randomBlockWrites.emplace_back((long) (index * WRITTEN_PIECE_LENGTH + offset), WRITTEN_BLOCK_LENGTH);
+
+    std::cout << "Writing " << data.size() / BYTES_PER_MIB << " MiB through the disk writer to "
+              << options.directory << WRITER_FILE_NAME << ", merged writes of up to " << coalesceLimit / 1024
+              << " KiB" << std::endl;
+    std::cout << std::left << std::setw(28) << "writes" << std::right << std::setw(14) << "separate"
+              << std::setw(10) << "calls" << std::setw(14) << "merged" << std::setw(10) << "calls" << std::endl;
+    struct Workload { std::string name; const std::vector<std::pair<long, size_t>>& writes; };
+    for (const Workload& workload : { Workload { "pieces, in order", pieceWrites },
+                                      Workload { "blocks, pieces in order", blockWrites },
+                                      Workload { "blocks, pieces at random", randomBlockWrites } })
+    {
+        WriterRun separate {};
+        WriterRun merged {};
+        for (int i = 0; i < options.repetitions; i++)
+        {
+            WriterRun run = writeQueued(options, workload.writes, data, 0);
+            if (i == 0 || run.seconds < separate.seconds)
+                separate = run;
+            run = writeQueued(options, workload.writes, data, coalesceLimit);
+            if (i == 0 || run.seconds < merged.seconds)
+                merged = run;
+        }
+        report(workload.name, data.size(), separate, merged);
+    }
+}
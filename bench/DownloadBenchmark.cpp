@@ -0,0 +1,321 @@
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <thread>
+#include <stdexcept>
+#include <filesystem>
+#include <functional>
+#include <exception>
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <crypto/sha256_engine.h>
+
+#include "Benchmark.h"
+#include "PieceManager.h"
+#include "TorrentCreator.h"
+#include "MerkleTree.h"
+
+#define LARGE_PIECE_LENGTH 16777216 // 16 MiB, the piece length of the Torrents of large files
+#define BYTES_PER_MIB 1048576
+#define SIMULATED_PEERS 8
+#define VERIFIED_PIECE_LENGTH 1048576 // 1 MiB, i.e. 64 Blocks verified at once with v1
+#define CORRUPT_PEERS 2
+#define CORRUPTION_RATE 0.01 // probability that a corrupt peer corrupts a Block
+#define DOWNLOAD_FILE_NAME "download.bench"
+#define DOWNLOAD_DIRECTORY_NAME "download.bench.out"
+
+/**
+ * The peers of a simulated download.
+ */
+struct SimulatedSwarm
+{
+    int peerCount;
+    // Whether each peer only has its own share of the pieces, so that every
+    // peer works on a different piece, or all the pieces
+    bool isSplit;
+    // The first 'corruptPeers' peers corrupt each Block they send with the
+    // given probability
+    int corruptPeers;
+    double corruptionRate;
+};
+
+/**
+ * The result of a simulated download, measured in the process which ran it.
+ */
+struct DownloadRun
+{
+    double seconds;
+    // Peak resident memory of the process, in bytes
+    long peakMemory;
+    unsigned long wastedBytes;
+    int bannedPeers;
+};
+
+/**
+ * Creates the source file of a synthetic Torrent of 'sizeMb' MiB in the
+ * benchmark directory, and its Torrent file.
+ * @return the path of the Torrent file.
+ */
+static std::string createSyntheticTorrent(const BenchmarkOptions& options, long pieceLength, bool hybrid)
+{
+    std::string sourcePath = options.directory + DOWNLOAD_FILE_NAME;
+    std::string torrentPath = sourcePath + (hybrid ? ".v2.torrent" : ".torrent");
+    writeRandomFile(sourcePath, std::max((size_t) 1, options.sizeMb) * BYTES_PER_MIB);
+    std::stringstream discarded;
+    std::streambuf* output = std::cout.rdbuf(discarded.rdbuf());
+    try
+    {
+        TorrentCreator creator(sourcePath, pieceLength, 1, hybrid);
+        creator.create(torrentPath, "");
+    }
+    catch (...)
+    {
+        std::cout.rdbuf(output);
+        throw;
+    }
+    std::cout.rdbuf(output);
+    return torrentPath;
+}
+
+/**
+ * Runs a measurement in a child process, so that its peak resident memory
+ * is its own, and the progress bar of the download is discarded.
+ */
+static DownloadRun runInChild(const std::function<DownloadRun()>& measurement)
+{
+    int results[2];
+    if (pipe(results) < 0)
+        throw std::runtime_error("Cannot create a pipe for the download benchmark");
+    pid_t child = fork();
+    if (child < 0)
+        throw std::runtime_error("Cannot fork the download benchmark");
+    if (child == 0)
+    {
+        close(results[0]);
+        int nullOutput = open("/dev/null", O_WRONLY);
+        dup2(nullOutput, STDOUT_FILENO);
+        try
+        {
+            DownloadRun run = measurement();
+            _exit(write(results[1], &run, sizeof(run)) == sizeof(run) ? 0 : 1);
+        }
+        catch (std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+            _exit(1);
+        }
+    }
+    close(results[1]);
+    DownloadRun run {};
+    bool hasResult = read(results[0], &run, sizeof(run)) == sizeof(run);
+    close(results[0]);
+    int status = 0;
+    struct rusage usage {};
+    wait4(child, &status, 0, &usage);
+    if (!hasResult || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        throw std::runtime_error("The simulated download failed");
+    // In KiB on Linux
+    run.peakMemory = usage.ru_maxrss * 1024L;
+    return run;
+}
+
+/**
+ * Computes the leaf hashes of a piece of the source file, as sent by a
+ * peer in reply to a Hash Request. The leaves beyond the end of the file
+ * are zeros.
+ */
+static std::vector<std::string> leafHashes(int source, int pieceIndex, size_t leafCount, long fileSize)
+{
+    std::vector<std::string> hashes;
+    std::string leaf(MERKLE_LEAF_SIZE, '\0');
+    for (size_t i = 0; i < leafCount; i++)
+    {
+        long offset = (long) (pieceIndex * leafCount + i) * MERKLE_LEAF_SIZE;
+        if (offset >= fileSize)
+        {
+            hashes.emplace_back(SHA256_DIGEST_LENGTH, '\0');
+            continue;
+        }
+        size_t length = std::min((long) MERKLE_LEAF_SIZE, fileSize - offset);
+        if (pread(source, &leaf[0], length, offset) < 0)
+            throw std::runtime_error("Cannot read the source file of the download benchmark");
+        hashes.push_back(MerkleTree::hashLeaf(leaf.data(), length));
+    }
+    return hashes;
+}
+
+/**
+ * Downloads the synthetic Torrent with a PieceManager, from simulated
+ * peers which send the Blocks read from the source file as soon as they
+ * are requested, each from its own thread. The peers also answer the
+ * Hash Requests of v2 Torrents.
+ */
+static DownloadRun simulateDownload(const BenchmarkOptions& options, const std::string& torrentPath,
+                                    const SimulatedSwarm& swarm, const DownloadOptions& downloadOptions)
+{
+    std::string downloadDirectory = options.directory + DOWNLOAD_DIRECTORY_NAME + "/";
+    TorrentFileParser fileParser(torrentPath);
+    long pieceLength = fileParser.getPieceLength();
+    size_t pieceCount = (fileParser.getFileSize() + pieceLength - 1) / pieceLength;
+    int source = open((options.directory + DOWNLOAD_FILE_NAME).c_str(), O_RDONLY);
+    if (source < 0)
+        throw std::runtime_error("Cannot open the source file of the download benchmark");
+
+    std::filesystem::create_directories(downloadDirectory);
+    DownloadRun run {};
+    auto start = std::chrono::steady_clock::now();
+    {
+        PieceManager pieceManager(fileParser, downloadDirectory, swarm.peerCount, downloadOptions);
+        std::vector<std::string> peerIds;
+        for (int i = 0; i < swarm.peerCount; i++)
+        {
+            Bitfield peerPieces(pieceCount, !swarm.isSplit);
+            for (size_t index = i; swarm.isSplit && index < pieceCount; index += swarm.peerCount)
+                peerPieces.set(index);
+            peerIds.push_back("-BENCH-" + std::to_string(i));
+            pieceManager.addPeer(peerIds.back(), peerPieces.toBytes());
+        }
+        // One thread per peer, as for the connections of the client, since
+        // a request waits while the memory budget is used up
+        std::vector<std::thread> peerThreads;
+        std::vector<std::exception_ptr> peerErrors(peerIds.size());
+        std::atomic<bool> hasFailed { false };
+        for (size_t i = 0; i < peerIds.size(); i++)
+        {
+            peerThreads.emplace_back([&, i]
+            {
+                std::mt19937 random(i);
+                std::bernoulli_distribution isCorrupted((int) i < swarm.corruptPeers ? swarm.corruptionRate : 0);
+                try
+                {
+                    while (!pieceManager.isComplete() && !hasFailed)
+                    {
+                        int hashedPiece = pieceManager.nextHashRequest(peerIds[i]);
+                        if (hashedPiece >= 0)
+                            pieceManager.hashesReceived(peerIds[i], hashedPiece,
+                                                        leafHashes(source, hashedPiece, pieceManager.getLeavesPerPiece(),
+                                                                   fileParser.getFileSize()));
+                        Block* block = pieceManager.nextRequest(peerIds[i]);
+                        if (!block)
+                        {
+                            // Waits for the pieces being hashed or written
+                            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                            continue;
+                        }
+                        std::string data(block->length, '\0');
+                        long offset = (long) block->piece * pieceLength + block->offset;
+                        if (pread(source, &data[0], data.size(), offset) < 0)
+                            throw std::runtime_error("Cannot read the source file of the download benchmark");
+                        if (isCorrupted(random))
+                            data[0] ^= (char) 0xFF;
+                        pieceManager.blockReceived(peerIds[i], block->piece, block->offset, std::move(data));
+                    }
+                }
+                catch (...)
+                {
+                    peerErrors[i] = std::current_exception();
+                    hasFailed = true;
+                    pieceManager.stopRequests();
+                }
+            });
+        }
+        for (std::thread& thread : peerThreads)
+            thread.join();
+        for (const std::exception_ptr& error : peerErrors)
+        {
+            if (error)
+                std::rethrow_exception(error);
+        }
+        run.wastedBytes = pieceManager.getWastedBytes();
+        for (const std::string& peerId : peerIds)
+            run.bannedPeers += pieceManager.isBanned(peerId);
+    }
+    close(source);
+    std::filesystem::remove_all(downloadDirectory);
+    run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return run;
+}
+
+/**
+ * Compares the peak resident memory of the downloads of a synthetic
+ * Torrent of 'sizeMb' MiB in pieces of LARGE_PIECE_LENGTH bytes, with the
+ * Blocks kept in memory until their Piece is verified and with the Blocks
+ * written as they arrive (--write-through). Each of the SIMULATED_PEERS
+ * peers has its own share of the pieces, so that as many pieces are
+ * downloaded at once. The downloads are made without the memory budget,
+ * which would otherwise bound both, and with it.
+ */
+void benchmarkMemory(const BenchmarkOptions& options)
+{
+    std::string torrentPath = createSyntheticTorrent(options, LARGE_PIECE_LENGTH, false);
+    std::cout << "Downloading " << std::max((size_t) 1, options.sizeMb) << " MiB in pieces of "
+              << LARGE_PIECE_LENGTH / BYTES_PER_MIB << " MiB from " << SIMULATED_PEERS
+              << " peers, each with its own share of the pieces" << std::endl;
+    std::cout << std::left << std::setw(24) << "mode" << std::setw(16) << "memory budget" << std::right
+              << std::setw(14) << "peak memory" << std::setw(12) << "time" << std::endl;
+    SimulatedSwarm swarm { SIMULATED_PEERS, true, 0, 0 };
+    for (bool writeThrough : { false, true })
+    {
+        for (size_t budgetBytes : { (size_t) 0, DownloadOptions().memoryBudgetBytes })
+        {
+            DownloadOptions downloadOptions;
+            downloadOptions.writeThrough = writeThrough;
+            downloadOptions.memoryBudgetBytes = budgetBytes;
+            DownloadRun fastest {};
+            for (int i = 0; i < options.repetitions; i++)
+            {
+                DownloadRun run = runInChild([&] { return simulateDownload(options, torrentPath, swarm, downloadOptions); });
+                if (i == 0 || run.peakMemory < fastest.peakMemory)
+                    fastest = run;
+            }
+            std::cout << std::left << std::setw(24) << (writeThrough ? "write-through" : "in memory") << std::setw(16)
+                      << (budgetBytes == 0 ? "none" : std::to_string(budgetBytes / BYTES_PER_MIB) + " MiB")
+                      << std::right << std::fixed << std::setprecision(0) << std::setw(10)
+                      << (double) fastest.peakMemory / BYTES_PER_MIB << " MiB" << std::setprecision(2)
+                      << std::setw(10) << fastest.seconds << " s" << std::endl;
+        }
+    }
+    unlink((options.directory + DOWNLOAD_FILE_NAME).c_str());
+    unlink(torrentPath.c_str());
+}
+
+/**
+ * Compares the data wasted on corrupt Blocks by the downloads of synthetic
+ * v1 and v2 Torrents of 'sizeMb' MiB in pieces of VERIFIED_PIECE_LENGTH
+ * bytes, from SIMULATED_PEERS peers which all have all the pieces, the
+ * first CORRUPT_PEERS of which corrupt a Block now and then. With v1, a
+ * corrupt Block is only found once its whole piece is verified, and the
+ * piece is downloaded again; with v2, each Block is verified on its own
+ * against the Merkle tree of the file.
+ */
+void benchmarkCorruption(const BenchmarkOptions& options)
+{
+    std::cout << "Downloading " << std::max((size_t) 1, options.sizeMb) << " MiB in pieces of "
+              << VERIFIED_PIECE_LENGTH / 1024 << " KiB from " << SIMULATED_PEERS << " peers, " << CORRUPT_PEERS
+              << " of which corrupt " << CORRUPTION_RATE * 100 << "% of their Blocks" << std::endl;
+    std::cout << std::left << std::setw(28) << "verification" << std::right << std::setw(14) << "wasted"
+              << std::setw(16) << "peers banned" << std::setw(12) << "time" << std::endl;
+    SimulatedSwarm swarm { SIMULATED_PEERS, false, CORRUPT_PEERS, CORRUPTION_RATE };
+    for (bool hybrid : { false, true })
+    {
+        std::string torrentPath = createSyntheticTorrent(options, VERIFIED_PIECE_LENGTH, hybrid);
+        for (int i = 0; i < options.repetitions; i++)
+        {
+            DownloadRun run = runInChild([&] { return simulateDownload(options, torrentPath, swarm, DownloadOptions()); });
+            std::cout << std::left << std::setw(28) << (hybrid ? "v2, Blocks (Merkle tree)" : "v1, pieces (SHA-1)")
+                      << std::right << std::fixed << std::setprecision(2) << std::setw(10)
+                      << (double) run.wastedBytes / BYTES_PER_MIB << " MiB" << std::setw(16) << run.bannedPeers
+                      << std::setw(10) << run.seconds << " s" << std::endl;
+        }
+        unlink(torrentPath.c_str());
+    }
+    unlink((options.directory + DOWNLOAD_FILE_NAME).c_str());
+}
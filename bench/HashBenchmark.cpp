@@ -0,0 +1,93 @@
+#include <array>
+#include <cstring>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <crypto/sha1.h>
+#include <crypto/sha1_engine.h>
+#include <crypto/sha1_multi_buffer.h>
+#include <crypto/sha256_engine.h>
+
+#include "Benchmark.h"
+#include "MerkleTree.h"
+
+#define HASHED_PIECE_LENGTH 262144 // 256 KiB, the default piece length of the Torrents created
+#define BYTES_PER_MIB 1048576
+
+/**
+ * Prints the throughput of a hash function.
+ */
+static void report(const std::string& function, const std::string& backend, size_t bytes, double seconds)
+{
+    std::cout << std::left << std::setw(28) << function << std::setw(16) << backend << std::right << std::fixed
+              << std::setprecision(2) << std::setw(8) << (double) bytes / seconds / 1e9 << " GB/s" << std::endl;
+}
+
+/**
+ * Measures the throughput of the hash functions which verify the pieces,
+ * on 'sizeMb' MiB of random data split into pieces of HASHED_PIECE_LENGTH
+ * bytes: the legacy string-based SHA-1, SHA1Engine with the backend
+ * selected at runtime (see SHA1_BACKEND), the multi-buffer SHA-1 on
+ * batches of pieces (see SHA1_MULTI_BUFFER), and the SHA-256 leaf hashes
+ * of v2 Torrents (see SHA256_BACKEND).
+ */
+void benchmarkHash(const BenchmarkOptions& options)
+{
+    size_t pieceCount = std::max((size_t) 1, options.sizeMb * BYTES_PER_MIB / HASHED_PIECE_LENGTH);
+    std::string data(pieceCount * HASHED_PIECE_LENGTH, '\0');
+    std::mt19937_64 random(42);
+    for (size_t i = 0; i + sizeof(uint64_t) <= data.size(); i += sizeof(uint64_t))
+    {
+        uint64_t value = random();
+        memcpy(&data[i], &value, sizeof(value));
+    }
+    std::cout << "Hashing " << data.size() / BYTES_PER_MIB << " MiB in pieces of " << HASHED_PIECE_LENGTH / 1024
+              << " KiB" << std::endl;
+    unsigned char check = 0;
+
+    double seconds = fastestRun(options.repetitions, [&]
+    {
+        for (size_t offset = 0; offset < data.size(); offset += HASHED_PIECE_LENGTH)
+            check ^= (unsigned char) sha1(data.substr(offset, HASHED_PIECE_LENGTH))[0];
+    });
+    report("sha1() (legacy)", "portable", data.size(), seconds);
+
+    seconds = fastestRun(options.repetitions, [&]
+    {
+        unsigned char digest[SHA1_DIGEST_LENGTH];
+        for (size_t offset = 0; offset < data.size(); offset += HASHED_PIECE_LENGTH)
+        {
+            SHA1Engine::hash(data.data() + offset, HASHED_PIECE_LENGTH, digest);
+            check ^= digest[0];
+        }
+    });
+    report("SHA1Engine", SHA1Engine::backendName(), data.size(), seconds);
+
+    seconds = fastestRun(options.repetitions, [&]
+    {
+        size_t batchSize = SHA1MultiBuffer::lanes();
+        std::vector<std::array<unsigned char, SHA1_DIGEST_LENGTH>> digests;
+        for (size_t first = 0; first < pieceCount; first += batchSize)
+        {
+            std::vector<std::vector<SHA1Span>> messages;
+            for (size_t index = first; index < std::min(first + batchSize, pieceCount); index++)
+                messages.push_back({ { data.data() + index * HASHED_PIECE_LENGTH, HASHED_PIECE_LENGTH } });
+            SHA1MultiBuffer::hash(messages, digests);
+            check ^= digests[0][0];
+        }
+    });
+    report("SHA1MultiBuffer (" + std::to_string(SHA1MultiBuffer::lanes()) + " lanes)",
+           SHA1MultiBuffer::backendName(), data.size(), seconds);
+
+    seconds = fastestRun(options.repetitions, [&]
+    {
+        for (size_t offset = 0; offset < data.size(); offset += MERKLE_LEAF_SIZE)
+            check ^= (unsigned char) MerkleTree::hashLeaf(data.data() + offset, MERKLE_LEAF_SIZE)[0];
+    });
+    report("SHA-256 Merkle leaves", SHA256Engine::backendName(), data.size(), seconds);
+    // Keeps the digests alive, so that the hashing is not optimised away
+    std::cout << "(checksum " << (int) check << ")" << std::endl;
+}
@@ -0,0 +1,122 @@
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <numeric>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <unistd.h>
+
+#include "Benchmark.h"
+#include "Storage.h"
+
+#define STORED_PIECE_LENGTH 262144 // 256 KiB, the default piece length of the Torrents created
+#define BYTES_PER_MIB 1048576
+#define STORAGE_FILE_NAME "storage.bench"
+
+/**
+ * The result of writing the whole file once.
+ */
+struct StorageRun
+{
+    double seconds;
+    long extents;
+    long cachedSize;
+};
+
+/**
+ * Writes the pieces to a new file in the given order, then flushes it to
+ * disk. The time covers the creation and preallocation of the file, the
+ * writes and the flush, i.e. everything the download spends on the disk.
+ */
+static StorageRun writeFile(const BenchmarkOptions& options, const std::vector<size_t>& order,
+                            const std::string& data, bool memoryMapped, Preallocation preallocation, bool directIo)
+{
+    std::string path = options.directory + STORAGE_FILE_NAME;
+    unlink(path.c_str());
+    std::vector<TorrentFile> torrentFiles = { { STORAGE_FILE_NAME, (long) (order.size() * STORED_PIECE_LENGTH), 0, false } };
+    auto start = std::chrono::steady_clock::now();
+    StorageRun run {};
+    {
+        Storage storage(options.directory, torrentFiles, memoryMapped, preallocation, directIo);
+        for (size_t index : order)
+            storage.write((long) (index * STORED_PIECE_LENGTH), data.data() + index * STORED_PIECE_LENGTH,
+                          STORED_PIECE_LENGTH);
+        storage.flush();
+        run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        run.extents = storage.countExtents();
+        run.cachedSize = storage.getCachedSize();
+    }
+    unlink(path.c_str());
+    return run;
+}
+
+/**
+ * Keeps the fastest of the given number of runs.
+ */
+static StorageRun fastestWrite(const BenchmarkOptions& options, const std::vector<size_t>& order,
+                               const std::string& data, bool memoryMapped, Preallocation preallocation, bool directIo)
+{
+    StorageRun fastest {};
+    for (int i = 0; i < options.repetitions; i++)
+    {
+        StorageRun run = writeFile(options, order, data, memoryMapped, preallocation, directIo);
+        if (i == 0 || run.seconds < fastest.seconds)
+            fastest = run;
+    }
+    return fastest;
+}
+
+/**
+ * Prints the throughput of a run, with the fragmentation of the file and
+ * how much of it was left in the page cache.
+ */
+static void report(const std::string& backend, const std::string& order, size_t bytes, const StorageRun& run)
+{
+    std::cout << std::left << std::setw(24) << backend << std::setw(12) << order << std::right << std::fixed
+              << std::setprecision(0) << std::setw(8) << (double) bytes / run.seconds / BYTES_PER_MIB << " MiB/s"
+              << std::setw(10) << run.extents << std::setw(12)
+              << (run.cachedSize < 0 ? -1.0 : (double) run.cachedSize / BYTES_PER_MIB) << " MiB" << std::endl;
+}
+
+/**
+ * Measures the writes of 'sizeMb' MiB of pieces of STORED_PIECE_LENGTH
+ * bytes to a file of the benchmark directory, in the order of the pieces
+ * and in a random order (as they arrive from the peers): with pwrite, with
+ * memory mappings and with direct I/O, then with pwrite and each of the
+ * preallocation policies. The extents are the number of contiguous runs
+ * of disk blocks making up the file (-1 without FIEMAP).
+ */
+void benchmarkStorage(const BenchmarkOptions& options)
+{
+    size_t pieceCount = std::max((size_t) 1, options.sizeMb * BYTES_PER_MIB / STORED_PIECE_LENGTH);
+    std::string data(pieceCount * STORED_PIECE_LENGTH, '\0');
+    std::mt19937_64 random(42);
+    for (char& byte : data)
+        byte = (char) random();
+    std::vector<size_t> sequentialOrder(pieceCount);
+    std::iota(sequentialOrder.begin(), sequentialOrder.end(), 0);
+    std::vector<size_t> randomOrder = sequentialOrder;
+    std::shuffle(randomOrder.begin(), randomOrder.end(), random);
+
+    std::cout << "Writing " << data.size() / BYTES_PER_MIB << " MiB in pieces of " << STORED_PIECE_LENGTH / 1024
+              << " KiB to " << options.directory << STORAGE_FILE_NAME << std::endl;
+    std::cout << std::left << std::setw(24) << "backend" << std::setw(12) << "order" << std::right << std::setw(14)
+              << "throughput" << std::setw(10) << "extents" << std::setw(16) << "page cache" << std::endl;
+    struct Backend { std::string name; bool memoryMapped; bool directIo; };
+    for (const Backend& backend : { Backend { "pwrite", false, false }, Backend { "mmap", true, false },
+                                    Backend { "direct I/O", false, true } })
+    {
+        report(backend.name, "sequential", data.size(),
+               fastestWrite(options, sequentialOrder, data, backend.memoryMapped, sparseFile, backend.directIo));
+        report(backend.name, "random", data.size(),
+               fastestWrite(options, randomOrder, data, backend.memoryMapped, sparseFile, backend.directIo));
+    }
+
+    struct Policy { std::string name; Preallocation preallocation; };
+    for (const Policy& policy : { Policy { "pwrite, sparse", sparseFile }, Policy { "pwrite, fallocate", allocatedFile },
+                                  Policy { "pwrite, zero-filled", zeroFilledFile } })
+        report(policy.name, "random", data.size(),
+               fastestWrite(options, randomOrder, data, false, policy.preallocation, false));
+}
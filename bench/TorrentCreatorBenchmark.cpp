@@ -0,0 +1,71 @@
+#include <chrono>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <thread>
+#include <unistd.h>
+
+#include "Benchmark.h"
+#include "TorrentCreator.h"
+
+#define CREATED_PIECE_LENGTH 262144 // 256 KiB, the default piece length of the Torrents created
+#define BYTES_PER_MIB 1048576
+#define SOURCE_FILE_NAME "source.bench"
+#define CREATED_TORRENT_NAME "source.bench.torrent"
+
+/**
+ * Creates the Torrent file of the source file, with the output of the
+ * TorrentCreator discarded.
+ */
+static void createTorrent(const BenchmarkOptions& options, int threadCount, bool hybrid)
+{
+    std::stringstream discarded;
+    std::streambuf* output = std::cout.rdbuf(discarded.rdbuf());
+    try
+    {
+        TorrentCreator creator(options.directory + SOURCE_FILE_NAME, CREATED_PIECE_LENGTH, threadCount, hybrid);
+        creator.create(options.directory + CREATED_TORRENT_NAME, "");
+    }
+    catch (...)
+    {
+        std::cout.rdbuf(output);
+        throw;
+    }
+    std::cout.rdbuf(output);
+}
+
+/**
+ * Measures the creation of the Torrent file of a file of 'sizeMb' MiB of
+ * the benchmark directory, in pieces of CREATED_PIECE_LENGTH bytes, as v1
+ * and as hybrid Torrents, with one hasher thread and with one per core.
+ * The file is read once before the measurements, so that it is hashed
+ * from the page cache.
+ */
+void benchmarkTorrentCreator(const BenchmarkOptions& options)
+{
+    std::string path = options.directory + SOURCE_FILE_NAME;
+    size_t size = std::max((size_t) 1, options.sizeMb) * BYTES_PER_MIB;
+    writeRandomFile(path, size);
+
+    int cores = (int) std::max(1u, std::thread::hardware_concurrency());
+    std::cout << "Creating the Torrent of " << size / BYTES_PER_MIB << " MiB in pieces of "
+              << CREATED_PIECE_LENGTH / 1024 << " KiB (" << cores << (cores == 1 ? " core)" : " cores)") << std::endl;
+    createTorrent(options, cores, false);
+    for (bool hybrid : { false, true })
+    {
+        for (int threadCount : { 1, cores })
+        {
+            double seconds = fastestRun(options.repetitions, [&] { createTorrent(options, threadCount, hybrid); });
+            std::cout << std::left << std::setw(12) << (hybrid ? "hybrid" : "v1") << std::setw(12)
+                      << std::to_string(threadCount) + (threadCount == 1 ? " thread" : " threads") << std::right
+                      << std::fixed << std::setprecision(2) << std::setw(8) << (double) size / seconds / 1e9
+                      << " GB/s" << std::endl;
+            if (cores == 1)
+                break;
+        }
+    }
+    unlink(path.c_str());
+    unlink((options.directory + CREATED_TORRENT_NAME).c_str());
+}
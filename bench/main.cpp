@@ -0,0 +1,64 @@
+#include <map>
+#include <string>
+#include <iostream>
+#include <functional>
+#include <cxxopts/cxxopts.hpp>
+#include <loguru/loguru.hpp>
+
+#include "Benchmark.h"
+
+int main(int argc, const char* argv[])
+{
+    // The statistics logged by the classes measured would mix with the results
+    loguru::g_stderr_verbosity = loguru::Verbosity_WARNING;
+    std::map<std::string, std::function<void(const BenchmarkOptions&)>> benchmarks = {
+        { "bitfield", benchmarkBitfield },
+        { "check", benchmarkCheck },
+        { "corruption", benchmarkCorruption },
+        { "create", benchmarkTorrentCreator },
+        { "hash", benchmarkHash },
+        { "memory", benchmarkMemory },
+        { "storage", benchmarkStorage },
+        { "writer", benchmarkDiskWriter }
+    };
+
+    cxxopts::Options options("BitTorrentBenchmark", "Microbenchmarks of the BitTorrent client");
+    options.set_width(80).set_tab_expansion().add_options()
+            ("benchmark", "Benchmark to run: bitfield, check, corruption, create, hash, memory, storage, writer, or all", cxxopts::value<std::string>()->default_value("all"))
+            ("s,size", "Size in MiB of the data hashed or written by each measurement", cxxopts::value<size_t>()->default_value("256"))
+            ("r,repetitions", "Number of runs of each measurement, of which the fastest is reported", cxxopts::value<int>()->default_value("3"))
+            ("d,directory", "Directory in which the benchmark files are written", cxxopts::value<std::string>()->default_value("."))
+            ("h,help", "Print arguments and their descriptions")
+            ;
+    options.parse_positional({ "benchmark" });
+    options.positional_help("[benchmark]");
+    try
+    {
+        auto parsedOptions = options.parse(argc, argv);
+        if (parsedOptions.count("help"))
+        {
+            std::cout << options.help() << std::endl;
+            return 0;
+        }
+        BenchmarkOptions benchmarkOptions;
+        benchmarkOptions.sizeMb = parsedOptions["size"].as<size_t>();
+        benchmarkOptions.repetitions = std::max(1, parsedOptions["repetitions"].as<int>());
+        benchmarkOptions.directory = parsedOptions["directory"].as<std::string>() + "/";
+        std::string name = parsedOptions["benchmark"].as<std::string>();
+        if (name != "all" && !benchmarks.count(name))
+            throw std::invalid_argument("Unknown benchmark: " + name);
+        for (const auto& benchmark : benchmarks)
+        {
+            if (name != "all" && benchmark.first != name)
+                continue;
+            benchmark.second(benchmarkOptions);
+            std::cout << std::endl;
+        }
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
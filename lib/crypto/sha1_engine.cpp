@@ -0,0 +1,328 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include <openssl/sha.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA1_ENGINE_X86
+#endif
+
+#include "sha1_engine.h"
+
+#define SHA1_ROL32(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+
+namespace
+{
+
+/**
+ * Processes 'count' consecutive 64-byte blocks, updating the five
+ * 32-bit words of the hash state.
+ */
+typedef void (*CompressFunction)(uint32_t state[5], const unsigned char* blocks, size_t count);
+
+uint32_t loadBigEndian(const unsigned char* bytes)
+{
+    return ((uint32_t) bytes[0] << 24) | ((uint32_t) bytes[1] << 16) | ((uint32_t) bytes[2] << 8) | bytes[3];
+}
+
+void storeBigEndian(unsigned char* bytes, uint32_t value)
+{
+    bytes[0] = (unsigned char) (value >> 24);
+    bytes[1] = (unsigned char) (value >> 16);
+    bytes[2] = (unsigned char) (value >> 8);
+    bytes[3] = (unsigned char) value;
+}
+
+// ---------------------------------------------------------------------------
+// Portable implementation
+// ---------------------------------------------------------------------------
+
+void compressPortable(uint32_t state[5], const unsigned char* blocks, size_t count)
+{
+    for (; count > 0; count--, blocks += SHA1_BLOCK_LENGTH)
+    {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++)
+            w[i] = loadBigEndian(blocks + 4 * i);
+        for (int i = 16; i < 80; i++)
+            w[i] = SHA1_ROL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+        for (int i = 0; i < 80; i++)
+        {
+            uint32_t f, k;
+            if (i < 20)
+            {
+                f = (b & c) | (~b & d);
+                k = 0x5a827999;
+            }
+            else if (i < 40)
+            {
+                f = b ^ c ^ d;
+                k = 0x6ed9eba1;
+            }
+            else if (i < 60)
+            {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8f1bbcdc;
+            }
+            else
+            {
+                f = b ^ c ^ d;
+                k = 0xca62c1d6;
+            }
+            uint32_t temp = SHA1_ROL32(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = SHA1_ROL32(b, 30);
+            b = a;
+            a = temp;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// OpenSSL implementation
+// ---------------------------------------------------------------------------
+
+void compressOpenSsl(uint32_t state[5], const unsigned char* blocks, size_t count)
+{
+    SHA_CTX context;
+    context.h0 = state[0];
+    context.h1 = state[1];
+    context.h2 = state[2];
+    context.h3 = state[3];
+    context.h4 = state[4];
+    for (; count > 0; count--, blocks += SHA1_BLOCK_LENGTH)
+        SHA1_Transform(&context, blocks);
+    state[0] = context.h0;
+    state[1] = context.h1;
+    state[2] = context.h2;
+    state[3] = context.h3;
+    state[4] = context.h4;
+}
+
+#ifdef SHA1_ENGINE_X86
+
+// ---------------------------------------------------------------------------
+// SHA-NI implementation, based on the public domain code by Jeffrey Walton
+// (https://github.com/noloader/SHA-Intrinsics)
+// ---------------------------------------------------------------------------
+
+#define SHA_NI_TARGET __attribute__((target("sha,ssse3,sse4.1")))
+
+/**
+ * Performs the four rounds of group G (i.e. rounds 4G to 4G + 3), and
+ * advances the message schedule held in the four registers of 'message'.
+ * The two E registers take turns between holding the E value of the
+ * current group and saving ABCD for the next one.
+ */
+template <int G>
+SHA_NI_TARGET inline void sha1niRounds(__m128i& abcd, __m128i& e0, __m128i& e1, __m128i* message)
+{
+    __m128i& e = (G % 2 == 0) ? e0 : e1;
+    __m128i& next = (G % 2 == 0) ? e1 : e0;
+    __m128i& current = message[G % 4];
+
+    if constexpr (G == 0)
+        e = _mm_add_epi32(e, current);
+    else
+        e = _mm_sha1nexte_epu32(e, current);
+    next = abcd;
+    if constexpr (G >= 3 && G <= 18)
+        message[(G + 1) % 4] = _mm_sha1msg2_epu32(message[(G + 1) % 4], current);
+    abcd = _mm_sha1rnds4_epu32(abcd, e, G / 5);
+    if constexpr (G >= 1 && G <= 16)
+        message[(G + 3) % 4] = _mm_sha1msg1_epu32(message[(G + 3) % 4], current);
+    if constexpr (G >= 2 && G <= 17)
+        message[(G + 2) % 4] = _mm_xor_si128(message[(G + 2) % 4], current);
+}
+
+template <int... G>
+SHA_NI_TARGET inline void sha1niAllRounds(__m128i& abcd, __m128i& e0, __m128i& e1, __m128i* message,
+                                          std::integer_sequence<int, G...>)
+{
+    (sha1niRounds<G>(abcd, e0, e1, message), ...);
+}
+
+SHA_NI_TARGET
+void compressShaNi(uint32_t state[5], const unsigned char* blocks, size_t count)
+{
+    const __m128i byteSwap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) state), 0x1b);
+    __m128i e0 = _mm_set_epi32((int) state[4], 0, 0, 0);
+    __m128i e1;
+
+    for (; count > 0; count--, blocks += SHA1_BLOCK_LENGTH)
+    {
+        __m128i abcdSaved = abcd;
+        __m128i e0Saved = e0;
+        __m128i message[4];
+        for (int i = 0; i < 4; i++)
+            message[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (blocks + 16 * i)), byteSwap);
+
+        sha1niAllRounds(abcd, e0, e1, message, std::make_integer_sequence<int, 20>());
+
+        e0 = _mm_sha1nexte_epu32(e0, e0Saved);
+        abcd = _mm_add_epi32(abcd, abcdSaved);
+    }
+
+    _mm_storeu_si128((__m128i*) state, _mm_shuffle_epi32(abcd, 0x1b));
+    state[4] = (uint32_t) _mm_extract_epi32(e0, 3);
+}
+
+/**
+ * Checks if the CPU supports the SHA extensions, together with the
+ * SSSE3 and SSE4.1 instructions used alongside them.
+ */
+bool isShaNiSupported()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+    bool hasSse = (ecx & bit_SSSE3) && (ecx & bit_SSE4_1);
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return false;
+    return hasSse && (ebx & bit_SHA);
+}
+
+#endif // SHA1_ENGINE_X86
+
+struct Backend
+{
+    CompressFunction compress;
+    const char* name;
+};
+
+/**
+ * Selects the compression function once, on first use.
+ * The SHA1_BACKEND environment variable ("sha-ni", "openssl" or
+ * "portable") can force a given implementation, e.g. for comparisons.
+ */
+const Backend& backend()
+{
+    static const Backend selected = []
+    {
+        const char* forced = std::getenv("SHA1_BACKEND");
+        std::string name = forced ? forced : "";
+        if (name == "portable")
+            return Backend { compressPortable, "portable" };
+#ifdef SHA1_ENGINE_X86
+        if (name != "openssl" && isShaNiSupported())
+            return Backend { compressShaNi, "SHA-NI" };
+#endif
+        return Backend { compressOpenSsl, "OpenSSL" };
+    }();
+    return selected;
+}
+
+} // namespace
+
+SHA1Engine::SHA1Engine()
+{
+    reset();
+}
+
+/**
+ * Resets the engine so that a new message can be hashed.
+ */
+void SHA1Engine::reset()
+{
+    state[0] = 0x67452301;
+    state[1] = 0xefcdab89;
+    state[2] = 0x98badcfe;
+    state[3] = 0x10325476;
+    state[4] = 0xc3d2e1f0;
+    bufferLength = 0;
+    totalLength = 0;
+}
+
+/**
+ * Adds the given span of memory to the message being hashed.
+ * Whole blocks are hashed directly from the given memory, only
+ * partial blocks are copied to the internal buffer.
+ */
+void SHA1Engine::update(const void* data, size_t length)
+{
+    CompressFunction compress = backend().compress;
+    auto bytes = (const unsigned char*) data;
+    totalLength += length;
+
+    if (bufferLength > 0)
+    {
+        size_t bytesToCopy = std::min(length, SHA1_BLOCK_LENGTH - bufferLength);
+        std::memcpy(buffer + bufferLength, bytes, bytesToCopy);
+        bufferLength += bytesToCopy;
+        bytes += bytesToCopy;
+        length -= bytesToCopy;
+        if (bufferLength < SHA1_BLOCK_LENGTH)
+            return;
+        compress(state, buffer, 1);
+        bufferLength = 0;
+    }
+
+    size_t blockCount = length / SHA1_BLOCK_LENGTH;
+    if (blockCount > 0)
+    {
+        compress(state, bytes, blockCount);
+        bytes += blockCount * SHA1_BLOCK_LENGTH;
+        length -= blockCount * SHA1_BLOCK_LENGTH;
+    }
+
+    std::memcpy(buffer, bytes, length);
+    bufferLength = length;
+}
+
+/**
+ * Adds the padding and writes the 20-byte digest of the message.
+ * The engine has to be reset before it can be used again.
+ */
+void SHA1Engine::final(unsigned char digest[SHA1_DIGEST_LENGTH])
+{
+    CompressFunction compress = backend().compress;
+    uint64_t totalBits = totalLength * 8;
+
+    buffer[bufferLength++] = 0x80;
+    if (bufferLength > SHA1_BLOCK_LENGTH - 8)
+    {
+        std::memset(buffer + bufferLength, 0, SHA1_BLOCK_LENGTH - bufferLength);
+        compress(state, buffer, 1);
+        bufferLength = 0;
+    }
+    std::memset(buffer + bufferLength, 0, SHA1_BLOCK_LENGTH - 8 - bufferLength);
+    storeBigEndian(buffer + SHA1_BLOCK_LENGTH - 8, (uint32_t) (totalBits >> 32));
+    storeBigEndian(buffer + SHA1_BLOCK_LENGTH - 4, (uint32_t) totalBits);
+    compress(state, buffer, 1);
+
+    for (int i = 0; i < 5; i++)
+        storeBigEndian(digest + 4 * i, state[i]);
+}
+
+/**
+ * Computes the 20-byte SHA-1 digest of the given span of memory.
+ */
+void SHA1Engine::hash(const void* data, size_t length, unsigned char digest[SHA1_DIGEST_LENGTH])
+{
+    SHA1Engine engine;
+    engine.update(data, length);
+    engine.final(digest);
+}
+
+/**
+ * Returns the name of the implementation selected for this CPU.
+ */
+const char* SHA1Engine::backendName()
+{
+    return backend().name;
+}
@@ -0,0 +1,38 @@
+#ifndef BITTORRENTCLIENT_SHA1_ENGINE_H
+#define BITTORRENTCLIENT_SHA1_ENGINE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#define SHA1_DIGEST_LENGTH 20
+#define SHA1_BLOCK_LENGTH 64
+
+/**
+ * A streaming SHA-1 implementation which hashes contiguous spans of
+ * memory and produces the raw 20-byte digest.
+ * The compression function is selected at runtime, in order of
+ * preference:
+ * - the SHA extensions of x86 CPUs (SHA-NI),
+ * - OpenSSL, which itself picks an AVX2, AVX or SSSE3 implementation,
+ * - a portable C++ implementation, only used when explicitly selected
+ *   through the SHA1_BACKEND environment variable.
+ */
+class SHA1Engine
+{
+public:
+    SHA1Engine();
+    void reset();
+    void update(const void* data, size_t length);
+    void final(unsigned char digest[SHA1_DIGEST_LENGTH]);
+
+    static void hash(const void* data, size_t length, unsigned char digest[SHA1_DIGEST_LENGTH]);
+    static const char* backendName();
+
+private:
+    uint32_t state[5];
+    unsigned char buffer[SHA1_BLOCK_LENGTH];
+    size_t bufferLength;
+    uint64_t totalLength;
+};
+
+#endif //BITTORRENTCLIENT_SHA1_ENGINE_H
@@ -0,0 +1,338 @@
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "sha1_multi_buffer.h"
+
+#define SHA1_MAX_LANES 8
+#define SHA1_INLINE inline __attribute__((always_inline))
+
+namespace
+{
+
+/**
+ * Processes 'count' consecutive 64-byte blocks of each lane. The state
+ * is laid out word by word, i.e. word w of lane l is state[w * lanes + l].
+ */
+typedef void (*LaneFunction)(uint32_t* state, const unsigned char* const* blocks, size_t count);
+
+void storeBigEndian(unsigned char* bytes, uint32_t value)
+{
+    bytes[0] = (unsigned char) (value >> 24);
+    bytes[1] = (unsigned char) (value >> 16);
+    bytes[2] = (unsigned char) (value >> 8);
+    bytes[3] = (unsigned char) value;
+}
+
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+#define SHA1_MULTI_BUFFER_X86
+
+typedef uint32_t Vector4 __attribute__((vector_size(16)));
+typedef uint32_t Vector8 __attribute__((vector_size(32)));
+
+#define SHA1_ROTATE(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+
+/**
+ * Loads the message words of the next block of 4 lanes, so that w[i]
+ * holds word i of every lane. Words are loaded 4 at a time from each
+ * lane, byte-swapped and transposed.
+ */
+__attribute__((target("ssse3")))
+void loadWords(Vector4* w, const unsigned char* const* blocks, size_t offset)
+{
+    const __m128i byteSwap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    for (int group = 0; group < 16; group += 4)
+    {
+        __m128i rows[4];
+        for (int lane = 0; lane < 4; lane++)
+            rows[lane] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (blocks[lane] + offset + 4 * group)), byteSwap);
+        __m128i t0 = _mm_unpacklo_epi32(rows[0], rows[1]);
+        __m128i t1 = _mm_unpackhi_epi32(rows[0], rows[1]);
+        __m128i t2 = _mm_unpacklo_epi32(rows[2], rows[3]);
+        __m128i t3 = _mm_unpackhi_epi32(rows[2], rows[3]);
+        w[group] = (Vector4) _mm_unpacklo_epi64(t0, t2);
+        w[group + 1] = (Vector4) _mm_unpackhi_epi64(t0, t2);
+        w[group + 2] = (Vector4) _mm_unpacklo_epi64(t1, t3);
+        w[group + 3] = (Vector4) _mm_unpackhi_epi64(t1, t3);
+    }
+}
+
+/**
+ * Loads the message words of the next block of 8 lanes, so that w[i]
+ * holds word i of every lane. Words are loaded 8 at a time from each
+ * lane, byte-swapped and transposed.
+ */
+__attribute__((target("avx2")))
+void loadWords(Vector8* w, const unsigned char* const* blocks, size_t offset)
+{
+    const __m256i byteSwap = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                                             12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    for (int group = 0; group < 16; group += 8)
+    {
+        __m256i rows[8];
+        for (int lane = 0; lane < 8; lane++)
+            rows[lane] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*) (blocks[lane] + offset + 4 * group)), byteSwap);
+
+        __m256i t[8], u[8];
+        for (int i = 0; i < 8; i += 2)
+        {
+            t[i] = _mm256_unpacklo_epi32(rows[i], rows[i + 1]);
+            t[i + 1] = _mm256_unpackhi_epi32(rows[i], rows[i + 1]);
+        }
+        for (int i = 0; i < 8; i += 4)
+        {
+            u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+            u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+            u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+            u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+        }
+        for (int i = 0; i < 4; i++)
+        {
+            w[group + i] = (Vector8) _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+            w[group + i + 4] = (Vector8) _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+        }
+    }
+}
+
+/**
+ * Runs the SHA-1 compression function on all the lanes of V at once.
+ * Apart from loading the words, the code only uses the generic vector
+ * extensions of GCC, and is compiled for the instruction set of the
+ * function it is inlined into.
+ */
+template <typename V>
+SHA1_INLINE void compressLanes(uint32_t* state, const unsigned char* const* blocks, size_t count)
+{
+    V s[5];
+    std::memcpy(s, state, sizeof(s));
+
+    for (size_t offset = 0; offset < count * SHA1_BLOCK_LENGTH; offset += SHA1_BLOCK_LENGTH)
+    {
+        V w[16];
+        loadWords(w, blocks, offset);
+
+        V a = s[0], b = s[1], c = s[2], d = s[3], e = s[4];
+#define SHA1_LANE_ROUND(i, f, k)                                                                        \
+        {                                                                                               \
+            if ((i) >= 16)                                                                              \
+                w[(i) & 15] = SHA1_ROTATE(w[((i) - 3) & 15] ^ w[((i) - 8) & 15] ^ w[((i) - 14) & 15]   \
+                                          ^ w[(i) & 15], 1);                                            \
+            V temp = SHA1_ROTATE(a, 5) + (f) + e + (k) + w[(i) & 15];                                   \
+            e = d;                                                                                      \
+            d = c;                                                                                      \
+            c = SHA1_ROTATE(b, 30);                                                                     \
+            b = a;                                                                                      \
+            a = temp;                                                                                   \
+        }
+        for (int i = 0; i < 20; i++)
+            SHA1_LANE_ROUND(i, d ^ (b & (c ^ d)), 0x5a827999)
+        for (int i = 20; i < 40; i++)
+            SHA1_LANE_ROUND(i, b ^ c ^ d, 0x6ed9eba1)
+        for (int i = 40; i < 60; i++)
+            SHA1_LANE_ROUND(i, (b & c) | (d & (b | c)), 0x8f1bbcdc)
+        for (int i = 60; i < 80; i++)
+            SHA1_LANE_ROUND(i, b ^ c ^ d, 0xca62c1d6)
+#undef SHA1_LANE_ROUND
+
+        s[0] += a;
+        s[1] += b;
+        s[2] += c;
+        s[3] += d;
+        s[4] += e;
+    }
+
+    std::memcpy(state, s, sizeof(s));
+}
+
+__attribute__((target("ssse3")))
+void compressSsse3(uint32_t* state, const unsigned char* const* blocks, size_t count)
+{
+    compressLanes<Vector4>(state, blocks, count);
+}
+
+__attribute__((target("avx2")))
+void compressAvx2(uint32_t* state, const unsigned char* const* blocks, size_t count)
+{
+    compressLanes<Vector8>(state, blocks, count);
+}
+
+#endif // SHA1_MULTI_BUFFER_X86
+
+struct Backend
+{
+    LaneFunction compress;
+    size_t lanes;
+    const char* name;
+};
+
+/**
+ * Selects the lane function once, on first use. SHA1Engine is used
+ * instead (i.e. a single lane) when it runs on the SHA extensions,
+ * since a single SHA-NI stream outperforms the 8 AVX2 lanes.
+ * The SHA1_MULTI_BUFFER environment variable ("avx2", "ssse3" or
+ * "off") can force a given implementation, e.g. for comparisons.
+ */
+const Backend& backend()
+{
+    static const Backend selected = []
+    {
+        const char* forced = std::getenv("SHA1_MULTI_BUFFER");
+        std::string name = forced ? forced : "";
+        if (name == "off")
+            return Backend { nullptr, 1, "single-buffer" };
+#ifdef SHA1_MULTI_BUFFER_X86
+        bool preferEngine = name.empty() && std::string(SHA1Engine::backendName()) == "SHA-NI";
+        if (!preferEngine && name != "ssse3" && __builtin_cpu_supports("avx2"))
+            return Backend { compressAvx2, 8, "AVX2 8-lane" };
+        if (!preferEngine && __builtin_cpu_supports("ssse3"))
+            return Backend { compressSsse3, 4, "SSSE3 4-lane" };
+#endif
+        return Backend { nullptr, 1, "single-buffer" };
+    }();
+    return selected;
+}
+
+/**
+ * Checks if the messages can be hashed in the same lanes, i.e. if they
+ * are made of spans of the same lengths, all being whole 64-byte blocks
+ * except for the last one.
+ */
+bool isSameLayout(const std::vector<SHA1Span>& first, const std::vector<SHA1Span>& other)
+{
+    if (first.size() != other.size())
+        return false;
+    for (size_t i = 0; i < first.size(); i++)
+    {
+        if (first[i].length != other[i].length)
+            return false;
+        if (i + 1 < first.size() && first[i].length % SHA1_BLOCK_LENGTH != 0)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Hashes up to 'backend.lanes' messages of the same layout together.
+ * Unused lanes hash the first message again and their result is ignored.
+ */
+void hashLanes(const Backend& backend, const std::vector<SHA1Span>* const* messages, size_t count,
+               std::array<unsigned char, SHA1_DIGEST_LENGTH>* const* digests)
+{
+    const size_t lanes = backend.lanes;
+    static const uint32_t initialState[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+    uint32_t state[5 * SHA1_MAX_LANES];
+    for (int word = 0; word < 5; word++)
+        for (size_t lane = 0; lane < lanes; lane++)
+            state[word * lanes + lane] = initialState[word];
+
+    const unsigned char* blocks[SHA1_MAX_LANES];
+    const std::vector<SHA1Span>& layout = *messages[0];
+    uint64_t totalLength = 0;
+    size_t tailLength = 0;
+    for (size_t i = 0; i < layout.size(); i++)
+    {
+        size_t blockCount = layout[i].length / SHA1_BLOCK_LENGTH;
+        for (size_t lane = 0; lane < lanes; lane++)
+            blocks[lane] = (const unsigned char*) (*messages[lane < count ? lane : 0])[i].data;
+        backend.compress(state, blocks, blockCount);
+        totalLength += layout[i].length;
+        tailLength = layout[i].length % SHA1_BLOCK_LENGTH;
+    }
+
+    // Pads the remaining bytes of each lane, which take either one or two blocks
+    unsigned char tails[SHA1_MAX_LANES][2 * SHA1_BLOCK_LENGTH];
+    size_t tailBlocks = tailLength + 9 > SHA1_BLOCK_LENGTH ? 2 : 1;
+    size_t paddedLength = tailBlocks * SHA1_BLOCK_LENGTH;
+    uint64_t totalBits = totalLength * 8;
+    for (size_t lane = 0; lane < lanes; lane++)
+    {
+        unsigned char* tail = tails[lane];
+        if (tailLength > 0)
+        {
+            const SHA1Span& last = (*messages[lane < count ? lane : 0]).back();
+            std::memcpy(tail, (const unsigned char*) last.data + last.length - tailLength, tailLength);
+        }
+        tail[tailLength] = 0x80;
+        std::memset(tail + tailLength + 1, 0, paddedLength - tailLength - 9);
+        storeBigEndian(tail + paddedLength - 8, (uint32_t) (totalBits >> 32));
+        storeBigEndian(tail + paddedLength - 4, (uint32_t) totalBits);
+        blocks[lane] = tail;
+    }
+    backend.compress(state, blocks, tailBlocks);
+
+    for (size_t lane = 0; lane < count; lane++)
+        for (int word = 0; word < 5; word++)
+            storeBigEndian(digests[lane]->data() + 4 * word, state[word * lanes + lane]);
+}
+
+/**
+ * Hashes a single message with SHA1Engine.
+ */
+void hashSingle(const std::vector<SHA1Span>& message, std::array<unsigned char, SHA1_DIGEST_LENGTH>& digest)
+{
+    SHA1Engine engine;
+    for (const SHA1Span& span : message)
+        engine.update(span.data, span.length);
+    engine.final(digest.data());
+}
+
+} // namespace
+
+/**
+ * Returns the number of messages hashed at once by the selected
+ * implementation. A value of 1 means that messages are hashed one by one.
+ */
+size_t SHA1MultiBuffer::lanes()
+{
+    return backend().lanes;
+}
+
+/**
+ * Returns the name of the implementation selected for this CPU.
+ */
+const char* SHA1MultiBuffer::backendName()
+{
+    return backend().name;
+}
+
+/**
+ * Computes the SHA-1 digest of each message, grouping the messages
+ * of the same layout so that they are hashed in parallel lanes.
+ * @param messages: the messages to hash, each given as a list of spans.
+ * @param digests: receives the digest of each message, in the same order.
+ */
+void SHA1MultiBuffer::hash(const std::vector<std::vector<SHA1Span>>& messages,
+                           std::vector<std::array<unsigned char, SHA1_DIGEST_LENGTH>>& digests)
+{
+    const Backend& selected = backend();
+    digests.resize(messages.size());
+    std::vector<bool> hashed(messages.size(), false);
+
+    for (size_t i = 0; i < messages.size(); i++)
+    {
+        if (hashed[i])
+            continue;
+        hashed[i] = true;
+
+        const std::vector<SHA1Span>* group[SHA1_MAX_LANES];
+        std::array<unsigned char, SHA1_DIGEST_LENGTH>* groupDigests[SHA1_MAX_LANES];
+        size_t count = 0;
+        for (size_t j = i; j < messages.size() && count < selected.lanes; j++)
+        {
+            if ((j != i && hashed[j]) || !isSameLayout(messages[i], messages[j]))
+                continue;
+            group[count] = &messages[j];
+            groupDigests[count] = &digests[j];
+            hashed[j] = true;
+            count++;
+        }
+
+        if (count <= 1)
+            hashSingle(messages[i], digests[i]);
+        else
+            hashLanes(selected, group, count, groupDigests);
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef BITTORRENTCLIENT_SHA1_MULTI_BUFFER_H
+#define BITTORRENTCLIENT_SHA1_MULTI_BUFFER_H
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+#include "sha1_engine.h"
+
+/**
+ * A contiguous part of a message, e.g. the data of one Block of a Piece.
+ */
+struct SHA1Span
+{
+    const void* data;
+    size_t length;
+};
+
+/**
+ * Hashes several messages at once, one message per 32-bit SIMD lane
+ * (8 lanes with AVX2, 4 lanes with SSSE3).
+ * Messages are hashed together when they are split into spans of the
+ * same lengths, and all of these spans but the last one are made of
+ * whole 64-byte blocks. This is the case for all the full-size Pieces
+ * of a Torrent. Other messages are hashed one by one with SHA1Engine,
+ * which is also used on CPUs where it is faster than the SIMD lanes
+ * (i.e. CPUs with the SHA extensions).
+ */
+class SHA1MultiBuffer
+{
+public:
+    static size_t lanes();
+    static const char* backendName();
+    static void hash(const std::vector<std::vector<SHA1Span>>& messages,
+                     std::vector<std::array<unsigned char, SHA1_DIGEST_LENGTH>>& digests);
+};
+
+#endif //BITTORRENTCLIENT_SHA1_MULTI_BUFFER_H
@@ -0,0 +1,330 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include <openssl/sha.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA256_ENGINE_X86
+#endif
+
+#include "sha256_engine.h"
+
+#define SHA256_ROR32(value, bits) (((value) >> (bits)) | ((value) << (32 - (bits))))
+
+namespace
+{
+
+/**
+ * Processes 'count' consecutive 64-byte blocks, updating the eight
+ * 32-bit words of the hash state.
+ */
+typedef void (*CompressFunction)(uint32_t state[8], const unsigned char* blocks, size_t count);
+
+alignas(16) const uint32_t roundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+uint32_t loadBigEndian(const unsigned char* bytes)
+{
+    return ((uint32_t) bytes[0] << 24) | ((uint32_t) bytes[1] << 16) | ((uint32_t) bytes[2] << 8) | bytes[3];
+}
+
+void storeBigEndian(unsigned char* bytes, uint32_t value)
+{
+    bytes[0] = (unsigned char) (value >> 24);
+    bytes[1] = (unsigned char) (value >> 16);
+    bytes[2] = (unsigned char) (value >> 8);
+    bytes[3] = (unsigned char) value;
+}
+
+// ---------------------------------------------------------------------------
+// Portable implementation
+// ---------------------------------------------------------------------------
+
+void compressPortable(uint32_t state[8], const unsigned char* blocks, size_t count)
+{
+    for (; count > 0; count--, blocks += SHA256_BLOCK_LENGTH)
+    {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++)
+            w[i] = loadBigEndian(blocks + 4 * i);
+        for (int i = 16; i < 64; i++)
+        {
+            uint32_t s0 = SHA256_ROR32(w[i - 15], 7) ^ SHA256_ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = SHA256_ROR32(w[i - 2], 17) ^ SHA256_ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++)
+        {
+            uint32_t s1 = SHA256_ROR32(e, 6) ^ SHA256_ROR32(e, 11) ^ SHA256_ROR32(e, 25);
+            uint32_t choice = (e & f) ^ (~e & g);
+            uint32_t temp1 = h + s1 + choice + roundConstants[i] + w[i];
+            uint32_t s0 = SHA256_ROR32(a, 2) ^ SHA256_ROR32(a, 13) ^ SHA256_ROR32(a, 22);
+            uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t temp2 = s0 + majority;
+            h = g;
+            g = f;
+            f = e;
+            e = d + temp1;
+            d = c;
+            c = b;
+            b = a;
+            a = temp1 + temp2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// OpenSSL implementation
+// ---------------------------------------------------------------------------
+
+void compressOpenSsl(uint32_t state[8], const unsigned char* blocks, size_t count)
+{
+    SHA256_CTX context;
+    SHA256_Init(&context);
+    for (int i = 0; i < 8; i++)
+        context.h[i] = state[i];
+    for (; count > 0; count--, blocks += SHA256_BLOCK_LENGTH)
+        SHA256_Transform(&context, blocks);
+    for (int i = 0; i < 8; i++)
+        state[i] = context.h[i];
+}
+
+#ifdef SHA256_ENGINE_X86
+
+// ---------------------------------------------------------------------------
+// SHA-NI implementation, based on the public domain code by Jeffrey Walton
+// (https://github.com/noloader/SHA-Intrinsics)
+// ---------------------------------------------------------------------------
+
+#define SHA_NI_TARGET __attribute__((target("sha,ssse3,sse4.1")))
+
+/**
+ * Performs the four rounds of group G (i.e. rounds 4G to 4G + 3), and
+ * advances the message schedule held in the four registers of 'message'.
+ */
+template <int G>
+SHA_NI_TARGET inline void sha256niRounds(__m128i& abef, __m128i& cdgh, __m128i* message)
+{
+    __m128i& current = message[G % 4];
+    __m128i& previous = message[(G + 3) % 4];
+    __m128i& next = message[(G + 1) % 4];
+
+    __m128i words = _mm_add_epi32(current, _mm_load_si128((const __m128i*) (roundConstants + 4 * G)));
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, words);
+    if constexpr (G >= 3 && G <= 14)
+    {
+        next = _mm_add_epi32(next, _mm_alignr_epi8(current, previous, 4));
+        next = _mm_sha256msg2_epu32(next, current);
+    }
+    words = _mm_shuffle_epi32(words, 0x0e);
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, words);
+    if constexpr (G >= 1 && G <= 12)
+        previous = _mm_sha256msg1_epu32(previous, current);
+}
+
+template <int... G>
+SHA_NI_TARGET inline void sha256niAllRounds(__m128i& abef, __m128i& cdgh, __m128i* message,
+                                            std::integer_sequence<int, G...>)
+{
+    (sha256niRounds<G>(abef, cdgh, message), ...);
+}
+
+SHA_NI_TARGET
+void compressShaNi(uint32_t state[8], const unsigned char* blocks, size_t count)
+{
+    const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // Rearranges the state from ABCD EFGH into the ABEF CDGH layout of the SHA instructions
+    __m128i dcba = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) state), 0xb1);
+    __m128i efgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) (state + 4)), 0x1b);
+    __m128i abef = _mm_alignr_epi8(dcba, efgh, 8);
+    __m128i cdgh = _mm_blend_epi16(efgh, dcba, 0xf0);
+
+    for (; count > 0; count--, blocks += SHA256_BLOCK_LENGTH)
+    {
+        __m128i abefSaved = abef;
+        __m128i cdghSaved = cdgh;
+        __m128i message[4];
+        for (int i = 0; i < 4; i++)
+            message[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (blocks + 16 * i)), byteSwap);
+
+        sha256niAllRounds(abef, cdgh, message, std::make_integer_sequence<int, 16>());
+
+        abef = _mm_add_epi32(abef, abefSaved);
+        cdgh = _mm_add_epi32(cdgh, cdghSaved);
+    }
+
+    __m128i feba = _mm_shuffle_epi32(abef, 0x1b);
+    __m128i dchg = _mm_shuffle_epi32(cdgh, 0xb1);
+    _mm_storeu_si128((__m128i*) state, _mm_blend_epi16(feba, dchg, 0xf0));
+    _mm_storeu_si128((__m128i*) (state + 4), _mm_alignr_epi8(dchg, feba, 8));
+}
+
+/**
+ * Checks if the CPU supports the SHA extensions, together with the
+ * SSSE3 and SSE4.1 instructions used alongside them.
+ */
+bool isShaNiSupported()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+    bool hasSse = (ecx & bit_SSSE3) && (ecx & bit_SSE4_1);
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return false;
+    return hasSse && (ebx & bit_SHA);
+}
+
+#endif // SHA256_ENGINE_X86
+
+struct Backend
+{
+    CompressFunction compress;
+    const char* name;
+};
+
+/**
+ * Selects the compression function once, on first use.
+ * The SHA256_BACKEND environment variable ("sha-ni", "openssl" or
+ * "portable") can force a given implementation, e.g. for comparisons.
+ */
+const Backend& backend()
+{
+    static const Backend selected = []
+    {
+        const char* forced = std::getenv("SHA256_BACKEND");
+        std::string name = forced ? forced : "";
+        if (name == "portable")
+            return Backend { compressPortable, "portable" };
+#ifdef SHA256_ENGINE_X86
+        if (name != "openssl" && isShaNiSupported())
+            return Backend { compressShaNi, "SHA-NI" };
+#endif
+        return Backend { compressOpenSsl, "OpenSSL" };
+    }();
+    return selected;
+}
+
+} // namespace
+
+SHA256Engine::SHA256Engine()
+{
+    reset();
+}
+
+/**
+ * Resets the engine so that a new message can be hashed.
+ */
+void SHA256Engine::reset()
+{
+    static const uint32_t initialState[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    std::memcpy(state, initialState, sizeof(state));
+    bufferLength = 0;
+    totalLength = 0;
+}
+
+/**
+ * Adds the given span of memory to the message being hashed.
+ * Whole blocks are hashed directly from the given memory, only
+ * partial blocks are copied to the internal buffer.
+ */
+void SHA256Engine::update(const void* data, size_t length)
+{
+    CompressFunction compress = backend().compress;
+    auto bytes = (const unsigned char*) data;
+    totalLength += length;
+
+    if (bufferLength > 0)
+    {
+        size_t bytesToCopy = std::min(length, SHA256_BLOCK_LENGTH - bufferLength);
+        std::memcpy(buffer + bufferLength, bytes, bytesToCopy);
+        bufferLength += bytesToCopy;
+        bytes += bytesToCopy;
+        length -= bytesToCopy;
+        if (bufferLength < SHA256_BLOCK_LENGTH)
+            return;
+        compress(state, buffer, 1);
+        bufferLength = 0;
+    }
+
+    size_t blockCount = length / SHA256_BLOCK_LENGTH;
+    if (blockCount > 0)
+    {
+        compress(state, bytes, blockCount);
+        bytes += blockCount * SHA256_BLOCK_LENGTH;
+        length -= blockCount * SHA256_BLOCK_LENGTH;
+    }
+
+    std::memcpy(buffer, bytes, length);
+    bufferLength = length;
+}
+
+/**
+ * Adds the padding and writes the 32-byte digest of the message.
+ * The engine has to be reset before it can be used again.
+ */
+void SHA256Engine::final(unsigned char digest[SHA256_DIGEST_LENGTH])
+{
+    CompressFunction compress = backend().compress;
+    uint64_t totalBits = totalLength * 8;
+
+    buffer[bufferLength++] = 0x80;
+    if (bufferLength > SHA256_BLOCK_LENGTH - 8)
+    {
+        std::memset(buffer + bufferLength, 0, SHA256_BLOCK_LENGTH - bufferLength);
+        compress(state, buffer, 1);
+        bufferLength = 0;
+    }
+    std::memset(buffer + bufferLength, 0, SHA256_BLOCK_LENGTH - 8 - bufferLength);
+    storeBigEndian(buffer + SHA256_BLOCK_LENGTH - 8, (uint32_t) (totalBits >> 32));
+    storeBigEndian(buffer + SHA256_BLOCK_LENGTH - 4, (uint32_t) totalBits);
+    compress(state, buffer, 1);
+
+    for (int i = 0; i < 8; i++)
+        storeBigEndian(digest + 4 * i, state[i]);
+}
+
+/**
+ * Computes the 32-byte SHA-256 digest of the given span of memory.
+ */
+void SHA256Engine::hash(const void* data, size_t length, unsigned char digest[SHA256_DIGEST_LENGTH])
+{
+    SHA256Engine engine;
+    engine.update(data, length);
+    engine.final(digest);
+}
+
+/**
+ * Returns the name of the implementation selected for this CPU.
+ */
+const char* SHA256Engine::backendName()
+{
+    return backend().name;
+}
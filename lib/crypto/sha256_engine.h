@@ -0,0 +1,39 @@
+#ifndef BITTORRENTCLIENT_SHA256_ENGINE_H
+#define BITTORRENTCLIENT_SHA256_ENGINE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#define SHA256_DIGEST_LENGTH 32
+#define SHA256_BLOCK_LENGTH 64
+
+/**
+ * A streaming SHA-256 implementation which hashes contiguous spans of
+ * memory and produces the raw 32-byte digest, as used by the Merkle
+ * trees of BitTorrent v2.
+ * The compression function is selected at runtime, in order of
+ * preference:
+ * - the SHA extensions of x86 CPUs (SHA-NI),
+ * - OpenSSL, which itself picks an AVX2, AVX or SSSE3 implementation,
+ * - a portable C++ implementation, only used when explicitly selected
+ *   through the SHA256_BACKEND environment variable.
+ */
+class SHA256Engine
+{
+public:
+    SHA256Engine();
+    void reset();
+    void update(const void* data, size_t length);
+    void final(unsigned char digest[SHA256_DIGEST_LENGTH]);
+
+    static void hash(const void* data, size_t length, unsigned char digest[SHA256_DIGEST_LENGTH]);
+    static const char* backendName();
+
+private:
+    uint32_t state[8];
+    unsigned char buffer[SHA256_BLOCK_LENGTH];
+    size_t bufferLength;
+    uint64_t totalLength;
+};
+
+#endif //BITTORRENTCLIENT_SHA256_ENGINE_H
@@ -0,0 +1,94 @@
+#include <cstdlib>
+#include <new>
+#include <algorithm>
+
+#include "AlignedBufferPool.h"
+
+/**
+ * @param alignment: boundary on which the buffers are aligned, a power of
+ * two. The capacity of the buffers is also a multiple of it.
+ * @param maximumFreeBuffers: number of released buffers kept for reuse.
+ */
+AlignedBufferPool::AlignedBufferPool(size_t alignment, size_t maximumFreeBuffers):
+    alignment(alignment), maximumFreeBuffers(maximumFreeBuffers) {}
+
+/**
+ * Destructor of the AlignedBufferPool class. Frees the released buffers,
+ * all the buffers must have been released.
+ */
+AlignedBufferPool::~AlignedBufferPool()
+{
+    for (FreeBuffer& freeBuffer : freeBuffers)
+        free(freeBuffer.data);
+}
+
+/**
+ * Retrieves a buffer of at least 'length' bytes: the smallest large enough
+ * released buffer, or a newly allocated one.
+ */
+AlignedBufferPool::Buffer AlignedBufferPool::acquire(size_t length)
+{
+    size_t capacity = (length + alignment - 1) / alignment * alignment;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto best = freeBuffers.end();
+        for (auto iter = freeBuffers.begin(); iter != freeBuffers.end(); iter++)
+        {
+            if (iter->capacity >= capacity && (best == freeBuffers.end() || iter->capacity < best->capacity))
+                best = iter;
+        }
+        if (best != freeBuffers.end())
+        {
+            FreeBuffer freeBuffer = *best;
+            freeBuffers.erase(best);
+            return Buffer(this, freeBuffer.data, freeBuffer.capacity);
+        }
+    }
+    void* data = nullptr;
+    if (posix_memalign(&data, alignment, std::max(capacity, alignment)) != 0)
+        throw std::bad_alloc();
+    return Buffer(this, (char*) data, capacity);
+}
+
+/**
+ * Puts a buffer back in the pool. The smallest buffer is freed when the
+ * pool is full, so that the pool ends up with buffers of the usual size.
+ */
+void AlignedBufferPool::release(char* data, size_t capacity)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    freeBuffers.push_back({ data, capacity });
+    if (freeBuffers.size() > maximumFreeBuffers)
+    {
+        auto smallest = std::min_element(freeBuffers.begin(), freeBuffers.end(),
+            [](const FreeBuffer& first, const FreeBuffer& second) { return first.capacity < second.capacity; });
+        free(smallest->data);
+        freeBuffers.erase(smallest);
+    }
+}
+
+AlignedBufferPool::Buffer::Buffer(AlignedBufferPool* pool, char* buffer, size_t capacity):
+    pool(pool), buffer(buffer), capacity(capacity) {}
+
+AlignedBufferPool::Buffer::Buffer(Buffer&& other) noexcept:
+    pool(other.pool), buffer(other.buffer), capacity(other.capacity)
+{
+    other.buffer = nullptr;
+}
+
+/**
+ * Gives the buffer back to the pool.
+ */
+AlignedBufferPool::Buffer::~Buffer()
+{
+    if (buffer)
+        pool->release(buffer, capacity);
+}
+
+/**
+ * Retrieves the aligned memory of the buffer.
+ */
+char* AlignedBufferPool::Buffer::data() const
+{
+    return buffer;
+}
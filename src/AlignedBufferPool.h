@@ -0,0 +1,55 @@
+#ifndef BITTORRENTCLIENT_ALIGNEDBUFFERPOOL_H
+#define BITTORRENTCLIENT_ALIGNEDBUFFERPOOL_H
+
+#include <mutex>
+#include <vector>
+#include <cstddef>
+
+/**
+ * A pool of buffers whose address is aligned on a given boundary, as
+ * required by direct I/O. Allocating such a buffer for every write of a
+ * piece is costly, so the released buffers are kept, up to a maximum
+ * number, and handed out again.
+ */
+class AlignedBufferPool
+{
+private:
+    struct FreeBuffer
+    {
+        char* data;
+        size_t capacity;
+    };
+
+    const size_t alignment;
+    const size_t maximumFreeBuffers;
+    std::vector<FreeBuffer> freeBuffers;
+    std::mutex lock;
+
+    void release(char* data, size_t capacity);
+
+public:
+    /**
+     * A buffer of the pool, which goes back to the pool when destroyed.
+     */
+    class Buffer
+    {
+    private:
+        AlignedBufferPool* pool;
+        char* buffer;
+        size_t capacity;
+
+    public:
+        Buffer(AlignedBufferPool* pool, char* buffer, size_t capacity);
+        Buffer(Buffer&& other) noexcept;
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+        ~Buffer();
+        char* data() const;
+    };
+
+    AlignedBufferPool(size_t alignment, size_t maximumFreeBuffers);
+    ~AlignedBufferPool();
+    Buffer acquire(size_t length);
+};
+
+#endif //BITTORRENTCLIENT_ALIGNEDBUFFERPOOL_H
@@ -17,7 +17,11 @@ enum MessageId
     request = 6,
     piece = 7,
     cancel = 8,
-    port = 9
+    port = 9,
+    // BitTorrent v2 (BEP 52)
+    hashRequest = 21,
+    hashes = 22,
+    hashReject = 23
 };
 
 class BitTorrentMessage
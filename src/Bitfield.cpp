@@ -0,0 +1,638 @@
+#include <stdexcept>
+#include <algorithm>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define BITFIELD_X86
+#endif
+
+#include "Bitfield.h"
+
+#define WORD_BITS 64
+#define WORDS_PER_CHUNK 4   // 256 bits, the width of an AVX2 register
+
+namespace
+{
+
+/**
+ * The bulk operations on word arrays. Every array has a length which
+ * is a multiple of WORDS_PER_CHUNK. The find functions return the
+ * index of the first word at or after 'from' which has a bit set,
+ * or 'n' if no such word exists.
+ */
+struct BitfieldKernels
+{
+    size_t (*popcount)(const uint64_t* a, size_t n);
+    size_t (*popcountAnd)(const uint64_t* a, const uint64_t* b, size_t n);
+    size_t (*popcountAndNot)(const uint64_t* a, const uint64_t* b, size_t n);
+    size_t (*find)(const uint64_t* a, size_t n, size_t from);
+    size_t (*findAnd)(const uint64_t* a, const uint64_t* b, size_t n, size_t from);
+    size_t (*findAndNot)(const uint64_t* a, const uint64_t* b, size_t n, size_t from);
+    void (*bitAnd)(uint64_t* dst, const uint64_t* a, const uint64_t* b, size_t n);
+    void (*bitAndNot)(uint64_t* dst, const uint64_t* a, const uint64_t* b, size_t n);
+};
+
+// ---------------------------------------------------------------------------
+// Portable implementation
+// ---------------------------------------------------------------------------
+
+size_t popcountScalar(const uint64_t* a, size_t n)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < n; i++)
+        total += __builtin_popcountll(a[i]);
+    return total;
+}
+
+size_t popcountAndScalar(const uint64_t* a, const uint64_t* b, size_t n)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < n; i++)
+        total += __builtin_popcountll(a[i] & b[i]);
+    return total;
+}
+
+size_t popcountAndNotScalar(const uint64_t* a, const uint64_t* b, size_t n)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < n; i++)
+        total += __builtin_popcountll(a[i] & ~b[i]);
+    return total;
+}
+
+size_t findScalar(const uint64_t* a, size_t n, size_t from)
+{
+    for (size_t i = from; i < n; i++)
+        if (a[i])
+            return i;
+    return n;
+}
+
+size_t findAndScalar(const uint64_t* a, const uint64_t* b, size_t n, size_t from)
+{
+    for (size_t i = from; i < n; i++)
+        if (a[i] & b[i])
+            return i;
+    return n;
+}
+
+size_t findAndNotScalar(const uint64_t* a, const uint64_t* b, size_t n, size_t from)
+{
+    for (size_t i = from; i < n; i++)
+        if (a[i] & ~b[i])
+            return i;
+    return n;
+}
+
+void bitAndScalar(uint64_t* dst, const uint64_t* a, const uint64_t* b, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        dst[i] = a[i] & b[i];
+}
+
+void bitAndNotScalar(uint64_t* dst, const uint64_t* a, const uint64_t* b, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        dst[i] = a[i] & ~b[i];
+}
+
+const BitfieldKernels scalarKernels = {
+    popcountScalar, popcountAndScalar, popcountAndNotScalar,
+    findScalar, findAndScalar, findAndNotScalar,
+    bitAndScalar, bitAndNotScalar
+};
+
+#ifdef BITFIELD_X86
+
+// ---------------------------------------------------------------------------
+// SSE implementation (SSSE3 nibble lookup popcount, SSE4.1 PTEST)
+// ---------------------------------------------------------------------------
+
+/**
+ * Counts the set bits of each 64-bit lane with the nibble lookup
+ * table method described by Wojciech Mula.
+ */
+__attribute__((target("ssse3,sse4.1")))
+inline __m128i popcount128(__m128i v)
+{
+    const __m128i lookup = _mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m128i lowMask = _mm_set1_epi8(0x0f);
+    __m128i lo = _mm_and_si128(v, lowMask);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), lowMask);
+    __m128i counts = _mm_add_epi8(_mm_shuffle_epi8(lookup, lo), _mm_shuffle_epi8(lookup, hi));
+    return _mm_sad_epu8(counts, _mm_setzero_si128());
+}
+
+__attribute__((target("ssse3,sse4.1")))
+inline size_t sum128(__m128i acc)
+{
+    return (size_t) _mm_cvtsi128_si64(acc) + (size_t) _mm_extract_epi64(acc, 1);
+}
+
+__attribute__((target("ssse3,sse4.1")))
+size_t popcountSse(const uint64_t* a, size_t n)
+{
+    __m128i acc = _mm_setzero_si128();
+    for (size_t i = 0; i < n; i += 2)
+        acc = _mm_add_epi64(acc, popcount128(_mm_loadu_si128((const __m128i*) (a + i))));
+    return sum128(acc);
+}
+
+__attribute__((target("ssse3,sse4.1")))
+size_t popcountAndSse(const uint64_t* a, const uint64_t* b, size_t n)
+{
+    __m128i acc = _mm_setzero_si128();
+    for (size_t i = 0; i < n; i += 2)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i*) (a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*) (b + i));
+        acc = _mm_add_epi64(acc, popcount128(_mm_and_si128(va, vb)));
+    }
+    return sum128(acc);
+}
+
+__attribute__((target("ssse3,sse4.1")))
+size_t popcountAndNotSse(const uint64_t* a, const uint64_t* b, size_t n)
+{
+    __m128i acc = _mm_setzero_si128();
+    for (size_t i = 0; i < n; i += 2)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i*) (a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*) (b + i));
+        acc = _mm_add_epi64(acc, popcount128(_mm_andnot_si128(vb, va)));
+    }
+    return sum128(acc);
+}
+
+__attribute__((target("ssse3,sse4.1")))
+size_t findSse(const uint64_t* a, size_t n, size_t from)
+{
+    size_t aligned = std::min(n, (from + 1) & ~(size_t) 1);
+    size_t found = findScalar(a, aligned, from);
+    if (found != aligned)
+        return found;
+    for (size_t i = aligned; i < n; i += 2)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*) (a + i));
+        if (!_mm_testz_si128(v, v))
+            return findScalar(a, i + 2, i);
+    }
+    return n;
+}
+
+__attribute__((target("ssse3,sse4.1")))
+size_t findAndSse(const uint64_t* a, const uint64_t* b, size_t n, size_t from)
+{
+    size_t aligned = std::min(n, (from + 1) & ~(size_t) 1);
+    size_t found = findAndScalar(a, b, aligned, from);
+    if (found != aligned)
+        return found;
+    for (size_t i = aligned; i < n; i += 2)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i*) (a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*) (b + i));
+        if (!_mm_testz_si128(va, vb))
+            return findAndScalar(a, b, i + 2, i);
+    }
+    return n;
+}
+
+__attribute__((target("ssse3,sse4.1")))
+size_t findAndNotSse(const uint64_t* a, const uint64_t* b, size_t n, size_t from)
+{
+    size_t aligned = std::min(n, (from + 1) & ~(size_t) 1);
+    size_t found = findAndNotScalar(a, b, aligned, from);
+    if (found != aligned)
+        return found;
+    for (size_t i = aligned; i < n; i += 2)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i*) (a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*) (b + i));
+        // PTEST sets CF when (~vb & va) == 0
+        if (!_mm_testc_si128(vb, va))
+            return findAndNotScalar(a, b, i + 2, i);
+    }
+    return n;
+}
+
+__attribute__((target("ssse3,sse4.1")))
+void bitAndSse(uint64_t* dst, const uint64_t* a, const uint64_t* b, size_t n)
+{
+    for (size_t i = 0; i < n; i += 2)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i*) (a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*) (b + i));
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_and_si128(va, vb));
+    }
+}
+
+__attribute__((target("ssse3,sse4.1")))
+void bitAndNotSse(uint64_t* dst, const uint64_t* a, const uint64_t* b, size_t n)
+{
+    for (size_t i = 0; i < n; i += 2)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i*) (a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*) (b + i));
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_andnot_si128(vb, va));
+    }
+}
+
+const BitfieldKernels sseKernels = {
+    popcountSse, popcountAndSse, popcountAndNotSse,
+    findSse, findAndSse, findAndNotSse,
+    bitAndSse, bitAndNotSse
+};
+
+// ---------------------------------------------------------------------------
+// AVX2 implementation
+// ---------------------------------------------------------------------------
+
+__attribute__((target("avx2")))
+inline __m256i popcount256(__m256i v)
+{
+    const __m256i lookup = _mm256_setr_epi8(
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i lowMask = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v, lowMask);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), lowMask);
+    __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+    return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+inline size_t sum256(__m256i acc)
+{
+    return (size_t) _mm256_extract_epi64(acc, 0) + (size_t) _mm256_extract_epi64(acc, 1) +
+           (size_t) _mm256_extract_epi64(acc, 2) + (size_t) _mm256_extract_epi64(acc, 3);
+}
+
+__attribute__((target("avx2")))
+size_t popcountAvx2(const uint64_t* a, size_t n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    for (size_t i = 0; i < n; i += WORDS_PER_CHUNK)
+        acc = _mm256_add_epi64(acc, popcount256(_mm256_loadu_si256((const __m256i*) (a + i))));
+    return sum256(acc);
+}
+
+__attribute__((target("avx2")))
+size_t popcountAndAvx2(const uint64_t* a, const uint64_t* b, size_t n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    for (size_t i = 0; i < n; i += WORDS_PER_CHUNK)
+    {
+        __m256i va = _mm256_loadu_si256((const __m256i*) (a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*) (b + i));
+        acc = _mm256_add_epi64(acc, popcount256(_mm256_and_si256(va, vb)));
+    }
+    return sum256(acc);
+}
+
+__attribute__((target("avx2")))
+size_t popcountAndNotAvx2(const uint64_t* a, const uint64_t* b, size_t n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    for (size_t i = 0; i < n; i += WORDS_PER_CHUNK)
+    {
+        __m256i va = _mm256_loadu_si256((const __m256i*) (a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*) (b + i));
+        acc = _mm256_add_epi64(acc, popcount256(_mm256_andnot_si256(vb, va)));
+    }
+    return sum256(acc);
+}
+
+__attribute__((target("avx2")))
+size_t findAvx2(const uint64_t* a, size_t n, size_t from)
+{
+    size_t aligned = std::min(n, (from + WORDS_PER_CHUNK - 1) & ~(size_t) (WORDS_PER_CHUNK - 1));
+    size_t found = findScalar(a, aligned, from);
+    if (found != aligned)
+        return found;
+    for (size_t i = aligned; i < n; i += WORDS_PER_CHUNK)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (a + i));
+        if (!_mm256_testz_si256(v, v))
+            return findScalar(a, i + WORDS_PER_CHUNK, i);
+    }
+    return n;
+}
+
+__attribute__((target("avx2")))
+size_t findAndAvx2(const uint64_t* a, const uint64_t* b, size_t n, size_t from)
+{
+    size_t aligned = std::min(n, (from + WORDS_PER_CHUNK - 1) & ~(size_t) (WORDS_PER_CHUNK - 1));
+    size_t found = findAndScalar(a, b, aligned, from);
+    if (found != aligned)
+        return found;
+    for (size_t i = aligned; i < n; i += WORDS_PER_CHUNK)
+    {
+        __m256i va = _mm256_loadu_si256((const __m256i*) (a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*) (b + i));
+        if (!_mm256_testz_si256(va, vb))
+            return findAndScalar(a, b, i + WORDS_PER_CHUNK, i);
+    }
+    return n;
+}
+
+__attribute__((target("avx2")))
+size_t findAndNotAvx2(const uint64_t* a, const uint64_t* b, size_t n, size_t from)
+{
+    size_t aligned = std::min(n, (from + WORDS_PER_CHUNK - 1) & ~(size_t) (WORDS_PER_CHUNK - 1));
+    size_t found = findAndNotScalar(a, b, aligned, from);
+    if (found != aligned)
+        return found;
+    for (size_t i = aligned; i < n; i += WORDS_PER_CHUNK)
+    {
+        __m256i va = _mm256_loadu_si256((const __m256i*) (a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*) (b + i));
+        // VPTEST sets CF when (~vb & va) == 0
+        if (!_mm256_testc_si256(vb, va))
+            return findAndNotScalar(a, b, i + WORDS_PER_CHUNK, i);
+    }
+    return n;
+}
+
+__attribute__((target("avx2")))
+void bitAndAvx2(uint64_t* dst, const uint64_t* a, const uint64_t* b, size_t n)
+{
+    for (size_t i = 0; i < n; i += WORDS_PER_CHUNK)
+    {
+        __m256i va = _mm256_loadu_si256((const __m256i*) (a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*) (b + i));
+        _mm256_storeu_si256((__m256i*) (dst + i), _mm256_and_si256(va, vb));
+    }
+}
+
+__attribute__((target("avx2")))
+void bitAndNotAvx2(uint64_t* dst, const uint64_t* a, const uint64_t* b, size_t n)
+{
+    for (size_t i = 0; i < n; i += WORDS_PER_CHUNK)
+    {
+        __m256i va = _mm256_loadu_si256((const __m256i*) (a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*) (b + i));
+        _mm256_storeu_si256((__m256i*) (dst + i), _mm256_andnot_si256(vb, va));
+    }
+}
+
+const BitfieldKernels avx2Kernels = {
+    popcountAvx2, popcountAndAvx2, popcountAndNotAvx2,
+    findAvx2, findAndAvx2, findAndNotAvx2,
+    bitAndAvx2, bitAndNotAvx2
+};
+
+#endif // BITFIELD_X86
+
+/**
+ * Selects the set of kernels matching the instruction sets supported
+ * by the CPU. The selection is made once, on first use.
+ */
+const BitfieldKernels& kernels()
+{
+    static const BitfieldKernels* selected = []
+    {
+#ifdef BITFIELD_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return &avx2Kernels;
+        if (__builtin_cpu_supports("ssse3") && __builtin_cpu_supports("sse4.1"))
+            return &sseKernels;
+#endif
+        return &scalarKernels;
+    }();
+    return *selected;
+}
+
+/**
+ * Reverses the order of the bits in a byte. BitField messages number
+ * the pieces from the most significant bit of each byte, whereas the
+ * words are numbered from the least significant bit.
+ */
+uint8_t reverseBits(uint8_t value)
+{
+    return (uint8_t) (((value * 0x0802LU & 0x22110LU) | (value * 0x8020LU & 0x88440LU)) * 0x10101LU >> 16);
+}
+
+/**
+ * Returns the number of words needed to store the given number of bits,
+ * rounded up to a whole number of chunks.
+ */
+size_t wordCountFor(size_t bits)
+{
+    const size_t chunkBits = WORD_BITS * WORDS_PER_CHUNK;
+    return (bits + chunkBits - 1) / chunkBits * WORDS_PER_CHUNK;
+}
+
+} // namespace
+
+/**
+ * Creates a Bitfield which is able to hold 'size' bits.
+ * @param size: the number of pieces the Bitfield represents.
+ * @param value: the initial value of every bit.
+ */
+Bitfield::Bitfield(size_t size, bool value): words(wordCountFor(size), 0), bitCount(size)
+{
+    if (!value)
+        return;
+    std::fill(words.begin(), words.begin() + size / WORD_BITS, ~(uint64_t) 0);
+    if (size % WORD_BITS)
+        words[size / WORD_BITS] = ((uint64_t) 1 << (size % WORD_BITS)) - 1;
+}
+
+/**
+ * Creates a Bitfield from the payload of a BitField message, in which
+ * the high bit of the first byte corresponds to piece 0.
+ * Spare bits at the end of the payload are ignored. A payload that is
+ * shorter than required is treated as if it were padded with zeros.
+ * @param bytes: the payload of the BitField message.
+ * @param size: the number of pieces in the Torrent.
+ */
+Bitfield Bitfield::fromBytes(const std::string& bytes, size_t size)
+{
+    Bitfield bitfield(size);
+    size_t byteCount = std::min(bytes.size(), (size + 7) / 8);
+    for (size_t i = 0; i < byteCount; i++)
+    {
+        auto value = (uint8_t) bytes[i];
+        if (value)
+            bitfield.words[i / 8] |= (uint64_t) reverseBits(value) << (8 * (i % 8));
+    }
+    // Clears the spare bits sent by the peer
+    if (size % WORD_BITS && !bitfield.words.empty())
+        bitfield.words[size / WORD_BITS] &= ((uint64_t) 1 << (size % WORD_BITS)) - 1;
+    return bitfield;
+}
+
+/**
+ * Serializes the Bitfield into the payload format of a BitField message.
+ */
+std::string Bitfield::toBytes() const
+{
+    std::string bytes((bitCount + 7) / 8, '\0');
+    for (size_t i = 0; i < bytes.size(); i++)
+    {
+        auto value = (uint8_t) (words[i / 8] >> (8 * (i % 8)));
+        bytes[i] = (char) reverseBits(value);
+    }
+    return bytes;
+}
+
+/**
+ * Returns the number of bits (i.e. pieces) in the Bitfield.
+ */
+size_t Bitfield::size() const
+{
+    return bitCount;
+}
+
+/**
+ * Checks if the bit at the given index is set.
+ */
+bool Bitfield::get(size_t index) const
+{
+    if (index >= bitCount)
+        return false;
+    return (words[index / WORD_BITS] >> (index % WORD_BITS)) & 1;
+}
+
+/**
+ * Sets the bit at the given index to 1.
+ */
+void Bitfield::set(size_t index)
+{
+    if (index >= bitCount)
+        throw std::out_of_range("Piece index " + std::to_string(index) + " is out of range");
+    words[index / WORD_BITS] |= (uint64_t) 1 << (index % WORD_BITS);
+}
+
+/**
+ * Sets the bit at the given index to 0.
+ */
+void Bitfield::clear(size_t index)
+{
+    if (index >= bitCount)
+        throw std::out_of_range("Piece index " + std::to_string(index) + " is out of range");
+    words[index / WORD_BITS] &= ~((uint64_t) 1 << (index % WORD_BITS));
+}
+
+/**
+ * Counts the number of bits that are set.
+ */
+size_t Bitfield::count() const
+{
+    return kernels().popcount(words.data(), words.size());
+}
+
+/**
+ * Checks if at least one bit is set.
+ */
+bool Bitfield::any() const
+{
+    return findNext() != npos;
+}
+
+/**
+ * Checks if no bit is set.
+ */
+bool Bitfield::none() const
+{
+    return !any();
+}
+
+/**
+ * Counts the bits that are set in both this and the other Bitfield.
+ */
+size_t Bitfield::countAnd(const Bitfield& other) const
+{
+    return kernels().popcountAnd(words.data(), other.words.data(), std::min(words.size(), other.words.size()));
+}
+
+/**
+ * Counts the bits that are set in this Bitfield but not in the other one,
+ * e.g. the number of pieces a peer has which we still need.
+ */
+size_t Bitfield::countAndNot(const Bitfield& other) const
+{
+    if (other.words.size() < words.size())
+        return andNot(other).count();
+    return kernels().popcountAndNot(words.data(), other.words.data(), words.size());
+}
+
+/**
+ * Returns the index of the first set bit at or after 'from',
+ * or npos if there is none.
+ */
+size_t Bitfield::findNext(size_t from) const
+{
+    if (from >= bitCount)
+        return npos;
+    size_t wordIndex = from / WORD_BITS;
+    uint64_t first = words[wordIndex] & (~(uint64_t) 0 << (from % WORD_BITS));
+    if (first)
+        return wordIndex * WORD_BITS + __builtin_ctzll(first);
+    wordIndex = kernels().find(words.data(), words.size(), wordIndex + 1);
+    if (wordIndex == words.size())
+        return npos;
+    return wordIndex * WORD_BITS + __builtin_ctzll(words[wordIndex]);
+}
+
+/**
+ * Returns the index of the first bit at or after 'from' that is set in both
+ * this and the other Bitfield, or npos if there is none.
+ */
+size_t Bitfield::findNextAnd(const Bitfield& other, size_t from) const
+{
+    size_t n = std::min(words.size(), other.words.size());
+    if (from >= bitCount || from / WORD_BITS >= n)
+        return npos;
+    size_t wordIndex = from / WORD_BITS;
+    uint64_t first = words[wordIndex] & other.words[wordIndex] & (~(uint64_t) 0 << (from % WORD_BITS));
+    if (first)
+        return wordIndex * WORD_BITS + __builtin_ctzll(first);
+    wordIndex = kernels().findAnd(words.data(), other.words.data(), n, wordIndex + 1);
+    if (wordIndex == n)
+        return npos;
+    return wordIndex * WORD_BITS + __builtin_ctzll(words[wordIndex] & other.words[wordIndex]);
+}
+
+/**
+ * Returns the index of the first bit at or after 'from' that is set in this
+ * Bitfield but not in the other one, or npos if there is none.
+ */
+size_t Bitfield::findNextAndNot(const Bitfield& other, size_t from) const
+{
+    if (other.words.size() < words.size())
+        return andNot(other).findNext(from);
+    if (from >= bitCount)
+        return npos;
+    size_t wordIndex = from / WORD_BITS;
+    uint64_t first = words[wordIndex] & ~other.words[wordIndex] & (~(uint64_t) 0 << (from % WORD_BITS));
+    if (first)
+        return wordIndex * WORD_BITS + __builtin_ctzll(first);
+    wordIndex = kernels().findAndNot(words.data(), other.words.data(), words.size(), wordIndex + 1);
+    if (wordIndex == words.size())
+        return npos;
+    return wordIndex * WORD_BITS + __builtin_ctzll(words[wordIndex] & ~other.words[wordIndex]);
+}
+
+/**
+ * Returns the intersection of this and the other Bitfield.
+ */
+Bitfield Bitfield::operator&(const Bitfield& other) const
+{
+    Bitfield result(bitCount);
+    size_t n = std::min(words.size(), other.words.size());
+    kernels().bitAnd(result.words.data(), words.data(), other.words.data(), n);
+    return result;
+}
+
+/**
+ * Returns the bits that are set in this Bitfield but not in the other one.
+ */
+Bitfield Bitfield::andNot(const Bitfield& other) const
+{
+    Bitfield result(*this);
+    size_t n = std::min(words.size(), other.words.size());
+    kernels().bitAndNot(result.words.data(), words.data(), other.words.data(), n);
+    return result;
+}
@@ -0,0 +1,50 @@
+#ifndef BITTORRENTCLIENT_BITFIELD_H
+#define BITTORRENTCLIENT_BITFIELD_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * A fixed-size set of piece indices, used both for the BitFields
+ * received from peers and for the bookkeeping of our own pieces.
+ * Bits are stored in 64-bit words which are padded to a multiple
+ * of 256 bits, so that the bulk operations (population count,
+ * AND-NOT, find-first-set) can be carried out with AVX2 or SSE
+ * instructions without handling a tail. The padding bits are
+ * always kept at 0.
+ * Bulk operations are dispatched at runtime to the widest
+ * instruction set supported by the CPU.
+ */
+class Bitfield
+{
+private:
+    std::vector<uint64_t> words;
+    size_t bitCount = 0;
+
+public:
+    static const size_t npos = (size_t) -1;
+
+    Bitfield() = default;
+    explicit Bitfield(size_t size, bool value = false);
+    static Bitfield fromBytes(const std::string& bytes, size_t size);
+    std::string toBytes() const;
+
+    size_t size() const;
+    bool get(size_t index) const;
+    void set(size_t index);
+    void clear(size_t index);
+
+    size_t count() const;
+    bool any() const;
+    bool none() const;
+    size_t countAnd(const Bitfield& other) const;
+    size_t countAndNot(const Bitfield& other) const;
+    size_t findNext(size_t from = 0) const;
+    size_t findNextAnd(const Bitfield& other, size_t from = 0) const;
+    size_t findNextAndNot(const Bitfield& other, size_t from = 0) const;
+    Bitfield operator&(const Bitfield& other) const;
+    Bitfield andNot(const Bitfield& other) const;
+};
+
+#endif //BITTORRENTCLIENT_BITFIELD_H
@@ -25,6 +25,8 @@ struct Block
     int length;
     BlockStatus status;
     std::string data;
+    // The peer from which the data was received
+    std::string peerId;
 };
 
 #endif //BITTORRENTCLIENT_BLOCK_H
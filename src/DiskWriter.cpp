@@ -0,0 +1,285 @@
+#include <chrono>
+#include <utility>
+#include <climits>
+#include <algorithm>
+#include <loguru/loguru.hpp>
+
+#include "DiskWriter.h"
+
+#define BYTES_PER_MB 1048576
+#define COALESCE_DELAY_MS 10 // time for which a write is held so that adjacent writes can be merged into it
+
+/**
+ * Starts the writer thread.
+ * @param storage: the file to which the data is written.
+ * @param budget: the memory budget in which the queued data is accounted.
+ * @param coalesceLimit: maximum size of a merged write, 0 not to merge writes.
+ * @param onWritten: receives the Pieces whose data has been written.
+ */
+DiskWriter::DiskWriter(Storage& storage, MemoryBudget& budget, size_t coalesceLimit, WrittenCallback onWritten):
+    storage(storage), budget(budget), coalesceLimit(coalesceLimit), onWritten(std::move(onWritten))
+{
+    size_t blockSize = storage.getBlockSize();
+    if (this->coalesceLimit > blockSize)
+        this->coalesceLimit -= this->coalesceLimit % blockSize;
+    thread = std::thread([this] { this->run(); });
+}
+
+/**
+ * Destructor of the DiskWriter class. Writes the queued data and stops
+ * the writer thread.
+ */
+DiskWriter::~DiskWriter()
+{
+    stop();
+}
+
+/**
+ * Queues data to be written at the given offset of the file, e.g. a Block
+ * of a Piece which is being downloaded.
+ * @param piece: the Piece to which the data belongs.
+ */
+void DiskWriter::write(Piece* piece, long offset, std::string data)
+{
+    queue({ piece, offset, std::move(data), false, std::chrono::steady_clock::now() });
+}
+
+/**
+ * Queues the end of the writes of a Piece: the Piece is reported as
+ * written once all the data queued for it before has been written.
+ */
+void DiskWriter::pieceDone(Piece* piece)
+{
+    queue({ piece, 0, std::string(), true, std::chrono::steady_clock::now() });
+}
+
+/**
+ * Adds a job to the queue. Never blocks, so that the hasher threads are
+ * not held up: the size of the queue is bounded by the memory budget instead.
+ */
+void DiskWriter::queue(Job job)
+{
+    budget.charge(writingData, job.data.size());
+    std::unique_lock<std::mutex> queueLock(lock);
+    bytesQueued += job.data.size();
+    if (!job.data.empty())
+        pendingWrites[job.piece]++;
+    maxBytesQueued = std::max(maxBytesQueued, bytesQueued);
+    jobs.push_back(std::move(job));
+    queueLock.unlock();
+    jobAvailable.notify_one();
+}
+
+/**
+ * Waits until all the queued data has been written, e.g. before data
+ * which has been released from memory is read back from the file.
+ */
+void DiskWriter::drain()
+{
+    std::unique_lock<std::mutex> queueLock(lock);
+    queueEmpty.wait(queueLock, [this] { return stopping || (jobs.empty() && !isWriting); });
+}
+
+/**
+ * Waits until all the data queued for the given Piece has been written,
+ * e.g. before data of the Piece which has been released from memory is
+ * read back from the file. The writes of the other Pieces are not waited
+ * for.
+ */
+void DiskWriter::waitForPiece(Piece* piece)
+{
+    std::unique_lock<std::mutex> queueLock(lock);
+    pieceWritesDone.wait(queueLock, [this, piece] { return stopping || pendingWrites.count(piece) == 0; });
+}
+
+/**
+ * Stops the writer thread once all the queued data has been written.
+ */
+void DiskWriter::stop()
+{
+    std::unique_lock<std::mutex> queueLock(lock);
+    stopping = true;
+    queueLock.unlock();
+    jobAvailable.notify_all();
+    queueEmpty.notify_all();
+    pieceWritesDone.notify_all();
+    if (thread.joinable())
+        thread.join();
+}
+
+/**
+ * Returns the number of bytes waiting to be written.
+ */
+size_t DiskWriter::queuedBytes()
+{
+    std::lock_guard<std::mutex> queueLock(lock);
+    return bytesQueued;
+}
+
+/**
+ * Returns the number of write calls made to the Storage so far.
+ */
+unsigned long DiskWriter::getWriteCalls()
+{
+    std::lock_guard<std::mutex> queueLock(lock);
+    return writeCalls;
+}
+
+/**
+ * Logs the throughput of the writes, the number of write calls and the
+ * average size of a write, and the peak size of the queue.
+ */
+void DiskWriter::logStatistics()
+{
+    std::lock_guard<std::mutex> queueLock(lock);
+    double throughput = writeSeconds == 0 ? 0 : (double) bytesWritten / writeSeconds / BYTES_PER_MB;
+    double bytesPerWrite = writeCalls == 0 ? 0 : (double) bytesWritten / (double) writeCalls;
+    LOG_F(INFO, "Disk writer: %.2f MB written at %.2f MB/s in %lu write calls for %lu writes "
+                "(%.2f KB per call), maximum queue %.2f MB",
+          (double) bytesWritten / BYTES_PER_MB, throughput, writeCalls, writeJobs, bytesPerWrite / 1024,
+          (double) maxBytesQueued / BYTES_PER_MB);
+}
+
+/**
+ * Takes the next write off the queue, along with the queued writes which
+ * directly follow it in the file, up to 'coalesceLimit' bytes in total.
+ * A write is not moved ahead of an earlier one which overlaps it, so the
+ * data written last to any part of the file is still the data queued last.
+ * Must be called with the lock held and a non-empty queue.
+ * @return the writes in the order of their offsets, or the end of a Piece.
+ */
+std::vector<DiskWriter::Job> DiskWriter::nextWrite()
+{
+    std::vector<Job> run;
+    run.push_back(std::move(jobs.front()));
+    jobs.pop_front();
+    if (run.front().data.empty())
+        return run;
+    long end = run.front().offset + (long) run.front().data.size();
+    size_t length = run.front().data.size();
+    bool isExtended = true;
+    while (isExtended && length < coalesceLimit && run.size() < IOV_MAX)
+    {
+        isExtended = false;
+        // The ranges of the writes which are left in the queue
+        std::vector<std::pair<long, long>> skipped;
+        for (auto iter = jobs.begin(); iter != jobs.end(); iter++)
+        {
+            if (iter->data.empty())
+                continue;
+            long jobEnd = iter->offset + (long) iter->data.size();
+            // Only the write which follows the run is checked against the
+            // skipped ones, so that a long queue is not scanned quadratically
+            if (iter->offset == end && length + iter->data.size() <= coalesceLimit &&
+                std::none_of(skipped.begin(), skipped.end(), [&](const std::pair<long, long>& range)
+                {
+                    return iter->offset < range.second && range.first < jobEnd;
+                }))
+            {
+                end = jobEnd;
+                length += iter->data.size();
+                run.push_back(std::move(*iter));
+                jobs.erase(iter);
+                isExtended = true;
+                break;
+            }
+            skipped.emplace_back(iter->offset, jobEnd);
+        }
+    }
+    return run;
+}
+
+/**
+ * Main loop of the writer thread. Writes the queued data in order until
+ * the DiskWriter is stopped and the queue is empty. When merging writes,
+ * the first queued write is held for up to COALESCE_DELAY_MS, unless
+ * enough data to fill a merged write is already queued.
+ */
+void DiskWriter::run()
+{
+    while (true)
+    {
+        std::unique_lock<std::mutex> queueLock(lock);
+        jobAvailable.wait(queueLock, [this] { return stopping || !jobs.empty(); });
+        if (jobs.empty())
+            return;
+        if (coalesceLimit > 0 && !jobs.front().data.empty())
+            jobAvailable.wait_until(queueLock, jobs.front().queuedAt + std::chrono::milliseconds(COALESCE_DELAY_MS),
+                                    [this] { return stopping || bytesQueued >= coalesceLimit; });
+        std::vector<Job> run = nextWrite();
+        isWriting = true;
+        queueLock.unlock();
+
+        size_t length = 0;
+        for (const Job& job : run)
+            length += job.data.size();
+        bool hasFailed = false;
+        if (length > 0)
+        {
+            auto start = std::chrono::steady_clock::now();
+            try
+            {
+                if (run.size() == 1)
+                    storage.write(run.front().offset, run.front().data.data(), length);
+                else
+                {
+                    std::vector<iovec> buffers;
+                    for (Job& job : run)
+                        buffers.push_back({ &job.data[0], job.data.size() });
+                    storage.write(run.front().offset, std::move(buffers));
+                }
+            }
+            catch (std::runtime_error& e)
+            {
+                LOG_F(ERROR, "%s", e.what());
+                hasFailed = true;
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            queueLock.lock();
+            writeSeconds += elapsed.count();
+            writeCalls++;
+            writeJobs += run.size();
+            if (!hasFailed)
+                bytesWritten += length;
+            queueLock.unlock();
+        }
+
+        // Only the end of a Piece is taken off the queue on its own
+        Job& job = run.front();
+        bool isWritten = true;
+        if (hasFailed || job.isLast)
+        {
+            queueLock.lock();
+            if (hasFailed)
+            {
+                for (const Job& failedJob : run)
+                    failedPieces.insert(failedJob.piece);
+            }
+            else
+                isWritten = failedPieces.erase(job.piece) == 0;
+            queueLock.unlock();
+        }
+        if (job.isLast)
+            onWritten(job.piece, isWritten);
+
+        queueLock.lock();
+        bytesQueued -= length;
+        isWriting = false;
+        bool isEmpty = jobs.empty();
+        bool isPieceWritten = false;
+        for (const Job& writtenJob : run)
+        {
+            auto pending = pendingWrites.find(writtenJob.piece);
+            if (writtenJob.data.empty() || pending == pendingWrites.end() || --pending->second > 0)
+                continue;
+            pendingWrites.erase(pending);
+            isPieceWritten = true;
+        }
+        queueLock.unlock();
+        budget.release(writingData, length);
+        if (isEmpty)
+            queueEmpty.notify_all();
+        if (isPieceWritten)
+            pieceWritesDone.notify_all();
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef BITTORRENTCLIENT_DISKWRITER_H
+#define BITTORRENTCLIENT_DISKWRITER_H
+
+#include <set>
+#include <map>
+#include <deque>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+#include "Piece.h"
+#include "Storage.h"
+#include "MemoryBudget.h"
+
+/**
+ * A dedicated thread which performs all the writes to the Storage, so
+ * that neither the network threads nor the hasher threads wait on the
+ * disk. Writes are carried out in the order in which they are queued.
+ * The queued data is part of the memory budget of the download, which
+ * holds back new pieces until the writer catches up, instead of memory
+ * growing without bound.
+ * Writes to adjacent parts of the file, e.g. pieces completed one after
+ * the other, are held briefly and merged into a single pwritev of up to
+ * 'coalesceLimit' bytes, rounded down to the block size of the file
+ * system so that the merged writes stay aligned with its blocks.
+ */
+class DiskWriter
+{
+public:
+    // Called from the writer thread once all the data queued for a
+    // Piece has been written, with false if any of the writes failed
+    typedef std::function<void(Piece*, bool)> WrittenCallback;
+
+    explicit DiskWriter(Storage& storage, MemoryBudget& budget, size_t coalesceLimit, WrittenCallback onWritten);
+    ~DiskWriter();
+    void write(Piece* piece, long offset, std::string data);
+    void pieceDone(Piece* piece);
+    void drain();
+    void waitForPiece(Piece* piece);
+    void stop();
+    size_t queuedBytes();
+    unsigned long getWriteCalls();
+    void logStatistics();
+
+private:
+    struct Job
+    {
+        Piece* piece;
+        long offset;
+        std::string data;
+        // Whether this is the last job of the Piece, after which the
+        // Piece is reported as written
+        bool isLast;
+        std::chrono::steady_clock::time_point queuedAt;
+    };
+
+    Storage& storage;
+    MemoryBudget& budget;
+    size_t coalesceLimit;
+    const WrittenCallback onWritten;
+    std::deque<Job> jobs;
+    size_t bytesQueued = 0;
+    bool isWriting = false;
+    bool stopping = false;
+    std::thread thread;
+    // Pieces for which a write has failed
+    std::set<Piece*> failedPieces;
+    // Number of writes queued or in progress for each Piece
+    std::map<Piece*, int> pendingWrites;
+
+    size_t maxBytesQueued = 0;
+    unsigned long bytesWritten = 0;
+    unsigned long writeCalls = 0;
+    unsigned long writeJobs = 0;
+    double writeSeconds = 0;
+
+    std::mutex lock;
+    std::condition_variable jobAvailable;
+    std::condition_variable queueEmpty;
+    std::condition_variable pieceWritesDone;
+
+    void queue(Job job);
+    std::vector<Job> nextWrite();
+    void run();
+};
+
+#endif //BITTORRENTCLIENT_DISKWRITER_H
@@ -0,0 +1,182 @@
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <loguru/loguru.hpp>
+
+#include "FileCache.h"
+
+#define FILE_CACHE_SHARDS 16
+
+/**
+ * @param capacity: number of descriptors kept open, spread over the shards.
+ * @param openFlags: flags with which all the files are opened, in addition
+ * to the access mode.
+ */
+FileCache::FileCache(size_t capacity, int openFlags):
+    shardCapacity(std::max((size_t) 1, capacity / FILE_CACHE_SHARDS)), openFlags(openFlags), shards(FILE_CACHE_SHARDS)
+{
+}
+
+/**
+ * Destructor of the FileCache class. Closes all the descriptors, which
+ * must no longer be in use.
+ */
+FileCache::~FileCache()
+{
+    for (Shard& shard : shards)
+    {
+        for (Entry& entry : shard.entries)
+            close(entry.fd);
+    }
+}
+
+/**
+ * Returns the shard in which the descriptors of the given file are kept.
+ */
+FileCache::Shard& FileCache::shardOf(size_t fileIndex)
+{
+    return shards[fileIndex % shards.size()];
+}
+
+/**
+ * Retrieves an open descriptor of the given file, opening the file if it
+ * is not in the cache. The least recently used descriptors which are not
+ * in use are closed when the shard is full.
+ * @param fileIndex: index of the file, which identifies it in the cache.
+ * @param path: path of the file.
+ * @param isWrite: whether the descriptor is used to write to the file.
+ */
+FileCache::FileHandle FileCache::open(size_t fileIndex, const std::string& path, bool isWrite)
+{
+    Shard& shard = shardOf(fileIndex);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    // A read can use a descriptor opened for writing
+    for (size_t key : { fileIndex * 2 + 1, fileIndex * 2 })
+    {
+        if (!isWrite || key % 2 == 1)
+        {
+            auto iter = shard.index.find(key);
+            if (iter == shard.index.end())
+                continue;
+            shard.entries.splice(shard.entries.begin(), shard.entries, iter->second);
+            Entry& entry = shard.entries.front();
+            entry.users++;
+            shard.hits++;
+            return FileHandle(this, fileIndex, &entry);
+        }
+    }
+
+    shard.misses++;
+    evict(shard, shardCapacity - 1, std::chrono::steady_clock::time_point::max());
+    int fd = ::open(path.c_str(), (isWrite ? O_RDWR : O_RDONLY) | openFlags);
+    if (fd < 0)
+        throw std::runtime_error("Cannot open " + path + " [" + strerror(errno) + "]");
+    size_t key = fileIndex * 2 + (isWrite ? 1 : 0);
+    shard.entries.push_front({ key, fd, 1, std::chrono::steady_clock::now() });
+    shard.index[key] = shard.entries.begin();
+    return FileHandle(this, fileIndex, &shard.entries.front());
+}
+
+/**
+ * Marks a descriptor as no longer used by a FileHandle. Descriptors which
+ * were opened while all the others were in use are closed once released.
+ */
+void FileCache::release(size_t fileIndex, Entry* entry)
+{
+    Shard& shard = shardOf(fileIndex);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    entry->users--;
+    entry->lastUsed = std::chrono::steady_clock::now();
+    if (shard.entries.size() > shardCapacity)
+        evict(shard, shardCapacity, std::chrono::steady_clock::time_point::max());
+}
+
+/**
+ * Closes the least recently used descriptors which are not in use, until
+ * the shard holds at most 'capacity' descriptors, or all the descriptors
+ * which have been idle since before 'idleBefore'.
+ * Must be called with the lock of the shard held.
+ */
+void FileCache::evict(Shard& shard, size_t capacity, std::chrono::steady_clock::time_point idleBefore)
+{
+    for (auto iter = shard.entries.end(); iter != shard.entries.begin();)
+    {
+        iter--;
+        bool isFull = shard.entries.size() > capacity;
+        if (!isFull && iter->lastUsed >= idleBefore)
+            break;
+        if (iter->users > 0)
+            continue;
+        close(iter->fd);
+        shard.index.erase(iter->key);
+        iter = shard.entries.erase(iter);
+        shard.evictions++;
+    }
+}
+
+/**
+ * Closes the descriptors which have not been used for the given time.
+ */
+void FileCache::closeIdle(std::chrono::seconds idleTime)
+{
+    auto idleBefore = std::chrono::steady_clock::now() - idleTime;
+    for (Shard& shard : shards)
+    {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        evict(shard, shard.entries.size(), idleBefore);
+    }
+}
+
+/**
+ * Logs the hit rate of the cache, and the number of descriptors closed
+ * to make room for others or because they were idle.
+ */
+void FileCache::logStatistics()
+{
+    unsigned long hits = 0;
+    unsigned long misses = 0;
+    unsigned long evictions = 0;
+    for (Shard& shard : shards)
+    {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        hits += shard.hits;
+        misses += shard.misses;
+        evictions += shard.evictions;
+    }
+    double hitRate = hits + misses == 0 ? 0 : (double) hits / (double) (hits + misses) * 100;
+    LOG_F(INFO, "File descriptor cache: %lu hits, %lu misses (%.2f%% hit rate), %lu descriptors closed",
+          hits, misses, hitRate, evictions);
+}
+
+/**
+ * @param entry: the descriptor, whose number of users has been incremented.
+ */
+FileCache::FileHandle::FileHandle(FileCache* cache, size_t fileIndex, Entry* entry):
+    cache(cache), fileIndex(fileIndex), entry(entry)
+{
+}
+
+FileCache::FileHandle::FileHandle(FileHandle&& other) noexcept:
+    cache(other.cache), fileIndex(other.fileIndex), entry(other.entry)
+{
+    other.entry = nullptr;
+}
+
+/**
+ * Releases the descriptor, which may then be closed by the cache.
+ */
+FileCache::FileHandle::~FileHandle()
+{
+    if (entry)
+        cache->release(fileIndex, entry);
+}
+
+/**
+ * Retrieves the open file descriptor.
+ */
+int FileCache::FileHandle::fd() const
+{
+    return entry->fd;
+}
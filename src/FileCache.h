@@ -0,0 +1,80 @@
+#ifndef BITTORRENTCLIENT_FILECACHE_H
+#define BITTORRENTCLIENT_FILECACHE_H
+
+#include <list>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/**
+ * A bounded cache of open file descriptors, so that Torrents with many
+ * files neither exhaust the limit on open files nor open a file for every
+ * access. Files are opened read-only or read-write depending on the use:
+ * a read may use a descriptor opened for writing, but not the reverse.
+ * The cache is split into shards, each with its own lock and its own
+ * least recently used list, so that threads accessing different files
+ * rarely wait for each other. A descriptor is only closed once no
+ * FileHandle uses it.
+ */
+class FileCache
+{
+private:
+    struct Entry
+    {
+        // Index of the file, times 2, plus 1 if it is open for writing
+        size_t key;
+        int fd;
+        int users;
+        std::chrono::steady_clock::time_point lastUsed;
+    };
+
+    struct Shard
+    {
+        std::mutex lock;
+        // Most recently used first
+        std::list<Entry> entries;
+        std::unordered_map<size_t, std::list<Entry>::iterator> index;
+        unsigned long hits = 0;
+        unsigned long misses = 0;
+        unsigned long evictions = 0;
+    };
+
+    const size_t shardCapacity;
+    // Flags added to the access mode when opening the files, e.g. O_DIRECT
+    const int openFlags;
+    std::vector<Shard> shards;
+
+    Shard& shardOf(size_t fileIndex);
+    void release(size_t fileIndex, Entry* entry);
+    void evict(Shard& shard, size_t capacity, std::chrono::steady_clock::time_point idleBefore);
+
+public:
+    /**
+     * An open file descriptor, which stays open while the FileHandle exists.
+     */
+    class FileHandle
+    {
+    private:
+        FileCache* cache;
+        size_t fileIndex;
+        Entry* entry;
+
+    public:
+        FileHandle(FileCache* cache, size_t fileIndex, Entry* entry);
+        FileHandle(FileHandle&& other) noexcept;
+        FileHandle(const FileHandle&) = delete;
+        FileHandle& operator=(const FileHandle&) = delete;
+        ~FileHandle();
+        int fd() const;
+    };
+
+    explicit FileCache(size_t capacity, int openFlags = 0);
+    ~FileCache();
+    FileHandle open(size_t fileIndex, const std::string& path, bool isWrite);
+    void closeIdle(std::chrono::seconds idleTime);
+    void logStatistics();
+};
+
+#endif //BITTORRENTCLIENT_FILECACHE_H
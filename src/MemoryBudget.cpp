@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <loguru/loguru.hpp>
+
+#include "MemoryBudget.h"
+
+#define BYTES_PER_MB 1048576
+#define RESUME_PERCENTAGE 75 // usage, in percent of the capacity, below which new pieces are started again
+#define ROOM_WAIT_TIMEOUT 1  // 1 sec
+
+/**
+ * @param capacity: number of bytes above which no new piece is started,
+ * 0 for no limit.
+ */
+MemoryBudget::MemoryBudget(size_t capacity):
+    capacity(capacity), resumeLevel(capacity / 100 * RESUME_PERCENTAGE) {}
+
+/**
+ * Adds data held in memory at the given stage, e.g. the size of a piece
+ * which is being started.
+ */
+void MemoryBudget::charge(BudgetStage stage, size_t bytes)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    stageBytes[stage] += bytes;
+    usedBytes += bytes;
+    update();
+}
+
+/**
+ * Removes data which is no longer held in memory at the given stage, e.g.
+ * once it has been written to disk.
+ */
+void MemoryBudget::release(BudgetStage stage, size_t bytes)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    bytes = std::min(bytes, stageBytes[stage]);
+    stageBytes[stage] -= bytes;
+    usedBytes -= bytes;
+    update();
+}
+
+/**
+ * Moves data from one stage to the next, e.g. a Block which has been
+ * received. The usage of the budget does not change.
+ */
+void MemoryBudget::move(BudgetStage from, BudgetStage to, size_t bytes)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    bytes = std::min(bytes, stageBytes[from]);
+    stageBytes[from] -= bytes;
+    stageBytes[to] += bytes;
+}
+
+/**
+ * Starts holding back new pieces once the budget is used up, and resumes
+ * once the usage has fallen below the resume level. Must be called with
+ * the lock held.
+ */
+void MemoryBudget::update()
+{
+    peakBytes = std::max(peakBytes, usedBytes);
+    auto currentTime = std::chrono::steady_clock::now();
+    if (!throttled && capacity > 0 && usedBytes >= capacity)
+    {
+        throttled = true;
+        throttledSince = currentTime;
+        throttledPeriods++;
+    }
+    else if (throttled && usedBytes <= resumeLevel)
+    {
+        throttled = false;
+        throttledSeconds += std::chrono::duration<double>(currentTime - throttledSince).count();
+        roomAvailable.notify_all();
+    }
+}
+
+/**
+ * Checks if new pieces are being held back.
+ */
+bool MemoryBudget::isThrottled()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return throttled && !stopping;
+}
+
+/**
+ * Waits until new pieces may be started again, or for at most
+ * ROOM_WAIT_TIMEOUT, after which the caller looks again for a Block of
+ * the started pieces to request (e.g. a request which has expired).
+ */
+void MemoryBudget::waitForRoom()
+{
+    std::unique_lock<std::mutex> budgetLock(lock);
+    if (!throttled || stopping)
+        return;
+    auto start = std::chrono::steady_clock::now();
+    roomAvailable.wait_for(budgetLock, std::chrono::seconds(ROOM_WAIT_TIMEOUT),
+                           [this] { return !throttled || stopping; });
+    stalledSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Releases the threads waiting for room, once the download is stopping.
+ */
+void MemoryBudget::stop()
+{
+    std::unique_lock<std::mutex> budgetLock(lock);
+    stopping = true;
+    budgetLock.unlock();
+    roomAvailable.notify_all();
+}
+
+/**
+ * Logs the memory currently used at each stage, if any.
+ */
+void MemoryBudget::logUsage()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (usedBytes == 0)
+        return;
+    LOG_F(INFO, "Memory budget: %.2f / %.2f MB (requested %.2f MB, received %.2f MB, hashing %.2f MB, "
+                "writing %.2f MB)%s",
+          (double) usedBytes / BYTES_PER_MB, (double) capacity / BYTES_PER_MB,
+          (double) stageBytes[requestedData] / BYTES_PER_MB, (double) stageBytes[receivedData] / BYTES_PER_MB,
+          (double) stageBytes[hashingData] / BYTES_PER_MB, (double) stageBytes[writingData] / BYTES_PER_MB,
+          throttled ? ", new pieces held back" : "");
+}
+
+/**
+ * Logs the peak usage of the budget, and how long new pieces were held
+ * back and the connections stalled because the budget was used up.
+ */
+void MemoryBudget::logStatistics()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    double seconds = throttledSeconds;
+    if (throttled)
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - throttledSince).count();
+    LOG_F(INFO, "Memory budget of %.2f MB: peak usage %.2f MB, new pieces held back %lu times (%.2f s in total), "
+                "connections stalled waiting for room for %.2f s in total",
+          (double) capacity / BYTES_PER_MB, (double) peakBytes / BYTES_PER_MB, throttledPeriods, seconds,
+          stalledSeconds);
+}
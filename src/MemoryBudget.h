@@ -0,0 +1,73 @@
+#ifndef BITTORRENTCLIENT_MEMORYBUDGET_H
+#define BITTORRENTCLIENT_MEMORYBUDGET_H
+
+#include <chrono>
+#include <mutex>
+#include <cstddef>
+#include <condition_variable>
+
+#define BUDGET_STAGES 4
+
+/**
+ * The stages through which the data of a piece goes while it is held in
+ * memory, from the moment the piece is started until it has been written.
+ */
+enum BudgetStage
+{
+    // Blocks of the started pieces which have not been received yet
+    requestedData = 0,
+    // Blocks received for pieces which are not complete yet
+    receivedData = 1,
+    // Complete pieces waiting to be hashed and verified
+    hashingData = 2,
+    // Data waiting in the queue of the disk writer
+    writingData = 3
+};
+
+/**
+ * A budget of memory shared by the pieces being downloaded, so that the
+ * memory stays bounded whatever the speed of the disk compared to that of
+ * the network. The whole size of a piece is reserved when it is started,
+ * and its data is then moved from one stage to the next until it has been
+ * written to disk.
+ * Once the budget is used up, no new piece is started until the usage
+ * falls back below a lower level (i.e. with hysteresis), so that requests
+ * do not resume and stop again with every write. The pieces which have
+ * already been started are still completed, since their memory is part
+ * of the budget. The time during which requests are held back is recorded.
+ */
+class MemoryBudget
+{
+private:
+    const size_t capacity;
+    const size_t resumeLevel;
+    size_t stageBytes[BUDGET_STAGES] = {};
+    size_t usedBytes = 0;
+    size_t peakBytes = 0;
+    bool throttled = false;
+    bool stopping = false;
+
+    std::chrono::steady_clock::time_point throttledSince;
+    unsigned long throttledPeriods = 0;
+    double throttledSeconds = 0;
+    // Time spent by the connections waiting for room
+    double stalledSeconds = 0;
+
+    std::mutex lock;
+    std::condition_variable roomAvailable;
+
+    void update();
+
+public:
+    explicit MemoryBudget(size_t capacity);
+    void charge(BudgetStage stage, size_t bytes);
+    void release(BudgetStage stage, size_t bytes);
+    void move(BudgetStage from, BudgetStage to, size_t bytes);
+    bool isThrottled();
+    void waitForRoom();
+    void stop();
+    void logUsage();
+    void logStatistics();
+};
+
+#endif //BITTORRENTCLIENT_MEMORYBUDGET_H
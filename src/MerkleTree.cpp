@@ -0,0 +1,76 @@
+#include <utility>
+#include <crypto/sha256_engine.h>
+
+#include "MerkleTree.h"
+
+/**
+ * Computes the hash of a leaf, i.e. the SHA-256 hash of a block of at
+ * most MERKLE_LEAF_SIZE bytes.
+ * @return the raw 32-byte hash.
+ */
+std::string MerkleTree::hashLeaf(const char* data, size_t length)
+{
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    SHA256Engine::hash(data, length, digest);
+    return std::string((const char*) digest, SHA256_DIGEST_LENGTH);
+}
+
+/**
+ * Computes the hash of an inner node from the hashes of its two children.
+ */
+std::string MerkleTree::hashPair(const std::string& left, const std::string& right)
+{
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    SHA256Engine engine;
+    engine.update(left.data(), left.size());
+    engine.update(right.data(), right.size());
+    engine.final(digest);
+    return std::string((const char*) digest, SHA256_DIGEST_LENGTH);
+}
+
+/**
+ * Computes the root of a subtree whose leaves all lie beyond the end of
+ * the file, i.e. the hash which pads a layer of the tree.
+ * @param leafCount: number of leaves in the subtree, a power of two.
+ */
+std::string MerkleTree::paddingHash(size_t leafCount)
+{
+    std::string hash(SHA256_DIGEST_LENGTH, '\0');
+    for (; leafCount > 1; leafCount /= 2)
+        hash = hashPair(hash, hash);
+    return hash;
+}
+
+/**
+ * Computes the root of a tree from one of its layers.
+ * @param hashes: the hashes of the layer, from left to right.
+ * @param width: number of nodes in the layer once padded, a power of two.
+ * @param padding: the hash of the nodes which lie beyond the end of the file.
+ */
+std::string MerkleTree::root(std::vector<std::string> hashes, size_t width, const std::string& padding)
+{
+    hashes.resize(width, padding);
+    while (hashes.size() > 1)
+    {
+        for (size_t i = 0; i < hashes.size() / 2; i++)
+            hashes[i] = hashPair(hashes[2 * i], hashes[2 * i + 1]);
+        hashes.resize(hashes.size() / 2);
+    }
+    return hashes.empty() ? padding : hashes[0];
+}
+
+/**
+ * Computes the number of leaves covered by the hash of a piece. A file
+ * which fits in a single piece has no piece layer: its piece is then
+ * checked against the root of the whole tree instead.
+ */
+size_t MerkleTree::leavesPerPiece(long pieceLength, long fileSize)
+{
+    if (fileSize > pieceLength)
+        return pieceLength / MERKLE_LEAF_SIZE;
+    size_t leafCount = (fileSize + MERKLE_LEAF_SIZE - 1) / MERKLE_LEAF_SIZE;
+    size_t width = 1;
+    while (width < leafCount)
+        width *= 2;
+    return width;
+}
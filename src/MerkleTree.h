@@ -0,0 +1,27 @@
+#ifndef BITTORRENTCLIENT_MERKLETREE_H
+#define BITTORRENTCLIENT_MERKLETREE_H
+
+#include <string>
+#include <vector>
+
+#define MERKLE_LEAF_SIZE 16384 // 2 ^ 14
+
+/**
+ * Helpers for the SHA-256 Merkle trees of BitTorrent v2 (BEP 52).
+ * The leaves of the tree of a file are the hashes of its 16 KiB blocks,
+ * and the tree is padded with zero hashes up to a power of two leaves.
+ * The roots of the subtrees which cover a piece each form the piece
+ * layer of the file.
+ * See: https://www.bittorrent.org/beps/bep_0052.html
+ */
+class MerkleTree
+{
+public:
+    static std::string hashLeaf(const char* data, size_t length);
+    static std::string hashPair(const std::string& left, const std::string& right);
+    static std::string paddingHash(size_t leafCount);
+    static std::string root(std::vector<std::string> hashes, size_t width, const std::string& padding);
+    static size_t leavesPerPiece(long pieceLength, long fileSize);
+};
+
+#endif //BITTORRENTCLIENT_MERKLETREE_H
@@ -7,6 +7,7 @@
 #include <cassert>
 #include <cstring>
 #include <chrono>
+#include <ctime>
 #include <unistd.h>
 #include <netinet/in.h>
 #include <loguru/loguru.hpp>
@@ -20,6 +21,14 @@
 #define PEER_ID_STARTING_POS 48
 #define HASH_LEN 20
 #define DUMMY_PEER_IP "0.0.0.0"
+#define UNINTERESTING_PEER_TIMEOUT 30 // 30 sec
+#define MERKLE_HASH_LEN 32
+// Pieces root, base layer, index, length and proof layers
+#define HASH_REQUEST_LENGTH (MERKLE_HASH_LEN + 16)
+#define V2_RESERVED_BYTE 7
+#define V2_RESERVED_BIT 0x10
+#define REQUEST_LENGTH 12
+#define MAX_BLOCK_LENGTH 131072 // 128 KiB, larger requests are not served
 
 /**
  * Constructor of the class PeerConnection.
@@ -61,10 +70,14 @@ void PeerConnection::start() {
             // that we are interested.
             if (establishNewConnection())
             {
-                while (!pieceManager->isComplete())
+                while (!terminated && !pieceManager->isComplete())
                 {
+                    if (pieceManager->isBanned(peerId))
+                        throw std::runtime_error("Peer " + peer->ip + " has been banned for sending corrupt data");
                     BitTorrentMessage message = receiveMessage();
-                    if (message.getMessageId() > 10)
+                    uint8_t messageId = message.getMessageId();
+                    if (messageId > 10 && (messageId < hashRequest || messageId > hashReject) &&
+                        messageId != (uint8_t) keepAlive)
                         throw std::runtime_error("Received invalid message Id from peer " + peerId);
                     switch (message.getMessageId())
                     {
@@ -76,6 +89,20 @@ void PeerConnection::start() {
                             choked = false;
                             break;
 
+                        case interested:
+                            peerInterested = true;
+                            updatePeerChoking();
+                            break;
+
+                        case notInterested:
+                            peerInterested = false;
+                            updatePeerChoking();
+                            break;
+
+                        case request:
+                            servePiece(message.getPayload());
+                            break;
+
                         case piece:
                         {
                             requestPending = false;
@@ -93,17 +120,44 @@ void PeerConnection::start() {
                             pieceManager->updatePeer(peerId, pieceIndex);
                             break;
                         }
+                        case cancel:
+                            // Requests are served as soon as they are received,
+                            // so there is nothing left to cancel
+                            break;
+
+                        case hashRequest:
+                            // Hashes are not served, the request is rejected as is
+                            outgoingMessages += BitTorrentMessage(hashReject, message.getPayload()).toString();
+                            break;
+
+                        case hashes:
+                            receiveHashes(message.getPayload());
+                            break;
+
+                        case hashReject:
+                        {
+                            std::string payload = message.getPayload();
+                            if (payload.size() >= HASH_REQUEST_LENGTH && pieceManager->getLeavesPerPiece() > 0)
+                            {
+                                int hashIndex = bytesToInt(payload.substr(MERKLE_HASH_LEN + 4, 4));
+                                pieceManager->hashesRejected(hashIndex / (int) pieceManager->getLeavesPerPiece());
+                            }
+                            break;
+                        }
 
                         default:
                             break;
                     }
-                    if (!choked)
+                    updateInterest();
+                    queueHaveMessages();
+                    if (!choked && amInterested)
                     {
                         if (!requestPending)
                         {
                             requestPiece();
                         }
                     }
+                    flushMessages();
                 }
             }
         }
@@ -177,14 +231,54 @@ void PeerConnection::receiveBitField()
     BitTorrentMessage message = receiveMessage();
     if (message.getMessageId() != bitField)
         throw std::runtime_error("Receive BitField from peer: FAILED [Wrong message ID]");
-    peerBitField = message.getPayload();
 
     // Informs the PieceManager of the BitField received
-    pieceManager->addPeer(peerId, peerBitField);
+    pieceManager->addPeer(peerId, message.getPayload());
+    peerAdded = true;
 
     LOG_F(INFO, "Receive BitField from peer: SUCCESS");
 }
 
+/**
+ * Sends the BitField of the pieces we have to the peer, if we have any,
+ * so that the peer knows which pieces it can request from us.
+ */
+void PeerConnection::sendBitField()
+{
+    std::string payload = pieceManager->getBitField(completedCursor);
+    if (payload.find_first_not_of('\0') == std::string::npos)
+        return;
+    LOG_F(INFO, "Sending BitField message to peer [%s]...", peer->ip.c_str());
+    std::string bitFieldMessage = BitTorrentMessage(bitField, payload).toString();
+    sendData(sock, bitFieldMessage);
+    LOG_F(INFO, "Send BitField message: SUCCESS");
+}
+
+/**
+ * Queues a Have message for every piece that has been completed since
+ * the peer was last informed, unless the peer already has the piece.
+ */
+void PeerConnection::queueHaveMessages()
+{
+    for (int index : pieceManager->piecesToAnnounce(peerId, completedCursor))
+    {
+        uint32_t pieceIndex = htonl(index);
+        std::string payload((char*) &pieceIndex, sizeof(pieceIndex));
+        outgoingMessages += BitTorrentMessage(have, payload).toString();
+    }
+}
+
+/**
+ * Sends all the queued messages to the peer in a single write.
+ */
+void PeerConnection::flushMessages()
+{
+    if (outgoingMessages.empty())
+        return;
+    sendData(sock, outgoingMessages);
+    outgoingMessages.clear();
+}
+
 /**
  * Sends a request message to the peer for the next block
  * to be downloaded.
@@ -209,15 +303,107 @@ void PeerConnection::requestPiece() {
         payload += (char) temp[i];
 
     std::stringstream info;
-    info << "Sending Request message to peer " << peer->ip << " ";
+    info << "Queueing Request message to peer " << peer->ip << " ";
     info << "[Piece: " << std::to_string(block->piece) << " ";
     info << "Offset: " << std::to_string(block->offset) << " ";
     info << "Length: " << std::to_string(block->length) << "]";
     LOG_F(INFO, "%s", info.str().c_str());
-    std::string requestMessage = BitTorrentMessage(request, payload).toString();
-    sendData(sock, requestMessage);
+    outgoingMessages += BitTorrentMessage(request, payload).toString();
     requestPending = true;
-    LOG_F(INFO, "Send Request message: SUCCESS");
+    requestHashes();
+}
+
+/**
+ * Unchokes the peer when it becomes interested in our pieces, so that it
+ * can request them, and chokes it again once it is no longer interested.
+ */
+void PeerConnection::updatePeerChoking()
+{
+    if (peerInterested == !peerChoked)
+        return;
+    peerChoked = !peerInterested;
+    LOG_F(INFO, "Queueing %s message to peer %s", peerChoked ? "Choke" : "Unchoke", peer->ip.c_str());
+    outgoingMessages += BitTorrentMessage(peerChoked ? choke : unchoke).toString();
+}
+
+/**
+ * Replies to a Request message from the peer with a Piece message holding
+ * the requested Block, read through the PieceManager's read cache.
+ * Requests from a choked peer, or for a Block we do not have, are ignored.
+ * request: <index><begin><length>
+ */
+void PeerConnection::servePiece(const std::string& payload)
+{
+    if (payload.size() != REQUEST_LENGTH)
+        throw std::runtime_error("Received invalid Request message from peer " + peer->ip);
+    int index = bytesToInt(payload.substr(0, 4));
+    int begin = bytesToInt(payload.substr(4, 4));
+    int length = bytesToInt(payload.substr(8, 4));
+    std::string data;
+    if (peerChoked || length > MAX_BLOCK_LENGTH || !pieceManager->readBlock(index, begin, length, data))
+    {
+        LOG_F(INFO, "Ignoring Request message from peer %s [Piece: %d Offset: %d Length: %d]",
+              peer->ip.c_str(), index, begin, length);
+        return;
+    }
+    LOG_F(INFO, "Queueing Piece message to peer %s [Piece: %d Offset: %d Length: %d]",
+          peer->ip.c_str(), index, begin, length);
+    outgoingMessages += BitTorrentMessage(piece, payload.substr(0, 8) + data).toString();
+}
+
+/**
+ * Queues a Hash Request message for the leaf hashes of an ongoing piece,
+ * if any are needed (BitTorrent v2 only). Once received, they allow each
+ * Block of the piece to be verified as soon as it arrives.
+ * The message has the following structure:
+ *
+ * hash request: <pieces root><base layer><index><length><proof layers>
+ * pieces root: root of the Merkle tree of the file.
+ * base layer: the layer of the requested hashes, 0 for the leaves.
+ * index: position of the first requested hash in the layer.
+ * length: number of requested hashes.
+ * proof layers: number of ancestor layers to include, none here since the
+ * hashes are checked against the piece layer from the Torrent file.
+ *
+ * See: https://www.bittorrent.org/beps/bep_0052.html
+ */
+void PeerConnection::requestHashes()
+{
+    int pieceIndex = pieceManager->nextHashRequest(peerId);
+    if (pieceIndex < 0)
+        return;
+
+    uint32_t leafCount = pieceManager->getLeavesPerPiece();
+    uint32_t fields[4] = { htonl(0), htonl(pieceIndex * leafCount), htonl(leafCount), htonl(0) };
+    std::string payload = pieceManager->getPiecesRoot();
+    payload.append((char*) fields, sizeof(fields));
+
+    LOG_F(INFO, "Queueing Hash Request message to peer %s [Piece: %d]", peer->ip.c_str(), pieceIndex);
+    outgoingMessages += BitTorrentMessage(hashRequest, payload).toString();
+}
+
+/**
+ * Reads a Hashes message, which has the fields of the Hash Request it
+ * replies to followed by the requested hashes, and passes the leaf hashes
+ * of the piece to the PieceManager.
+ */
+void PeerConnection::receiveHashes(const std::string& payload)
+{
+    if (payload.size() < HASH_REQUEST_LENGTH || payload.substr(0, MERKLE_HASH_LEN) != pieceManager->getPiecesRoot())
+        throw std::runtime_error("Received invalid Hashes message from peer " + peerId);
+    int baseLayer = bytesToInt(payload.substr(MERKLE_HASH_LEN, 4));
+    int hashIndex = bytesToInt(payload.substr(MERKLE_HASH_LEN + 4, 4));
+    int hashCount = bytesToInt(payload.substr(MERKLE_HASH_LEN + 8, 4));
+    int leafCount = (int) pieceManager->getLeavesPerPiece();
+    if (baseLayer != 0 || hashCount != leafCount || hashIndex % leafCount != 0 ||
+        payload.size() < HASH_REQUEST_LENGTH + (size_t) hashCount * MERKLE_HASH_LEN)
+        throw std::runtime_error("Received unexpected Hashes message from peer " + peerId);
+
+    std::vector<std::string> leafHashes;
+    leafHashes.reserve(hashCount);
+    for (int i = 0; i < hashCount; i++)
+        leafHashes.push_back(payload.substr(HASH_REQUEST_LENGTH + i * MERKLE_HASH_LEN, MERKLE_HASH_LEN));
+    pieceManager->hashesReceived(peerId, hashIndex / leafCount, leafHashes);
 }
 
 
@@ -232,6 +418,53 @@ void PeerConnection::sendInterested()
     LOG_F(INFO, "Send Interested message: SUCCESS");
 }
 
+/**
+ * Send a NotInterested message to the peer.
+ */
+void PeerConnection::sendNotInterested()
+{
+    LOG_F(INFO, "Sending NotInterested message to peer [%s]...", peer->ip.c_str());
+    std::string notInterestedMessage = BitTorrentMessage(notInterested).toString();
+    sendData(sock, notInterestedMessage);
+    LOG_F(INFO, "Send NotInterested message: SUCCESS");
+}
+
+/**
+ * Recomputes whether the peer has any of the pieces we still need, which
+ * changes as the peer announces new pieces with Have messages and as our
+ * own pieces are completed. Lets the peer know with an Interested or
+ * NotInterested message whenever the state changes.
+ * If the peer stays uninteresting, and not interested in our pieces, for
+ * longer than UNINTERESTING_PEER_TIMEOUT while the download is still in
+ * progress, an exception is raised so that
+ * the connection slot can be given to another peer.
+ */
+void PeerConnection::updateInterest()
+{
+    bool isInteresting = pieceManager->isInteresting(peerId);
+    if (isInteresting != amInterested)
+    {
+        amInterested = isInteresting;
+        if (amInterested)
+            sendInterested();
+        else
+            sendNotInterested();
+    }
+
+    // A peer which downloads from us is kept even if it has nothing we need
+    if (amInterested || peerInterested)
+    {
+        uninterestingSince = 0;
+        return;
+    }
+    time_t currentTime = std::time(nullptr);
+    if (!uninterestingSince)
+        uninterestingSince = currentTime;
+    else if (std::difftime(currentTime, uninterestingSince) >= UNINTERESTING_PEER_TIMEOUT &&
+             !pieceManager->isComplete())
+        throw std::runtime_error("Peer " + peer->ip + " has none of the pieces we need");
+}
+
 /**
  * Receives and reads the Unchoke message from the peer.
  * If the received message does not match the expected Unchoke, raise an error.
@@ -253,8 +486,8 @@ void PeerConnection::receiveUnchoke() {
  *
  * 1. Sends the peer a BitTorrent handshake message, waits for its reply and
  * compares the info hashes.
- * 2. Receives and stores the BitField from the peer.
- * 3. Send an Interested message to the peer.
+ * 2. Receives and stores the BitField from the peer, and sends ours.
+ * 3. Send an Interested message to the peer if it has any of the pieces we need.
  *
  * Returns true if a stable connection has been successfully established,
  * false otherwise.
@@ -268,8 +501,11 @@ bool PeerConnection::establishNewConnection() {
     try
     {
         performHandshake();
+        if (pieceManager->isBanned(peerId))
+            throw std::runtime_error("Peer " + peer->ip + " has been banned for sending corrupt data");
         receiveBitField();
-        sendInterested();
+        sendBitField();
+        updateInterest();
         return true;
     }
     catch (const std::runtime_error& e)
@@ -305,6 +541,9 @@ std::string PeerConnection::createHandshakeMessage()
     std::string reserved;
     for (int i = 0; i < 8; i++)
         reserved.push_back('\0');
+    // Lets the peer know that we support BitTorrent v2
+    if (pieceManager->hasMerkleTree())
+        reserved[V2_RESERVED_BYTE] |= V2_RESERVED_BIT;
     buffer << reserved;
     buffer << hexDecode(infoHash);
     buffer << clientId;
@@ -348,10 +587,15 @@ void PeerConnection::closeSock()
         close(sock);
         sock = {};
         requestPending = false;
+        amInterested = false;
+        peerInterested = false;
+        peerChoked = true;
+        uninterestingSince = 0;
+        outgoingMessages.clear();
         // If the peer has been added to piece manager, remove it
-        if (!peerBitField.empty())
+        if (peerAdded)
         {
-            peerBitField.clear();
+            peerAdded = false;
             pieceManager->removePeer(peerId);
         }
     }
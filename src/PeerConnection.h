@@ -5,6 +5,8 @@
 #ifndef BITTORRENTCLIENT_PEERCONNECTION_H
 #define BITTORRENTCLIENT_PEERCONNECTION_H
 
+#include <atomic>
+
 #include "PeerRetriever.h"
 #include "BitTorrentMessage.h"
 #include "PieceManager.h"
@@ -17,22 +19,41 @@ class PeerConnection
 private:
     int sock{};
     bool choked = true;
-    bool terminated = false;
+    std::atomic<bool> terminated { false };
     bool requestPending = false;
+    bool amInterested = false;
+    // Whether the peer is interested in our pieces, and whether we choke it
+    bool peerInterested = false;
+    bool peerChoked = true;
+    time_t uninterestingSince = 0;
+    // Position in the PieceManager's list of completed pieces up to which
+    // the peer has been informed
+    size_t completedCursor = 0;
+    // Messages which are sent together in a single write
+    std::string outgoingMessages;
     const std::string clientId;
     const std::string infoHash;
     SharedQueue<Peer*>* queue;
     Peer* peer;
-    std::string peerBitField;
+    bool peerAdded = false;
     std::string peerId;
     PieceManager* pieceManager;
 
     std::string createHandshakeMessage();
     void performHandshake();
     void receiveBitField();
+    void sendBitField();
+    void queueHaveMessages();
+    void flushMessages();
     void sendInterested();
+    void sendNotInterested();
+    void updateInterest();
     void receiveUnchoke();
     void requestPiece();
+    void servePiece(const std::string& payload);
+    void updatePeerChoking();
+    void requestHashes();
+    void receiveHashes(const std::string& payload);
     void closeSock();
     bool establishNewConnection();
     BitTorrentMessage receiveMessage(int bufferSize = 0) const;
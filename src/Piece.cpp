@@ -9,16 +9,29 @@
 #include <algorithm>
 #include <sstream>
 #include <cassert>
-#include <crypto/sha1.h>
+#include <cstring>
+#include <crypto/sha256_engine.h>
 #include <loguru/loguru.hpp>
 
 #include "Piece.h"
+#include "MerkleTree.h"
 #include "utils.h"
 
-Piece::Piece(int index, std::vector<Block*> blocks, std::string hashValue):
-        index(index), hashValue(std::move(hashValue))
+/**
+ * @param index: index of the Piece in the Torrent.
+ * @param blocks: the Blocks which make up the Piece.
+ * @param hashValue: the SHA1 hash of the Piece, or the root of its subtree
+ * in the Merkle tree of the file.
+ * @param leafWidth: number of leaves in the subtree of the Piece, including
+ * the padding beyond the end of the file, or 0 if the Piece is checked
+ * with its SHA1 hash.
+ */
+Piece::Piece(int index, std::vector<Block*> blocks, std::string hashValue, size_t leafWidth):
+        index(index), hashValue(std::move(hashValue)), leafWidth(leafWidth)
 {
     this->blocks = std::move(blocks);
+    leafHashes.resize(this->blocks.size());
+    rejectedBlocks.assign(this->blocks.size(), false);
 }
 
 /**
@@ -31,12 +44,25 @@ Piece::~Piece()
 }
 
 /**
- * Resets the status of all Blocks in this Piece to Missing.
+ * Resets the status of all Blocks in this Piece to Missing,
+ * and discards the hash computed so far.
  */
 void Piece::reset()
 {
+    std::lock_guard<std::mutex> guard(hashLock);
     for (Block* block : blocks)
+    {
         block->status = missing;
+        block->data.clear();
+    }
+    checksum.reset();
+    hashedBlocks = 0;
+    contiguousBlocks = 0;
+    // The expected leaf hashes have been checked against the Piece hash,
+    // and thus stay valid
+    leafHashes.assign(blocks.size(), std::string());
+    rejectedBlocks.assign(blocks.size(), false);
+    generation++;
 }
 
 /**
@@ -63,16 +89,29 @@ Block* Piece::nextRequest()
  * of the Block specified by 'offset' to Retrieved.
  * @param offset: the offset of the Block within  the Piece.
  * @param data: the data contained in the Block.
+ * @param peerId: the peer from which the Block was received.
+ * @return false if the Block had already been retrieved.
+ * @throws std::runtime_error if the data is not the size of the Block.
  */
-void Piece::blockReceived(int offset, std::string data)
+bool Piece::blockReceived(int offset, std::string data, const std::string& peerId)
 {
     for (Block* block : blocks)
     {
         if (block->offset == offset)
         {
+            // The data of a retrieved Block may be being hashed,
+            // and a duplicate carries the same data anyway
+            if (block->status == retrieved)
+                return false;
+            if ((size_t) block->length != data.size())
+                throw std::runtime_error(
+                "Received " + std::to_string(data.size()) + " bytes for block " + std::to_string(offset) +
+                    " of " + std::to_string(block->length) + " bytes in piece " + std::to_string(index)
+                );
             block->status = retrieved;
-            block->data = data;
-            return;
+            block->data = std::move(data);
+            block->peerId = peerId;
+            return true;
         }
     }
     throw std::runtime_error(
@@ -97,13 +136,195 @@ bool Piece::isComplete()
 }
 
 /**
- * Checks if the SHA1 hash for all the retrieved Block data matches
- * the Piece hash from the Torrent meta-info.
+ * Moves past the Blocks at the start of the Piece which have been
+ * retrieved, i.e. the Blocks which are ready to be hashed in order.
+ * @return true if more Blocks are ready to be hashed, false otherwise.
+ */
+bool Piece::advanceContiguousBlocks()
+{
+    size_t previousBlocks = contiguousBlocks;
+    while (contiguousBlocks < blocks.size() && blocks[contiguousBlocks]->status == retrieved)
+        contiguousBlocks++;
+    return contiguousBlocks > previousBlocks;
+}
+
+/**
+ * Retrieves the number of Blocks at the start of the Piece that have
+ * been retrieved.
+ */
+size_t Piece::getContiguousBlocks() const
+{
+    return contiguousBlocks;
+}
+
+/**
+ * Retrieves the number of times the Piece has been reset.
+ */
+unsigned Piece::getGeneration() const
+{
+    return generation;
+}
+
+/**
+ * Adds the data of the first 'blockCount' Blocks to the hash of the
+ * Piece, skipping the Blocks which have already been hashed. Blocks
+ * received out of order stay buffered until the gap before them is
+ * filled. Nothing is done if the Piece has been reset in the meantime.
+ * For v2 Pieces, each Block is hashed on its own and, if the expected
+ * leaf hashes are known, checked right away: hashing then stops at the
+ * first corrupt Block, which is flagged to be reset.
+ * @param blockCount: number of Blocks at the start of the Piece that
+ * have been retrieved.
+ * @param pieceGeneration: the generation of the Piece when those Blocks
+ * were retrieved.
+ * @param releaseData: whether to free the data of the hashed Blocks
+ * (e.g. when it has already been written to disk).
+ */
+HashingResult Piece::hashBlocks(size_t blockCount, unsigned pieceGeneration, bool releaseData)
+{
+    std::lock_guard<std::mutex> guard(hashLock);
+    if (pieceGeneration != generation)
+        return blocksOutdated;
+    for (; hashedBlocks < blockCount; hashedBlocks++)
+    {
+        Block* block = blocks[hashedBlocks];
+        if (!isMerkle())
+            checksum.update(block->data.data(), block->data.size());
+        else if (rejectedBlocks[hashedBlocks])
+            return blocksRejected;
+        else if (leafHashes[hashedBlocks].empty())
+        {
+            std::string leafHash = MerkleTree::hashLeaf(block->data.data(), block->data.size());
+            if (!expectedLeafHashes.empty() && leafHash != expectedLeafHashes[hashedBlocks])
+            {
+                rejectedBlocks[hashedBlocks] = true;
+                return blocksRejected;
+            }
+            leafHashes[hashedBlocks] = leafHash;
+        }
+        if (releaseData)
+            std::string().swap(block->data);
+    }
+    return blocksHashed;
+}
+
+/**
+ * Checks if the hash for all the retrieved Block data matches the Piece
+ * hash from the Torrent meta-info: the SHA1 hash of the Piece, or the
+ * root of the subtree built from the leaf hashes of its Blocks. Only the
+ * Blocks which have not been hashed incrementally are hashed here.
  */
 bool Piece::isHashMatching()
 {
-    std::string pieceHash = hexDecode(sha1(getData()));
-    return pieceHash == hashValue;
+    assert(isComplete());
+    std::lock_guard<std::mutex> guard(hashLock);
+    if (isMerkle())
+    {
+        for (; hashedBlocks < blocks.size(); hashedBlocks++)
+        {
+            Block* block = blocks[hashedBlocks];
+            if (leafHashes[hashedBlocks].empty())
+                leafHashes[hashedBlocks] = MerkleTree::hashLeaf(block->data.data(), block->data.size());
+        }
+        return MerkleTree::root(leafHashes, leafWidth, std::string(SHA256_DIGEST_LENGTH, '\0')) == hashValue;
+    }
+    for (; hashedBlocks < blocks.size(); hashedBlocks++)
+        checksum.update(blocks[hashedBlocks]->data.data(), blocks[hashedBlocks]->data.size());
+    // Finalises a copy, so that the hash computed so far is kept
+    SHA1Engine pieceChecksum = checksum;
+    unsigned char digest[SHA1_DIGEST_LENGTH];
+    pieceChecksum.final(digest);
+    return hashValue.size() == SHA1_DIGEST_LENGTH && std::memcmp(digest, hashValue.data(), SHA1_DIGEST_LENGTH) == 0;
+}
+
+/**
+ * Checks if the Piece is verified with the Merkle tree of the file (v2)
+ * rather than with a SHA1 hash (v1).
+ */
+bool Piece::isMerkle() const
+{
+    return leafWidth > 0;
+}
+
+/**
+ * Retrieves the number of leaves in the subtree of the Piece, including
+ * the padding beyond the end of the file.
+ */
+size_t Piece::getLeafWidth() const
+{
+    return leafWidth;
+}
+
+/**
+ * Checks if the expected hash of each Block of the Piece is known.
+ */
+bool Piece::hasLeafHashes()
+{
+    std::lock_guard<std::mutex> guard(hashLock);
+    return !expectedLeafHashes.empty();
+}
+
+/**
+ * Sets the expected leaf hashes of the Piece, as received from a peer,
+ * once they have been checked against the hash of the Piece. The Blocks
+ * which have already been hashed and do not match their leaf hash are
+ * flagged to be reset.
+ * Must be called with the lock of the PieceManager held.
+ * @param hashes: the leaf hashes of the subtree of the Piece, including
+ * the padding.
+ * @return false if the hashes do not match the hash of the Piece.
+ */
+bool Piece::setLeafHashes(const std::vector<std::string>& hashes)
+{
+    std::lock_guard<std::mutex> guard(hashLock);
+    if (!expectedLeafHashes.empty())
+        return true;
+    if (hashes.size() != leafWidth ||
+        MerkleTree::root(hashes, leafWidth, std::string(SHA256_DIGEST_LENGTH, '\0')) != hashValue)
+        return false;
+    expectedLeafHashes = hashes;
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        if (!leafHashes[i].empty() && leafHashes[i] != expectedLeafHashes[i])
+            rejectedBlocks[i] = true;
+    }
+    return true;
+}
+
+/**
+ * Resets the Blocks which did not match their leaf hash to Missing, so
+ * that they are requested again. The other Blocks of the Piece are kept.
+ * Must be called with the lock of the PieceManager held.
+ * @return the Blocks which have been reset.
+ */
+std::vector<Block*> Piece::resetRejectedBlocks()
+{
+    std::lock_guard<std::mutex> guard(hashLock);
+    std::vector<Block*> rejected;
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        if (!rejectedBlocks[i])
+            continue;
+        rejectedBlocks[i] = false;
+        leafHashes[i].clear();
+        blocks[i]->status = missing;
+        blocks[i]->data.clear();
+        hashedBlocks = std::min(hashedBlocks, i);
+        contiguousBlocks = std::min(contiguousBlocks, i);
+        rejected.push_back(blocks[i]);
+    }
+    // Drops the hashing work queued before the reset
+    if (!rejected.empty())
+        generation++;
+    return rejected;
+}
+
+/**
+ * Retrieves the hash of the Piece from the Torrent meta-info.
+ */
+const std::string& Piece::getHashValue() const
+{
+    return hashValue;
 }
 
 /**
@@ -122,6 +343,17 @@ std::string Piece::getData()
     return data.str();
 }
 
+/**
+ * Frees the data of all the Blocks, e.g. once it has been handed to
+ * the disk writer. The Blocks keep their status.
+ */
+void Piece::releaseData()
+{
+    std::lock_guard<std::mutex> guard(hashLock);
+    for (Block* block : blocks)
+        std::string().swap(block->data);
+}
+
 
 
 
@@ -5,8 +5,21 @@
 #ifndef BITTORRENTCLIENT_PIECE_H
 #define BITTORRENTCLIENT_PIECE_H
 
+#include <vector>
+#include <mutex>
+#include <crypto/sha1_engine.h>
+
 #include "Block.h"
 
+enum HashingResult
+{
+    blocksHashed = 0,
+    // The Piece has been reset since the Blocks were submitted
+    blocksOutdated = 1,
+    // A Block does not match its hash in the Merkle tree
+    blocksRejected = 2
+};
+
 /**
  * A class representation of a piece of the Torrent content.
  * Each piece except the final one has a length equal to the
@@ -23,20 +36,50 @@
 class Piece
 {
 private:
+    // Either the 20-byte SHA1 hash of the Piece (v1), or the 32-byte
+    // root of its subtree in the Merkle tree of the file (v2)
     const std::string hashValue;
+    // Number of leaves covered by the subtree of the Piece, 0 for v1 Pieces
+    const size_t leafWidth;
+    // The SHA1 hash is computed incrementally over the first
+    // 'hashedBlocks' Blocks, which arrived in order
+    SHA1Engine checksum;
+    size_t hashedBlocks = 0;
+    // v2 Pieces hash each Block separately instead, and check it against
+    // its expected leaf hash as soon as the leaf hashes are known
+    std::vector<std::string> leafHashes;
+    std::vector<std::string> expectedLeafHashes;
+    // Blocks found corrupt, which are reset by resetRejectedBlocks()
+    std::vector<bool> rejectedBlocks;
+    // Number of Blocks at the start of the Piece which have been retrieved
+    size_t contiguousBlocks = 0;
+    // Incremented on every reset, so that outdated hashing work is dropped
+    unsigned generation = 0;
+    std::mutex hashLock;
 
 public:
     const int index;
     std::vector<Block*> blocks;
 
-    explicit Piece(int index, std::vector<Block*> blocks, std::string hashValue);
+    explicit Piece(int index, std::vector<Block*> blocks, std::string hashValue, size_t leafWidth = 0);
     ~Piece();
     void reset();
     std::string getData();
+    void releaseData();
     Block* nextRequest();
-    void blockReceived(int offset, std::string data);
+    bool blockReceived(int offset, std::string data, const std::string& peerId);
     bool isComplete();
+    bool advanceContiguousBlocks();
+    size_t getContiguousBlocks() const;
+    unsigned getGeneration() const;
+    HashingResult hashBlocks(size_t blockCount, unsigned pieceGeneration, bool releaseData);
     bool isHashMatching();
+    bool isMerkle() const;
+    size_t getLeafWidth() const;
+    bool hasLeafHashes();
+    bool setLeafHashes(const std::vector<std::string>& hashes);
+    std::vector<Block*> resetRejectedBlocks();
+    const std::string& getHashValue() const;
 };
 
 #endif //BITTORRENTCLIENT_PIECE_H
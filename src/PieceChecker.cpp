@@ -0,0 +1,363 @@
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <thread>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <crypto/sha1_multi_buffer.h>
+#include <crypto/sha256_engine.h>
+#include <loguru/loguru.hpp>
+
+#include "PieceChecker.h"
+#include "MerkleTree.h"
+
+#define CHECK_PROGRESS_INTERVAL 100 // 0.1 sec
+
+/**
+ * @param downloadDirectory: directory which contains the files to check.
+ * @param torrentFiles: the files of the Torrent, in the order of their data.
+ * @param pieceLength: length of a piece in bytes.
+ * @param pieceHashes: the 20-byte SHA1 hash of each piece, or the 32-byte root
+ * of its subtree in the Merkle tree of the file (single-file Torrents only).
+ * @param threadCount: number of threads hashing the pieces.
+ * @param leafWidth: number of leaves in the subtree of each piece, or 0 if
+ * the pieces are checked with their SHA1 hash.
+ */
+PieceChecker::PieceChecker(const std::string& downloadDirectory, const std::vector<TorrentFile>& torrentFiles,
+                           long pieceLength, std::vector<std::string> pieceHashes, int threadCount,
+                           size_t leafWidth):
+    pieceLength(pieceLength), pieceHashes(std::move(pieceHashes)), threadCount(std::max(threadCount, 1)),
+    leafWidth(leafWidth), validPieces(this->pieceHashes.size())
+{
+    files.reserve(torrentFiles.size());
+    for (const TorrentFile& file : torrentFiles)
+    {
+        files.push_back({ downloadDirectory + file.path, file.offset, file.length, file.isPadding, nullptr, 0, {} });
+        totalSize = file.offset + file.length;
+    }
+}
+
+/**
+ * Verifies all the pieces of the files, displaying the progress in stdout.
+ * Pieces which are beyond the end of a file on disk, in a file which does
+ * not exist, or in holes of sparse files, are considered invalid without
+ * being hashed.
+ * @return the set of pieces whose data matches their hash.
+ */
+Bitfield PieceChecker::check()
+{
+    return check(Bitfield(pieceHashes.size(), true));
+}
+
+/**
+ * Verifies the given pieces of the files, e.g. the pieces completed since
+ * resume data was saved. The other pieces are considered invalid.
+ * @param candidates: the pieces to check.
+ * @return the set of pieces whose data matches their hash.
+ */
+Bitfield PieceChecker::check(const Bitfield& candidates)
+{
+    candidatePieces = candidates;
+    mapFiles();
+    long mappedLength = 0;
+    long dataLength = 0;
+    for (const CheckedFile& file : files)
+    {
+        mappedLength += file.mappedLength;
+        for (const auto& extent : file.dataExtents)
+            dataLength += extent.second - extent.first;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threadCount; i++)
+        threads.emplace_back([this] { this->checkPieces(); });
+
+    std::unique_lock<std::mutex> progressLock(lock);
+    while (checkedPieces < pieceHashes.size())
+    {
+        checkingDone.wait_for(progressLock, std::chrono::milliseconds(CHECK_PROGRESS_INTERVAL));
+        displayProgress(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    progressLock.unlock();
+    for (std::thread& thread : threads)
+        thread.join();
+    std::cout << std::endl;
+    unmapFiles();
+
+    double elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    LOG_F(INFO, "Checked %zu pieces of %zu files in %.2f s (%.2f MB/s) with %d threads: %zu valid, "
+                "%zu skipped as holes (%.2f MB of data in %.2f MB of files)",
+          candidatePieces.count(), files.size(), elapsedSeconds,
+          (double) mappedLength / elapsedSeconds / 1e6, threadCount, validPieces.count(), holePieces.load(),
+          (double) dataLength / 1e6, (double) mappedLength / 1e6);
+    return validPieces;
+}
+
+/**
+ * Maps the part of each file which exists on disk into memory. Missing
+ * files are left unmapped.
+ */
+void PieceChecker::mapFiles()
+{
+    size_t maxPadding = 0;
+    for (CheckedFile& file : files)
+    {
+        if (file.isPadding)
+        {
+            maxPadding = std::max(maxPadding, (size_t) file.length);
+            continue;
+        }
+        if (file.length == 0)
+            continue;
+        int fd = open(file.path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            if (errno == ENOENT)
+                continue;
+            throw std::runtime_error("Cannot open " + file.path + " [" + strerror(errno) + "]");
+        }
+        struct stat fileStatus {};
+        if (fstat(fd, &fileStatus) < 0)
+        {
+            close(fd);
+            throw std::runtime_error("Cannot read the size of " + file.path + " [" + strerror(errno) + "]");
+        }
+        long mappedLength = std::min((long) fileStatus.st_size, file.length);
+        if (mappedLength > 0)
+        {
+            void* mapping = mmap(nullptr, mappedLength, PROT_READ, MAP_SHARED, fd, 0);
+            if (mapping == MAP_FAILED)
+            {
+                close(fd);
+                throw std::runtime_error("Cannot map " + file.path + " [" + strerror(errno) + "]");
+            }
+            madvise(mapping, mappedLength, MADV_SEQUENTIAL);
+            file.data = (const unsigned char*) mapping;
+            file.mappedLength = mappedLength;
+            findDataExtents(file, fd);
+        }
+        // The mapping stays valid after the file is closed
+        close(fd);
+    }
+    zeros.assign(maxPadding, '\0');
+}
+
+/**
+ * Unmaps the files.
+ */
+void PieceChecker::unmapFiles()
+{
+    for (CheckedFile& file : files)
+    {
+        if (file.data)
+            munmap((void*) file.data, file.mappedLength);
+        file.data = nullptr;
+    }
+}
+
+/**
+ * Lists the parts of the mapped length of the file which hold data, by
+ * skipping over the holes with SEEK_DATA and SEEK_HOLE. If the file system
+ * cannot tell, the whole file is considered to hold data.
+ */
+void PieceChecker::findDataExtents(CheckedFile& file, int fd)
+{
+    file.dataExtents.clear();
+    off_t position = 0;
+    while (position < file.mappedLength)
+    {
+        off_t dataStart = lseek(fd, position, SEEK_DATA);
+        // ENXIO: there is no data after the position
+        if (dataStart < 0 && errno == ENXIO)
+            return;
+        off_t dataEnd = dataStart < 0 ? -1 : lseek(fd, dataStart, SEEK_HOLE);
+        if (dataEnd < 0)
+        {
+            file.dataExtents = { { 0, file.mappedLength } };
+            return;
+        }
+        if (dataStart >= file.mappedLength)
+            return;
+        dataEnd = std::min((long) dataEnd, file.mappedLength);
+        file.dataExtents.emplace_back(dataStart, dataEnd);
+        position = dataEnd;
+    }
+}
+
+/**
+ * Checks if the data of the given piece lies entirely in holes of the
+ * files, i.e. if it has never been written. The padding files do not
+ * count as data, and a piece made only of padding is not a hole.
+ */
+bool PieceChecker::isHole(size_t index) const
+{
+    long start = (long) index * pieceLength;
+    long end = std::min(start + pieceLength, totalSize);
+    auto file = std::upper_bound(files.begin(), files.end(), start, [](long position, const CheckedFile& file)
+    {
+        return position < file.offset;
+    }) - 1;
+
+    bool hasFileData = false;
+    for (; file != files.end() && file->offset < end; file++)
+    {
+        long dataStart = std::max(start, file->offset) - file->offset;
+        long dataEnd = std::min(end, file->offset + file->length) - file->offset;
+        if (dataStart >= dataEnd || file->isPadding)
+            continue;
+        hasFileData = true;
+        // The first extent which ends after the start of the data
+        auto extent = std::upper_bound(file->dataExtents.begin(), file->dataExtents.end(), dataStart,
+            [](long position, const std::pair<long, long>& extent) { return position < extent.second; });
+        if (extent != file->dataExtents.end() && extent->first < dataEnd)
+            return false;
+    }
+    return hasFileData;
+}
+
+/**
+ * Finds the spans of memory which make up the given piece: parts of one
+ * or more files, and the zeros of the padding files.
+ * @return false if part of the piece is missing on disk.
+ */
+bool PieceChecker::pieceSpans(size_t index, std::vector<SHA1Span>& spans) const
+{
+    long start = (long) index * pieceLength;
+    long end = std::min(start + pieceLength, totalSize);
+    // The last file which starts at or before the piece
+    auto file = std::upper_bound(files.begin(), files.end(), start, [](long position, const CheckedFile& file)
+    {
+        return position < file.offset;
+    }) - 1;
+
+    spans.clear();
+    for (; file != files.end() && file->offset < end; file++)
+    {
+        long dataStart = std::max(start, file->offset);
+        long dataEnd = std::min(end, file->offset + file->length);
+        if (dataStart >= dataEnd)
+            continue;
+        if (file->isPadding)
+            spans.push_back({ (const unsigned char*) zeros.data(), (size_t) (dataEnd - dataStart) });
+        else if (dataEnd - file->offset > file->mappedLength)
+            return false;
+        else
+            spans.push_back({ file->data + (dataStart - file->offset), (size_t) (dataEnd - dataStart) });
+    }
+    return true;
+}
+
+/**
+ * Main loop of a checking thread. Claims a few consecutive pieces at a
+ * time, so that pieces of the same length can be hashed together in the
+ * lanes of the multi-buffer SHA1, until all pieces have been claimed.
+ */
+void PieceChecker::checkPieces()
+{
+    const size_t batchSize = SHA1MultiBuffer::lanes();
+    const size_t totalPieces = pieceHashes.size();
+    while (true)
+    {
+        size_t first = nextPiece.fetch_add(batchSize);
+        if (first >= totalPieces)
+            return;
+        size_t last = std::min(first + batchSize, totalPieces);
+
+        if (leafWidth > 0)
+        {
+            std::vector<size_t> validIndices;
+            checkMerklePieces(first, last, validIndices);
+            lock.lock();
+            for (size_t index : validIndices)
+                validPieces.set(index);
+            checkedPieces += last - first;
+            lock.unlock();
+            if (checkedPieces >= totalPieces)
+                checkingDone.notify_one();
+            continue;
+        }
+
+        std::vector<size_t> indices;
+        std::vector<std::vector<SHA1Span>> messages;
+        std::vector<SHA1Span> spans;
+        for (size_t index = first; index < last; index++)
+        {
+            if (!candidatePieces.get(index) || !pieceSpans(index, spans))
+                continue;
+            if (isHole(index))
+            {
+                holePieces++;
+                continue;
+            }
+            indices.push_back(index);
+            messages.push_back(spans);
+        }
+
+        std::vector<std::array<unsigned char, SHA1_DIGEST_LENGTH>> digests;
+        SHA1MultiBuffer::hash(messages, digests);
+
+        lock.lock();
+        for (size_t i = 0; i < indices.size(); i++)
+        {
+            const std::string& hashValue = pieceHashes[indices[i]];
+            if (hashValue.size() == SHA1_DIGEST_LENGTH &&
+                std::memcmp(digests[i].data(), hashValue.data(), SHA1_DIGEST_LENGTH) == 0)
+                validPieces.set(indices[i]);
+        }
+        checkedPieces += last - first;
+        lock.unlock();
+        if (checkedPieces >= totalPieces)
+            checkingDone.notify_one();
+    }
+}
+
+/**
+ * Checks the given pieces against the Merkle tree of the file, by hashing
+ * each of their 16 KiB blocks and computing the root of their subtree.
+ * The Torrent has a single file, so each piece is a single span.
+ * @param validIndices: receives the indices of the pieces which are valid.
+ */
+void PieceChecker::checkMerklePieces(size_t first, size_t last, std::vector<size_t>& validIndices)
+{
+    const std::string padding(SHA256_DIGEST_LENGTH, '\0');
+    std::vector<SHA1Span> spans;
+    for (size_t index = first; index < last; index++)
+    {
+        if (!candidatePieces.get(index) || !pieceSpans(index, spans) || spans.size() != 1)
+            continue;
+        if (isHole(index))
+        {
+            holePieces++;
+            continue;
+        }
+        const char* data = (const char*) spans[0].data;
+        long length = (long) spans[0].length;
+        std::vector<std::string> leafHashes;
+        for (long leaf = 0; leaf < length; leaf += MERKLE_LEAF_SIZE)
+            leafHashes.push_back(MerkleTree::hashLeaf(data + leaf, std::min((long) MERKLE_LEAF_SIZE, length - leaf)));
+        if (MerkleTree::root(leafHashes, leafWidth, padding) == pieceHashes[index])
+            validIndices.push_back(index);
+    }
+}
+
+/**
+ * Outputs the number of pieces checked so far and the checking speed in stdout.
+ */
+void PieceChecker::displayProgress(double elapsedSeconds)
+{
+    size_t checked = std::min(checkedPieces.load(), pieceHashes.size());
+    double checkedBytes = std::min((double) checked * (double) pieceLength, (double) totalSize);
+    std::stringstream info;
+    info << "[Checking: " << checked << " / " << pieceHashes.size() << " pieces, ";
+    info << std::fixed << std::setprecision(2) << checkedBytes / elapsedSeconds / 1e6 << " MB/s]";
+    std::cout << "\r" << info.str() << std::flush;
+}
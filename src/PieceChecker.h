@@ -0,0 +1,80 @@
+#ifndef BITTORRENTCLIENT_PIECECHECKER_H
+#define BITTORRENTCLIENT_PIECECHECKER_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#include <crypto/sha1_multi_buffer.h>
+
+#include "Bitfield.h"
+#include "TorrentFile.h"
+
+/**
+ * Verifies the pieces of files which are already on disk against the
+ * SHA1 hashes or the Merkle tree from the Torrent meta-info, e.g. to
+ * resume a download.
+ * The files are mapped into memory and the pieces are hashed in parallel
+ * by several threads, each taking a few consecutive pieces at a time.
+ * Pieces may span several files, as the files are treated as a single
+ * stream of data in the order of the file list.
+ * The data extents of sparse files are found with SEEK_DATA and SEEK_HOLE,
+ * and the pieces which lie entirely in holes (i.e. which have never been
+ * written) are considered invalid without being read.
+ */
+class PieceChecker
+{
+private:
+    struct CheckedFile
+    {
+        std::string path;
+        long offset;
+        long length;
+        bool isPadding;
+        const unsigned char* data;
+        // Length of the part of the file which exists on disk
+        long mappedLength;
+        // Start and end of the parts of the file which hold data, the
+        // rest being holes
+        std::vector<std::pair<long, long>> dataExtents;
+    };
+
+    std::vector<CheckedFile> files;
+    long totalSize = 0;
+    const long pieceLength;
+    const std::vector<std::string> pieceHashes;
+    const int threadCount;
+    // Number of leaves in the subtree of each piece, 0 for SHA1 hashes
+    const size_t leafWidth;
+
+    // Zeros, hashed in place of the padding files
+    std::string zeros;
+    std::atomic<size_t> nextPiece { 0 };
+    std::atomic<size_t> checkedPieces { 0 };
+    std::atomic<size_t> holePieces { 0 };
+    // The pieces to check, the others being considered invalid
+    Bitfield candidatePieces;
+    Bitfield validPieces;
+    std::mutex lock;
+    std::condition_variable checkingDone;
+
+    void mapFiles();
+    void unmapFiles();
+    static void findDataExtents(CheckedFile& file, int fd);
+    bool isHole(size_t index) const;
+    bool pieceSpans(size_t index, std::vector<SHA1Span>& spans) const;
+    void checkPieces();
+    void checkMerklePieces(size_t first, size_t last, std::vector<size_t>& validIndices);
+    void displayProgress(double elapsedSeconds);
+
+public:
+    explicit PieceChecker(const std::string& downloadDirectory, const std::vector<TorrentFile>& torrentFiles,
+                          long pieceLength, std::vector<std::string> pieceHashes, int threadCount,
+                          size_t leafWidth = 0);
+    Bitfield check();
+    Bitfield check(const Bitfield& candidates);
+};
+
+#endif //BITTORRENTCLIENT_PIECECHECKER_H
@@ -6,12 +6,19 @@
 #include <ctime>
 #include <iostream>
 #include <algorithm>
+#include <climits>
 #include <loguru/loguru.hpp>
 #include <bencode/bencoding.h>
 #include <iomanip>
 #include <unistd.h>
+#include <sys/resource.h>
+#include <cstring>
+#include <crypto/sha1_multi_buffer.h>
+#include <crypto/sha256_engine.h>
 
 #include "PieceManager.h"
+#include "PieceChecker.h"
+#include "MerkleTree.h"
 #include "Block.h"
 #include "utils.h"
 
@@ -19,58 +26,119 @@
 #define MAX_PENDING_TIME 5          // 5 sec
 #define PROGRESS_BAR_WIDTH 40
 #define PROGRESS_DISPLAY_INTERVAL 1 // 0.5 sec
+#define STREAMING_WINDOW 8          // number of pieces after the read cursor which have deadlines
+#define STREAMING_DEADLINE 2        // 2 sec per piece of distance from the read cursor
+#define BYTES_PER_MB 1048576
+#define MAX_HASHER_THREADS 4
+#define MAX_HASH_REQUEST_LENGTH 512 // maximum number of hashes in a Hash Request message
+#define MAX_CORRUPT_BLOCKS 1        // number of corrupt Blocks after which a peer is banned
 
 PieceManager::PieceManager(
     const TorrentFileParser& fileParser,
-    const std::string& downloadPath,
-    const int maximumConnections
-): fileParser(fileParser), maximumConnections(maximumConnections), pieceLength(fileParser.getPieceLength())
+    const std::string& downloadDirectory,
+    const int maximumConnections,
+    DownloadOptions options
+): options(options), storage(downloadDirectory, fileParser.getFiles(), options.memoryMapped, options.preallocation,
+           options.directIo),
+   resumeData(downloadDirectory, fileParser.getFileName(), fileParser.getInfoHash()),
+   pieceLength(fileParser.getPieceLength()), fileSize(fileParser.getFileSize()), fileParser(fileParser),
+   maximumConnections(maximumConnections),
+   readCache(options.readCacheBytes),
+   budget(options.memoryBudgetBytes),
+   writer(storage, budget, options.writeCoalesceBytes,
+          [this](Piece* piece, bool isWritten) { pieceWritten(piece, isWritten); }),
+   verifier(
+       (int) std::max(1u, std::min(std::thread::hardware_concurrency(), (unsigned) MAX_HASHER_THREADS)),
+       options.writeThrough,
+       [this](Piece* piece, bool isHashMatching, unsigned generation)
+       {
+           pieceVerified(piece, isHashMatching, generation);
+       },
+       [this](Piece* piece) { blocksRejected(piece); }
+   )
 {
-    missingPieces = initiatePieces();
-    // Creates the destination file with the file size specified in the Torrent file
-    downloadedFile.open(downloadPath, std::ios::binary | std::ios::out);
-    downloadedFile.seekp(fileParser.getFileSize() - 1);
-    downloadedFile.write("", 1);
+    pieces = initiatePieces();
+    missingPieces = Bitfield(totalPieces, true);
+    havePieces = Bitfield(totalPieces);
+    pieceAvailability.assign(totalPieces, 0);
+    if (useMerkleTree)
+        LOG_F(INFO, "Verifying blocks with the v2 Merkle tree, using the %s SHA-256 implementation",
+              SHA256Engine::backendName());
+    else
+        LOG_F(INFO, "Using the %s SHA-1 implementation (batches: %s)",
+              SHA1Engine::backendName(), SHA1MultiBuffer::backendName());
 
-    // Starts a thread to track progress of the download
     startingTime = std::time(nullptr);
-    std::thread progressThread([this] { this->trackProgress(); });
-    progressThread.detach();
+    downloadStart = std::chrono::steady_clock::now();
+    std::map<int, Bitfield> partialPieces;
+    if (storage.getExistingSize() > 0)
+    {
+        Bitfield resumedPieces(totalPieces);
+        Bitfield uncheckedPieces(totalPieces);
+        if (resumeData.load(storage.getInitialFileStates(), resumedPieces, uncheckedPieces, partialPieces))
+        {
+            markDownloaded(resumedPieces);
+            std::cout << resumedPieces.count() << " / " << totalPieces
+                      << " pieces already downloaded (from the resume data)" << std::endl;
+            if (uncheckedPieces.any())
+                recheck(downloadDirectory, uncheckedPieces);
+            resumePartialPieces(partialPieces);
+        }
+        else
+            recheck(downloadDirectory, Bitfield(totalPieces, true));
+    }
+    // The files may have been resized or allocated, and the journal starts over
+    resumeData.save(havePieces, partialPieces, storage.getFileStates());
+
+    // Starts a thread to track progress of the download
+    progressThread = std::thread([this] { this->trackProgress(); });
 }
 
 /**
  * Destructor of the PieceManager class. Frees all resources allocated.
  */
 PieceManager::~PieceManager() {
-    for (Piece* piece: missingPieces)
-        delete piece;
+    stopped = true;
+    if (progressThread.joinable())
+        progressThread.join();
+    // The hasher threads and the writer thread must not outlive the Pieces
+    verifier.stop();
+    writer.stop();
 
-    for (Piece *piece : ongoingPieces)
+    for (Piece* piece : pieces)
         delete piece;
 
     for (PendingRequest* pending : pendingRequests)
         delete pending;
-
-    downloadedFile.close();
 }
 
 
 /**
  * Pre-constructs the list of pieces and blocks based on
  * the number of pieces and the size of the block.
+ * The pieces of v2 and hybrid Torrents are checked against the
+ * Merkle tree of the file rather than with their SHA1 hash.
  * @return a vector containing all the pieces in the file.
  */
 std::vector<Piece*> PieceManager::initiatePieces()
 {
-    std::vector<std::string> pieceHashes = fileParser.splitPieceHashes();
+    long totalLength = fileParser.getFileSize();
+    std::vector<std::string> pieceHashes;
+    useMerkleTree = fileParser.hasMerkleTree();
+    if (useMerkleTree)
+    {
+        piecesRoot = fileParser.getPiecesRoot();
+        pieceHashes = fileParser.getPieceLayer();
+        leavesPerPiece = MerkleTree::leavesPerPiece(pieceLength, totalLength);
+    }
+    else
+        pieceHashes = fileParser.splitPieceHashes();
     totalPieces = pieceHashes.size();
     std::vector<Piece*> torrentPieces;
-    missingPieces.reserve(totalPieces);
-
-    long totalLength = fileParser.getFileSize();
+    torrentPieces.reserve(totalPieces);
 
     // number of blocks in a normal piece (i.e. pieces that are not the last one)
-    int blockCount = ceil(pieceLength / BLOCK_SIZE);
+    int blockCount = (int) ((pieceLength + BLOCK_SIZE - 1) / BLOCK_SIZE);
     long remLength = pieceLength;
 
     for (int i = 0; i < totalPieces; i++)
@@ -78,8 +146,8 @@ std::vector<Piece*> PieceManager::initiatePieces()
         // The final piece is likely to have a smaller size.
         if (i == totalPieces - 1)
         {
-            remLength = totalLength % pieceLength;
-            blockCount = std::max((int) ceil(remLength / BLOCK_SIZE), 1);
+            remLength = totalLength - pieceLength * (totalPieces - 1);
+            blockCount = (int) ((remLength + BLOCK_SIZE - 1) / BLOCK_SIZE);
         }
         std::vector<Block*> blocks;
         blocks.reserve(blockCount);
@@ -90,37 +158,207 @@ std::vector<Piece*> PieceManager::initiatePieces()
             block->piece = i;
             block->status = missing;
             block->offset = offset * BLOCK_SIZE;
-            int blockSize = BLOCK_SIZE;
-            if (i == totalPieces - 1 && offset == blockCount - 1)
-                blockSize = remLength % BLOCK_SIZE;
-            block->length = blockSize;
+            block->length = (int) std::min((long) BLOCK_SIZE, remLength - block->offset);
             blocks.push_back(block);
         }
-        auto piece = new Piece(i, blocks, pieceHashes[i]);
+        auto piece = new Piece(i, blocks, pieceHashes[i], leavesPerPiece);
         torrentPieces.emplace_back(piece);
     }
     return torrentPieces;
 }
 
+/**
+ * Verifies the data which was already in the files before the download
+ * started, and marks the valid pieces as downloaded.
+ * @param candidates: the pieces to verify, e.g. all of them.
+ */
+void PieceManager::recheck(const std::string& downloadDirectory, const Bitfield& candidates)
+{
+    std::cout << "Checking existing data in " << downloadDirectory + fileParser.getFileName() << "..." << std::endl;
+    std::vector<std::string> pieceHashes;
+    for (Piece* piece : pieces)
+        pieceHashes.push_back(piece->getHashValue());
+    PieceChecker checker(downloadDirectory, fileParser.getFiles(), pieceLength, pieceHashes,
+                         (int) std::thread::hardware_concurrency(), leavesPerPiece);
+    Bitfield validPieces = checker.check(candidates);
+    markDownloaded(validPieces);
+    std::cout << validPieces.count() << " / " << candidates.count() << " checked pieces already downloaded"
+              << std::endl;
+}
+
+/**
+ * Marks the given pieces, which are already on disk, as downloaded.
+ */
+void PieceManager::markDownloaded(const Bitfield& downloadedPieces)
+{
+    for (size_t index = downloadedPieces.findNext(0); index != Bitfield::npos;
+         index = downloadedPieces.findNext(index + 1))
+    {
+        havePieces.set(index);
+        missingPieces.clear(index);
+    }
+    advanceReadCursor();
+}
+
+/**
+ * Restores the pieces which were being downloaded when the download was
+ * stopped: their Blocks are read back from disk and marked as retrieved,
+ * so that only the missing Blocks are requested. The pieces are verified
+ * once complete, like any other piece.
+ * @param partialPieces: the Blocks on disk of each piece, by piece index.
+ */
+void PieceManager::resumePartialPieces(const std::map<int, Bitfield>& partialPieces)
+{
+    size_t resumedBlocks = 0;
+    size_t resumedPieces = 0;
+    for (const auto& entry : partialPieces)
+    {
+        Piece* piece = pieces[entry.first];
+        const Bitfield& retrievedBlocks = entry.second;
+        if (havePieces.get(piece->index) || retrievedBlocks.size() != piece->blocks.size() || retrievedBlocks.none())
+            continue;
+        startPiece(piece);
+        for (size_t i = retrievedBlocks.findNext(); i != Bitfield::npos; i = retrievedBlocks.findNext(i + 1))
+        {
+            Block* block = piece->blocks[i];
+            std::string data(block->length, '\0');
+            storage.read((long) piece->index * pieceLength + block->offset, &data[0], data.size());
+            piece->blockReceived(block->offset, std::move(data), std::string());
+            budget.move(requestedData, receivedData, block->length);
+            resumedBlocks++;
+        }
+        if (piece->isComplete())
+        {
+            ongoingPieces.erase(std::remove(ongoingPieces.begin(), ongoingPieces.end(), piece), ongoingPieces.end());
+            budget.move(receivedData, hashingData, getPieceSize(piece->index));
+        }
+        if (piece->advanceContiguousBlocks())
+            verifier.submit(piece, piece->getContiguousBlocks(), piece->getGeneration());
+        resumedPieces++;
+    }
+    if (resumedPieces > 0)
+        std::cout << resumedBlocks << " blocks of " << resumedPieces
+                  << " partially downloaded pieces resumed" << std::endl;
+}
+
+/**
+ * Writes the retrieved Blocks of the pieces which have not been completed
+ * at their offsets, so that they are not downloaded again when the
+ * download resumes. Must be called once the download has stopped and the
+ * writer is idle.
+ * @return the Blocks on disk of each such piece, by piece index.
+ */
+std::map<int, Bitfield> PieceManager::savePartialPieces()
+{
+    std::map<int, Bitfield> partialPieces;
+    lock.lock();
+    for (Piece* piece : pieces)
+    {
+        if (havePieces.get(piece->index))
+            continue;
+        Bitfield retrievedBlocks(piece->blocks.size());
+        try
+        {
+            for (size_t i = 0; i < piece->blocks.size(); i++)
+            {
+                Block* block = piece->blocks[i];
+                if (block->status != retrieved)
+                    continue;
+                // In write-through mode, the Blocks have been written as they arrived
+                if (!options.writeThrough)
+                    storage.write((long) piece->index * pieceLength + block->offset, block->data.data(),
+                                  block->data.size());
+                retrievedBlocks.set(i);
+            }
+        }
+        catch (const std::runtime_error& e)
+        {
+            LOG_F(ERROR, "Failed to save the blocks of piece %d [%s]", piece->index, e.what());
+            continue;
+        }
+        if (retrievedBlocks.any())
+            partialPieces[piece->index] = std::move(retrievedBlocks);
+    }
+    lock.unlock();
+    return partialPieces;
+}
+
+/**
+ * Compacts the journal of the resume data into a new snapshot, once the
+ * data of the downloaded pieces is on disk. Must not be called while data
+ * is being written, i.e. either from the writer thread or once it is idle.
+ * @param partialPieces: the Blocks on disk of the pieces which have not
+ * been completed, by piece index.
+ * @param isStopped: whether the download has stopped.
+ */
+void PieceManager::saveResumeData(const std::map<int, Bitfield>& partialPieces, bool isStopped)
+{
+    storage.flush();
+    lock.lock();
+    Bitfield downloadedPieces = havePieces;
+    lock.unlock();
+    resumeData.save(downloadedPieces, partialPieces, storage.getFileStates(), isStopped);
+}
+
 /**
  * Checks if all Pieces have been downloaded.
  * @return true if all Pieces are present false otherwise.
  */
 bool PieceManager::isComplete() {
     lock.lock();
-    bool isComplete = havePieces.size() == totalPieces;
+    bool isComplete = havePieces.count() == (size_t) totalPieces;
     lock.unlock();
     return isComplete;
 }
 
+/**
+ * Releases the threads which are waiting to request more data because the
+ * memory budget is used up, once the download is stopping.
+ */
+void PieceManager::stopRequests()
+{
+    budget.stop();
+}
+
+/**
+ * Once the download has stopped, waits until all the downloaded data has
+ * been written to disk and saves the resume data, including the Blocks of
+ * the pieces which have not been completed. Logs the fragmentation of the
+ * file and how much of it is in the page cache.
+ */
+void PieceManager::flush()
+{
+    // The Pieces still waiting to be verified are saved as partial pieces
+    verifier.stop();
+    writer.drain();
+    saveResumeData(savePartialPieces(), true);
+    long extents = storage.countExtents();
+    if (extents >= 0)
+        LOG_F(INFO, "The downloaded file occupies %ld extents", extents);
+    long cachedSize = storage.getCachedSize();
+    if (cachedSize >= 0)
+        LOG_F(INFO, "%.2f MB of the downloaded file are in the page cache", (double) cachedSize / BYTES_PER_MB);
+}
+
 /**
  * Adds a peer and the BitField representing the pieces the peer has.
- * Store the given information in the instance variable peers.
+ * Store the given information in the instance variable peers, and
+ * updates the availability of each of the pieces the peer has.
  */
-void PieceManager::addPeer(const std::string& peerId, std::string bitField)
+void PieceManager::addPeer(const std::string& peerId, const std::string& bitField)
 {
+    Bitfield peerPieces = Bitfield::fromBytes(bitField, totalPieces);
     lock.lock();
-    peers[peerId] = bitField;
+    auto iter = peers.find(peerId);
+    if (iter != peers.end())
+    {
+        const Bitfield& previous = iter->second;
+        for (size_t i = previous.findNext(); i != Bitfield::npos; i = previous.findNext(i + 1))
+            pieceAvailability[i]--;
+    }
+    for (size_t i = peerPieces.findNext(); i != Bitfield::npos; i = peerPieces.findNext(i + 1))
+        pieceAvailability[i]++;
+    peers[peerId] = std::move(peerPieces);
     lock.unlock();
     std::stringstream info;
     info << "Number of connections: " <<
@@ -136,9 +374,15 @@ void PieceManager::addPeer(const std::string& peerId, std::string bitField)
 void PieceManager::updatePeer(const std::string& peerId, int index)
 {
     lock.lock();
-    if (peers.find(peerId) != peers.end())
+    auto iter = peers.find(peerId);
+    if (iter != peers.end())
     {
-        setPiece(peers[peerId], index);
+        Bitfield& peerPieces = iter->second;
+        if (!peerPieces.get(index))
+        {
+            peerPieces.set(index);
+            pieceAvailability[index]++;
+        }
         lock.unlock();
     }
     else
@@ -148,6 +392,65 @@ void PieceManager::updatePeer(const std::string& peerId, int index)
     }
 }
 
+/**
+ * Checks if the given peer has any piece that we have not downloaded
+ * and verified yet (i.e. whether we should be interested in the peer).
+ */
+bool PieceManager::isInteresting(const std::string& peerId)
+{
+    lock.lock();
+    bool isInteresting = false;
+    auto iter = peers.find(peerId);
+    if (iter != peers.end())
+        isInteresting = iter->second.findNextAndNot(havePieces) != Bitfield::npos;
+    lock.unlock();
+    return isInteresting;
+}
+
+/**
+ * Returns the BitField of the pieces we have verified, in the format of
+ * the payload of a BitField message.
+ * @param completedCursor: set to the position in the list of completed
+ * pieces up to which the returned BitField is up-to-date.
+ */
+std::string PieceManager::getBitField(size_t& completedCursor)
+{
+    lock.lock();
+    std::string bitField = havePieces.toBytes();
+    completedCursor = completedPieces.size();
+    lock.unlock();
+    return bitField;
+}
+
+/**
+ * Returns the pieces completed since the given cursor which should be
+ * announced to the peer with Have messages, and advances the cursor.
+ * Pieces which the peer already has are left out (i.e. lazy Have), which
+ * saves most of the Have messages that would otherwise be sent to seeds.
+ * @param peerId: the peer to which the Have messages will be sent.
+ * @param completedCursor: position in the list of completed pieces up to
+ * which the peer has been informed.
+ */
+std::vector<int> PieceManager::piecesToAnnounce(const std::string& peerId, size_t& completedCursor)
+{
+    std::vector<int> announcements;
+    lock.lock();
+    auto iter = peers.find(peerId);
+    for (; completedCursor < completedPieces.size(); completedCursor++)
+    {
+        int index = completedPieces[completedCursor];
+        if (iter != peers.end() && iter->second.get(index))
+        {
+            haveMessagesSuppressed++;
+            continue;
+        }
+        announcements.push_back(index);
+    }
+    haveMessagesSent += announcements.size();
+    lock.unlock();
+    return announcements;
+}
+
 /**
  * Removes a previously added peer in case of a lost connection.
  * @param peerId: Id of the peer to be removed.
@@ -160,6 +463,9 @@ void PieceManager::removePeer(const std::string& peerId)
     auto iter = peers.find(peerId);
     if (iter != peers.end())
     {
+        const Bitfield& peerPieces = iter->second;
+        for (size_t i = peerPieces.findNext(); i != Bitfield::npos; i = peerPieces.findNext(i + 1))
+            pieceAvailability[i]--;
         peers.erase(iter);
         lock.unlock();
         std::stringstream info;
@@ -184,40 +490,59 @@ void PieceManager::removePeer(const std::string& peerId)
  */
 Block* PieceManager::nextRequest(std::string peerId)
 {
-    // The algorithm implemented for which piece to retrieve is a simple
-    // one. This should preferably be replaced with an implementation of
-    // "rarest-piece-first" algorithm instead.
-    // The algorithm tries to download the pieces in sequence and will try
-    // to finish started pieces before starting with new pieces.
+    // The algorithm will try to finish started pieces before starting
+    // with new pieces, which are picked with the "rarest-piece-first"
+    // algorithm.
     //
     // 1. Check any pending blocks to see if any request should be reissued
     // due to timeout
-    // 2. Check the ongoing pieces to get the next block to request
-    // 3. Check if this peer have any of the missing pieces not yet started
+    // 2. In sequential mode, let the fastest peers work on the pieces which
+    // are close to the read cursor
+    // 3. Check the ongoing pieces to get the next block to request
+    // 4. Check if this peer have any of the missing pieces not yet started
+    // 5. In sequential mode, let the slower peers work on the pieces close
+    // to the read cursor if there is nothing else they can help with
+    //
+    // While the memory budget is used up (e.g. because the disk is behind),
+    // no new piece is started: the request waits until there is room again,
+    // unless it helps complete a piece which has already been started.
 
-    lock.lock();
-    if (missingPieces.empty())
+    while (true)
     {
-        lock.unlock();
-        return nullptr;
-    }
+        bool canStartPiece = !budget.isThrottled();
+        lock.lock();
+        if (missingPieces.none() && ongoingPieces.empty())
+        {
+            lock.unlock();
+            return nullptr;
+        }
 
-    if (peers.find(peerId) == peers.end())
-    {
-        lock.unlock();
-        return nullptr;
-    }
+        if (peers.find(peerId) == peers.end() || bannedPeers.count(peerId))
+        {
+            lock.unlock();
+            return nullptr;
+        }
 
-    Block* block = expiredRequest(peerId);
-    if (!block)
-    {
-        block = nextOngoing(peerId);
+        Block* block = expiredRequest(peerId);
+        bool isFast = options.sequential && isFastPeer(peerId);
+        if (!block && isFast)
+            block = nextUrgent(peerId, canStartPiece);
         if (!block)
-            block = getRarestPiece(peerId)->nextRequest();
-    }
-    lock.unlock();
+        {
+            block = nextOngoing(peerId);
+            // The newly started Piece is the only ongoing one with missing Blocks
+            if (!block && canStartPiece && getRarestPiece(peerId))
+                block = nextOngoing(peerId);
+        }
+        if (!block && options.sequential && !isFast)
+            block = nextUrgent(peerId, canStartPiece);
+        bool isHeldBack = !block && !canStartPiece && peers[peerId].findNextAnd(missingPieces) != Bitfield::npos;
+        lock.unlock();
 
-    return block;
+        if (!isHeldBack)
+            return block;
+        budget.waitForRoom();
+    }
 }
 
 /**
@@ -228,9 +553,10 @@ Block* PieceManager::nextRequest(std::string peerId)
 Block* PieceManager::expiredRequest(std::string peerId)
 {
     time_t currentTime = std::time(nullptr);
+    const Bitfield& peerPieces = peers[peerId];
     for (PendingRequest* pending : pendingRequests)
     {
-        if (hasPiece(peers[peerId], pending->block->piece))
+        if (peerPieces.get(pending->block->piece))
         {
             // If the request has expired
             auto diff = std::difftime(currentTime, pending->timestamp);
@@ -238,6 +564,7 @@ Block* PieceManager::expiredRequest(std::string peerId)
             {
                 // Resets the timer for that request
                 pending->timestamp = currentTime;
+                pending->peerId = peerId;
                 LOG_F(INFO, "Block %d from piece %d has expired", pending->block->offset, pending->block->piece);
                 return pending->block;
             }
@@ -249,82 +576,207 @@ Block* PieceManager::expiredRequest(std::string peerId)
 /**
  * Iterates through the pieces that are currently being downloaded, and returns
  * the next Block to be requested or NULL if no Block is left to be requested
- * from the list of Pieces.
+ * from the list of Pieces. In sequential mode, the pieces close to the read
+ * cursor are left to nextUrgent().
  */
 Block* PieceManager::nextOngoing(std::string peerId)
 {
+    const Bitfield& peerPieces = peers[peerId];
     for (Piece* piece : ongoingPieces)
     {
-        if (hasPiece(peers[peerId], piece->index))
+        if (peerPieces.get(piece->index) && !isUrgent(piece->index))
         {
             Block* block = piece->nextRequest();
             if (block)
-            {
-                auto currentTime = std::time(nullptr);
-                auto newPendingRequest = new PendingRequest;
-                newPendingRequest->block = block;
-                newPendingRequest->timestamp = std::time(nullptr);
-                pendingRequests.push_back(newPendingRequest);
-                return block;
-            }
+                return addPendingRequest(block, peerId);
         }
     }
     return nullptr;
 }
 
 /**
- * Given the list of missing pieces, finds the rarest one (i.e. a piece
- * which is owned by the fewest number of peers).
+ * Records that the given Block has been requested from the given peer.
+ * @return the given Block.
  */
-Piece* PieceManager::getRarestPiece(std::string peerId)
+Block* PieceManager::addPendingRequest(Block* block, const std::string& peerId)
+{
+    auto newPendingRequest = new PendingRequest;
+    newPendingRequest->block = block;
+    newPendingRequest->timestamp = std::time(nullptr);
+    newPendingRequest->peerId = peerId;
+    newPendingRequest->duplicated = false;
+    pendingRequests.push_back(newPendingRequest);
+    return block;
+}
+
+/**
+ * Checks if the given piece lies within the window after the read cursor
+ * in which pieces are downloaded in order. Always false if the download
+ * is not sequential.
+ */
+bool PieceManager::isUrgent(int pieceIndex) const
 {
-    // Custom comparator to make sure that the map is ordered by the index of the Piece.
-    auto comp = [](const Piece* a, const Piece* b) { return a->index < b->index; };
-    std::map<Piece*, int, decltype(comp)> pieceCount(comp);
-    for (Piece* piece : missingPieces)
+    return options.sequential && pieceIndex >= readCursor && pieceIndex < readCursor + STREAMING_WINDOW;
+}
+
+/**
+ * Finds the next Block to request among the pieces close to the read cursor,
+ * each of which has a deadline that depends on its distance from the cursor.
+ * 1. A Block of a piece that is past its deadline is requested a second time
+ * from this peer, if it has been pending at another peer.
+ * 2. Otherwise, the next Block of the first started urgent piece is returned.
+ * 3. Otherwise, the first urgent piece which has not been started is started,
+ * if 'canStartPiece' is true.
+ * @return the Block to request, or NULL if the peer cannot help with any of
+ * the urgent pieces.
+ */
+Block* PieceManager::nextUrgent(const std::string& peerId, bool canStartPiece)
+{
+    const Bitfield& peerPieces = peers[peerId];
+    time_t currentTime = std::time(nullptr);
+
+    for (PendingRequest* pending : pendingRequests)
     {
-        // If a connection has been established with the peer
-        if (peers.find(peerId) != peers.end())
+        int index = pending->block->piece;
+        auto deadline = pieceDeadlines.find(index);
+        if (deadline == pieceDeadlines.end() || currentTime <= deadline->second)
+            continue;
+        if (!pending->duplicated && pending->peerId != peerId && peerPieces.get(index))
         {
-            if (hasPiece(peers[peerId], piece->index))
-                pieceCount[piece] += 1;
+            pending->duplicated = true;
+            LOG_F(INFO, "Piece %d is late, requesting block %d again", index, pending->block->offset);
+            return pending->block;
         }
     }
 
-    Piece* rarest;
-    int leastCount = INT16_MAX;
-    for (auto const& [piece, count] : pieceCount)
+    int windowEnd = std::min(readCursor + STREAMING_WINDOW, totalPieces);
+    for (int index = readCursor; index < windowEnd; index++)
+    {
+        // Skips the pieces which have not been started or have been completed
+        if (missingPieces.get(index) || havePieces.get(index) || !peerPieces.get(index))
+            continue;
+        // Pieces started before entering the window are given a deadline now
+        if (!pieceDeadlines.count(index))
+            pieceDeadlines[index] = currentTime + STREAMING_DEADLINE * (index - readCursor + 1);
+        Block* block = pieces[index]->nextRequest();
+        if (block)
+            return addPendingRequest(block, peerId);
+    }
+
+    size_t index = peerPieces.findNextAnd(missingPieces, readCursor);
+    if (!canStartPiece || index == Bitfield::npos || !isUrgent((int) index))
+        return nullptr;
+    Piece* piece = pieces[index];
+    startPiece(piece);
+    pieceDeadlines[piece->index] = currentTime + STREAMING_DEADLINE * (piece->index - readCursor + 1);
+    return addPendingRequest(piece->nextRequest(), peerId);
+}
+
+/**
+ * Checks if the given peer is among the faster half of the connected
+ * peers, as per their download rates in the last interval.
+ */
+bool PieceManager::isFastPeer(const std::string& peerId)
+{
+    std::vector<double> rates;
+    for (auto const& [id, rate] : peerDownloadRates)
+        if (peers.count(id))
+            rates.push_back(rate);
+    if (rates.empty())
+        return true;
+    std::sort(rates.begin(), rates.end());
+    double median = rates[(rates.size() - 1) / 2];
+    auto iter = peerDownloadRates.find(peerId);
+    double rate = iter == peerDownloadRates.end() ? 0 : iter->second;
+    return rate >= median;
+}
+
+/**
+ * Among the missing pieces that the given peer has, finds the rarest
+ * one (i.e. a piece which is owned by the fewest number of peers),
+ * and moves it to the list of ongoing pieces.
+ * @return the rarest Piece, or NULL if the peer has none of the missing pieces.
+ */
+Piece* PieceManager::getRarestPiece(std::string peerId)
+{
+    const Bitfield& peerPieces = peers[peerId];
+    Piece* rarest = nullptr;
+    int leastCount = INT_MAX;
+    for (size_t i = peerPieces.findNextAnd(missingPieces); i != Bitfield::npos;
+         i = peerPieces.findNextAnd(missingPieces, i + 1))
     {
-        if (count < leastCount)
+        // In sequential mode, the pieces close to the read cursor are picked in order instead
+        if (isUrgent((int) i))
+            continue;
+        if (pieceAvailability[i] < leastCount)
         {
-            leastCount = count;
-            rarest = piece;
+            leastCount = pieceAvailability[i];
+            rarest = pieces[i];
         }
     }
+    if (!rarest)
+        return nullptr;
 
-    missingPieces.erase(
-            std::remove(missingPieces.begin(), missingPieces.end(), rarest),
-            missingPieces.end()
-    );
-    ongoingPieces.push_back(rarest);
+    startPiece(rarest);
     return rarest;
 }
 
+/**
+ * Moves a piece which has not been requested yet to the list of ongoing
+ * pieces, and reserves the memory for its data in the budget.
+ */
+void PieceManager::startPiece(Piece* piece)
+{
+    missingPieces.clear(piece->index);
+    ongoingPieces.push_back(piece);
+    budget.charge(requestedData, getPieceSize(piece->index));
+}
+
 /**
  * This method is called when a block of data has been received successfully.
- * Once an entire Piece has been received, a SHA1 hash is computed on the data
- * of all the retrieved blocks in the Piece. The hash will be compared to
- * that from the Torrent meta-info. If a mismatch is detected, all the blocks
- * in the Piece will be reset to a missing state. If the hash matches, the data
- * in the Piece will be written to disk.
+ * Whenever the Blocks at the start of the Piece are all retrieved, they are
+ * handed to the hasher threads, which hash them incrementally. Blocks received
+ * out of order wait until the gap before them is filled. Once the last Block
+ * has been hashed, the SHA1 hash is compared to that from the Torrent meta-info
+ * (see pieceVerified).
+ * In write-through mode, the Block is also queued to be written to disk right
+ * away, and its data is only kept in memory until it has been hashed.
+ * A Block that arrives after its Piece has been completed (e.g. because it
+ * had been requested from two peers) is ignored.
  */
 void PieceManager::blockReceived(std::string peerId, int pieceIndex, int blockOffset, std::string data)
 {
 
     LOG_F(INFO, "Received block %d for piece %d from peer %s", blockOffset, pieceIndex, peerId.c_str());
+    lock.lock();
+    // Retrieves the Piece to which this Block belongs
+    Piece* targetPiece = nullptr;
+    for (Piece* piece : ongoingPieces)
+    {
+        if (piece->index == pieceIndex)
+        {
+            targetPiece = piece;
+            break;
+        }
+    }
+    // A Block of the wrong size would be written over its neighbours, so
+    // the peer is dropped before the Piece, the budget or the writer see
+    // it. The request is left pending, to expire and be sent again.
+    if (targetPiece)
+    {
+        auto expectedBlock = std::find_if(targetPiece->blocks.begin(), targetPiece->blocks.end(),
+                                          [blockOffset](Block* block) { return block->offset == blockOffset; });
+        if (expectedBlock == targetPiece->blocks.end() || (size_t) (*expectedBlock)->length != data.size())
+        {
+            lock.unlock();
+            throw std::runtime_error("Received Block " + std::to_string(blockOffset) + " of piece " +
+                                     std::to_string(pieceIndex) + " with an invalid offset or length (" +
+                                     std::to_string(data.size()) + " bytes)");
+        }
+    }
+
     // Removes the received block from pending requests
     PendingRequest* requestToRemove = nullptr;
-    lock.lock();
     for (PendingRequest* pending : pendingRequests)
     {
         if (pending->block->piece == pieceIndex && pending->block->offset == blockOffset)
@@ -339,60 +791,443 @@ void PieceManager::blockReceived(std::string peerId, int pieceIndex, int blockOf
             pendingRequests.end()
     );
 
-    // Retrieves the Piece to which this Block belongs
-    Piece* targetPiece = nullptr;
-    for (Piece* piece : ongoingPieces)
+    peerBytesInInterval[peerId] += data.size();
+
+    if (!targetPiece)
     {
-        if (piece->index == pieceIndex)
+        bool isDuplicate = pieceIndex >= 0 && pieceIndex < totalPieces && !missingPieces.get(pieceIndex);
+        lock.unlock();
+        if (isDuplicate)
         {
-            targetPiece = piece;
-            break;
+            LOG_F(INFO, "Ignoring block %d of piece %d which is no longer needed", blockOffset, pieceIndex);
+            return;
         }
+        throw std::runtime_error("Received Block does not belong to any ongoing Piece.");
+    }
+
+    std::string blockData = options.writeThrough ? data : std::string();
+    size_t blockLength = data.size();
+    bool isNewBlock = targetPiece->blockReceived(blockOffset, std::move(data), peerId);
+    if (isNewBlock)
+        budget.move(requestedData, receivedData, blockLength);
+    if (options.writeThrough && isNewBlock)
+    {
+        // Queued while holding the lock, and only the first copy of the Block,
+        // so that a late duplicate cannot overwrite the data of a Piece which
+        // has already been verified
+        writer.write(targetPiece, (long) pieceIndex * pieceLength + blockOffset, std::move(blockData));
+    }
+    bool hasNewBlocks = targetPiece->advanceContiguousBlocks();
+    size_t hashableBlocks = targetPiece->getContiguousBlocks();
+    unsigned generation = targetPiece->getGeneration();
+    bool isComplete = targetPiece->isComplete();
+    // A complete Piece is taken off the ongoing list while it is verified,
+    // so that it is only verified and written once
+    if (isComplete)
+    {
+        ongoingPieces.erase(
+                std::remove(ongoingPieces.begin(), ongoingPieces.end(), targetPiece),
+                ongoingPieces.end()
+        );
+        budget.move(receivedData, hashingData, getPieceSize(pieceIndex));
     }
     lock.unlock();
-    if (!targetPiece)
-        throw std::runtime_error("Received Block does not belong to any ongoing Piece.");
 
-    targetPiece->blockReceived(blockOffset, std::move(data));
-    if (targetPiece->isComplete())
+    // Hashes the Blocks which are now in order; the Piece is verified once
+    // its last Block has been hashed
+    if (hasNewBlocks)
+        verifier.submit(targetPiece, hashableBlocks, generation);
+}
+
+/**
+ * Handles the result of the verification of a completed Piece.
+ * If the hash matches, the peers which sent corrupt Blocks are identified
+ * if the Piece had failed before, and the Piece is queued to be written
+ * to disk (see pieceWritten). Otherwise, all the blocks in the Piece are
+ * reset to a missing state, after the data of each Block and the peer it
+ * came from have been recorded. A failed Piece whose corrupt Blocks have
+ * meanwhile been reset by blocksRejected (i.e. whose generation has
+ * changed) has already been queued again, and is left as it is.
+ * Called from the hasher threads.
+ * @param generation: the generation of the Piece which was verified.
+ */
+void PieceManager::pieceVerified(Piece* piece, bool isHashMatching, unsigned generation)
+{
+    if (isHashMatching)
     {
-        // If the Piece is completed and the hash matches,
-        // writes the Piece to disk
-        if (targetPiece->isHashMatching())
+        identifyCorruptPeers(piece);
+        // The data is now either queued for writing, or already written
+        budget.release(hashingData, getPieceSize(piece->index));
+        if (!options.writeThrough)
+            write(piece);
+        writer.pieceDone(piece);
+    }
+    else
+    {
+        // The Piece is off the ongoing list, so its Blocks cannot change meanwhile
+        std::vector<SuspectBlock> suspects;
+        for (Block* block : piece->blocks)
+            suspects.push_back({ block->offset, block->peerId, blockDigest(piece, block) });
+        lock.lock();
+        if (piece->getGeneration() != generation)
         {
-            write(targetPiece);
-            // Removes the Piece from the ongoing list
-            lock.lock();
-            ongoingPieces.erase(
-                    std::remove(ongoingPieces.begin(), ongoingPieces.end(), targetPiece),
-                    ongoingPieces.end()
-            );
-            havePieces.push_back(targetPiece);
-            piecesDownloadedInInterval++;
             lock.unlock();
-
-            std::stringstream info;
-            info << "(" << std::fixed << std::setprecision(2) << (((float) havePieces.size()) / (float) totalPieces * 100) << "%) ";
-            info << std::to_string(havePieces.size()) + " / " + std::to_string(totalPieces) + " Pieces downloaded...";
-            LOG_F(INFO, "%s", info.str().c_str());
-        }
-        else
-        {
-            targetPiece->reset();
-            LOG_F(INFO, "Hash mismatch for Piece %d", targetPiece->index);
+            LOG_F(INFO, "Hash mismatch for Piece %d, whose corrupt blocks are already requested again",
+                  piece->index);
+            return;
         }
+        std::vector<SuspectBlock>& pieceSuspects = suspectBlocks[piece->index];
+        pieceSuspects.insert(pieceSuspects.end(), suspects.begin(), suspects.end());
+        for (Block* block : piece->blocks)
+            wastedBytes += block->length;
+        corruptPieces++;
+        piece->reset();
+        ongoingPieces.push_back(piece);
+        budget.move(hashingData, requestedData, getPieceSize(piece->index));
+        lock.unlock();
+        LOG_F(INFO, "Hash mismatch for Piece %d", piece->index);
     }
-    // lock.unlock();
 }
 
 /**
- * Writes the given Piece to disk.
+ * Handles a verified Piece once all its data has been written to disk:
+ * only then is the Piece marked as downloaded and announced to the peers.
+ * If a write failed, the Piece is downloaded again.
+ * Called from the writer thread.
+ */
+void PieceManager::pieceWritten(Piece* piece, bool isWritten)
+{
+    lock.lock();
+    if (!isWritten)
+    {
+        readCache.erase(piece->index);
+        piece->reset();
+        ongoingPieces.push_back(piece);
+        budget.charge(requestedData, getPieceSize(piece->index));
+        lock.unlock();
+        LOG_F(ERROR, "Failed to write Piece %d, downloading it again", piece->index);
+        return;
+    }
+    havePieces.set(piece->index);
+    completedPieces.push_back(piece->index);
+    pieceDeadlines.erase(piece->index);
+    advanceReadCursor();
+    piecesDownloadedInInterval++;
+    size_t downloadedPieces = havePieces.count();
+    lock.unlock();
+    // The data of the pieces is synchronised to disk before they are
+    // journaled, a batch of pieces at a time
+    if (resumeData.pieceCompleted(piece->index))
+    {
+        storage.flush();
+        if (resumeData.journalPieces())
+            saveResumeData();
+    }
+
+    std::stringstream info;
+    info << "(" << std::fixed << std::setprecision(2) << (((float) downloadedPieces) / (float) totalPieces * 100) << "%) ";
+    info << std::to_string(downloadedPieces) + " / " + std::to_string(totalPieces) + " Pieces downloaded...";
+    LOG_F(INFO, "%s", info.str().c_str());
+}
+
+/**
+ * Handles the Blocks of a v2 Piece which did not match their leaf hash:
+ * only those Blocks are reset and requested again, the rest of the Piece
+ * is kept. The reset changes the generation of the Piece, so that the
+ * result of a verification of the complete Piece still in progress is
+ * dropped (see pieceVerified), and the Piece is only queued again once.
+ * Called from the hasher threads, and when leaf hashes are received.
+ */
+void PieceManager::blocksRejected(Piece* piece)
+{
+    lock.lock();
+    std::vector<Block*> rejected = piece->resetRejectedBlocks();
+    bool isOngoing = std::find(ongoingPieces.begin(), ongoingPieces.end(), piece) != ongoingPieces.end();
+    if (!rejected.empty() && !isOngoing)
+        budget.move(hashingData, receivedData, getPieceSize(piece->index));
+    for (Block* block : rejected)
+    {
+        budget.move(receivedData, requestedData, block->length);
+        wastedBytes += block->length;
+        corruptBlocks++;
+        LOG_F(INFO, "Block %d of piece %d from peer %s failed Merkle verification",
+              block->offset, block->piece, block->peerId.c_str());
+        recordCorruptBlock(block->peerId);
+    }
+    // The Piece may have been taken off the ongoing list once complete
+    if (!rejected.empty() && !isOngoing)
+        ongoingPieces.push_back(piece);
+    lock.unlock();
+}
+
+/**
+ * Computes the SHA1 hash of the data of a Block of a complete Piece. The
+ * data is read back from disk if it has already been released, once the
+ * disk writer has written the data of that Piece.
+ */
+std::string PieceManager::blockDigest(Piece* piece, Block* block)
+{
+    unsigned char digest[SHA1_DIGEST_LENGTH];
+    if (block->data.size() == (size_t) block->length)
+        SHA1Engine::hash(block->data.data(), block->data.size(), digest);
+    else
+    {
+        writer.waitForPiece(piece);
+        std::string data(block->length, '\0');
+        storage.read((long) piece->index * pieceLength + block->offset, &data[0], data.size());
+        SHA1Engine::hash(data.data(), data.size(), digest);
+    }
+    return std::string((const char*) digest, SHA1_DIGEST_LENGTH);
+}
+
+/**
+ * Compares the Blocks recorded when the given Piece failed verification
+ * with the Blocks of the Piece, which has now been verified: the peers
+ * which sent Blocks that differ are the ones which sent corrupt data.
+ */
+void PieceManager::identifyCorruptPeers(Piece* piece)
+{
+    lock.lock();
+    auto iter = suspectBlocks.find(piece->index);
+    if (iter == suspectBlocks.end())
+    {
+        lock.unlock();
+        return;
+    }
+    std::vector<SuspectBlock> suspects = std::move(iter->second);
+    suspectBlocks.erase(iter);
+    lock.unlock();
+
+    std::map<int, std::string> verifiedDigests;
+    for (Block* block : piece->blocks)
+        verifiedDigests[block->offset] = blockDigest(piece, block);
+
+    lock.lock();
+    for (const SuspectBlock& suspect : suspects)
+    {
+        if (suspect.digest == verifiedDigests[suspect.offset])
+            continue;
+        corruptBlocks++;
+        LOG_F(INFO, "Block %d of piece %d from peer %s was corrupt",
+              suspect.offset, piece->index, suspect.peerId.c_str());
+        recordCorruptBlock(suspect.peerId);
+    }
+    lock.unlock();
+}
+
+/**
+ * Counts a corrupt Block against the peer which sent it, and bans the
+ * peer once it has sent MAX_CORRUPT_BLOCKS of them: no more Blocks are
+ * requested from it, and its connection is closed.
+ * Must be called with the lock held.
+ */
+void PieceManager::recordCorruptBlock(const std::string& peerId)
+{
+    if (++peerCorruptBlocks[peerId] >= MAX_CORRUPT_BLOCKS && bannedPeers.insert(peerId).second)
+        LOG_F(INFO, "Banning peer %s for sending %d corrupt blocks", peerId.c_str(), peerCorruptBlocks[peerId]);
+}
+
+/**
+ * Checks if the given peer has been banned for sending corrupt data.
+ */
+bool PieceManager::isBanned(const std::string& peerId)
+{
+    lock.lock();
+    bool isBanned = bannedPeers.count(peerId) > 0;
+    lock.unlock();
+    return isBanned;
+}
+
+/**
+ * Checks if the pieces are verified with the Merkle tree of the file (v2).
+ */
+bool PieceManager::hasMerkleTree() const
+{
+    return useMerkleTree;
+}
+
+/**
+ * Retrieves the 32-byte root of the Merkle tree of the file.
+ */
+const std::string& PieceManager::getPiecesRoot() const
+{
+    return piecesRoot;
+}
+
+/**
+ * Retrieves the number of leaf hashes covered by the hash of each piece.
+ */
+size_t PieceManager::getLeavesPerPiece() const
+{
+    return leavesPerPiece;
+}
+
+/**
+ * Finds an ongoing piece whose leaf hashes should be requested from the
+ * given peer, i.e. a piece that the peer has and whose leaf hashes are
+ * neither known nor being requested from another peer.
+ * @return the index of the piece, or -1 if no hashes need to be requested.
+ */
+int PieceManager::nextHashRequest(const std::string& peerId)
+{
+    if (!useMerkleTree || leavesPerPiece < 2 || leavesPerPiece > MAX_HASH_REQUEST_LENGTH)
+        return -1;
+    time_t currentTime = std::time(nullptr);
+    int pieceIndex = -1;
+    lock.lock();
+    const Bitfield& peerPieces = peers[peerId];
+    for (Piece* piece : ongoingPieces)
+    {
+        if (!peerPieces.get(piece->index) || piece->hasLeafHashes())
+            continue;
+        auto request = hashRequests.find(piece->index);
+        if (request != hashRequests.end() && std::difftime(currentTime, request->second) < MAX_PENDING_TIME)
+            continue;
+        hashRequests[piece->index] = currentTime;
+        pieceIndex = piece->index;
+        break;
+    }
+    lock.unlock();
+    return pieceIndex;
+}
+
+/**
+ * Handles the leaf hashes of a piece received from a peer in a Hashes
+ * message. The hashes are only used if they match the hash of the piece
+ * from the Torrent meta-info; the Blocks of the piece which have already
+ * been hashed and do not match are then reset.
+ */
+void PieceManager::hashesReceived(const std::string& peerId, int pieceIndex, const std::vector<std::string>& hashes)
+{
+    if (!useMerkleTree || pieceIndex < 0 || pieceIndex >= totalPieces)
+        throw std::runtime_error("Received hashes for an invalid piece " + std::to_string(pieceIndex));
+    Piece* piece = pieces[pieceIndex];
+    lock.lock();
+    hashRequests.erase(pieceIndex);
+    if (havePieces.get(pieceIndex) || !piece->setLeafHashes(hashes))
+    {
+        lock.unlock();
+        LOG_F(INFO, "Ignoring hashes for piece %d from peer %s", pieceIndex, peerId.c_str());
+        return;
+    }
+    lock.unlock();
+    LOG_F(INFO, "Received the leaf hashes of piece %d from peer %s", pieceIndex, peerId.c_str());
+    blocksRejected(piece);
+}
+
+/**
+ * Handles a Hash Reject message: the hashes of the piece can be requested
+ * from another peer straight away.
+ */
+void PieceManager::hashesRejected(int pieceIndex)
+{
+    lock.lock();
+    hashRequests.erase(pieceIndex);
+    lock.unlock();
+}
+
+/**
+ * Moves the read cursor past the pieces that have been downloaded, and
+ * records the time it took for the first 1, 10, 100, ... MB of the file
+ * to become available in order.
+ * Must be called with the lock held.
+ */
+void PieceManager::advanceReadCursor()
+{
+    while (readCursor < totalPieces && havePieces.get(readCursor))
+        readCursor++;
+
+    long availableBytes = std::min((long) readCursor * pieceLength, fileSize);
+    while (nextMilestoneMB * BYTES_PER_MB <= availableBytes)
+    {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - downloadStart;
+        firstBytesTimes.emplace_back(nextMilestoneMB, elapsed.count());
+        LOG_F(INFO, "First %ld MB available after %.2f s", nextMilestoneMB, elapsed.count());
+        nextMilestoneMB *= 10;
+    }
+}
+
+/**
+ * Computes the download rate of each peer in the last interval, which
+ * is used to decide which peers are given the pieces close to the read cursor.
+ * Must be called with the lock held.
+ */
+void PieceManager::updatePeerRates()
+{
+    peerDownloadRates.clear();
+    for (auto const& [peerId, bytes] : peerBytesInInterval)
+        peerDownloadRates[peerId] = (double) bytes / (double) PROGRESS_DISPLAY_INTERVAL;
+    peerBytesInInterval.clear();
+}
+
+/**
+ * Queues the given Piece to be written to disk, and frees its data. The
+ * data is also kept in the read cache, as the peers which are told about
+ * the Piece are likely to request it right away.
  */
 void PieceManager::write(Piece* piece)
 {
-    long position = piece->index * fileParser.getPieceLength();
-    downloadedFile.seekp(position);
-    downloadedFile << piece->getData();
+    std::string data = piece->getData();
+    if (readCache.getCapacity() > 0)
+        readCache.insert(piece->index, data);
+    writer.write(piece, (long) piece->index * pieceLength, std::move(data));
+    piece->releaseData();
+}
+
+/**
+ * Retrieves the size of the Piece at the given index: the piece length,
+ * except for the last Piece which may be shorter.
+ */
+long PieceManager::getPieceSize(int index) const
+{
+    return std::min(pieceLength, fileSize - (long) index * pieceLength);
+}
+
+/**
+ * Reads a Block requested by a peer. The whole Piece is read from disk on
+ * the first request for one of its Blocks and kept in the read cache, so
+ * that the requests for the following Blocks are served from memory, and
+ * the next Piece is read ahead as peers tend to request the Pieces in order.
+ * @param data: set to the data of the Block.
+ * @return false if the Piece has not been downloaded or the Block is not
+ * part of it.
+ */
+bool PieceManager::readBlock(int pieceIndex, int blockOffset, int length, std::string& data)
+{
+    if (pieceIndex < 0 || pieceIndex >= totalPieces)
+        return false;
+    long pieceSize = getPieceSize(pieceIndex);
+    if (blockOffset < 0 || length <= 0 || blockOffset + (long) length > pieceSize)
+        return false;
+    lock.lock();
+    bool isAvailable = havePieces.get(pieceIndex);
+    bool isNextAvailable = pieceIndex + 1 < totalPieces && havePieces.get(pieceIndex + 1);
+    lock.unlock();
+    if (!isAvailable)
+        return false;
+
+    long pieceOffset = (long) pieceIndex * pieceLength;
+    if (readCache.getCapacity() == 0)
+    {
+        data.assign(length, '\0');
+        storage.read(pieceOffset + blockOffset, &data[0], length);
+        readCache.recordDiskRead(length);
+        readCache.recordUpload(length);
+        return true;
+    }
+    std::shared_ptr<const std::string> pieceData = readCache.get(pieceIndex);
+    if (!pieceData)
+    {
+        std::string buffer(pieceSize, '\0');
+        storage.read(pieceOffset, &buffer[0], buffer.size());
+        readCache.recordDiskRead(buffer.size());
+        pieceData = readCache.insert(pieceIndex, std::move(buffer));
+        if (isNextAvailable)
+            storage.readAhead(pieceOffset + pieceLength, getPieceSize(pieceIndex + 1));
+    }
+    data.assign(*pieceData, blockOffset, length);
+    readCache.recordUpload(length);
+    return true;
 }
 
 /**
@@ -401,11 +1236,22 @@ void PieceManager::write(Piece* piece)
 unsigned long PieceManager::bytesDownloaded()
 {
     lock.lock();
-    unsigned long bytesDownloaded = havePieces.size() * pieceLength;
+    unsigned long bytesDownloaded = havePieces.count() * pieceLength;
     lock.unlock();
     return bytesDownloaded;
 }
 
+/**
+ * Returns the number of bytes downloaded and then discarded as corrupt.
+ */
+unsigned long PieceManager::getWastedBytes()
+{
+    lock.lock();
+    unsigned long bytes = wastedBytes;
+    lock.unlock();
+    return bytes;
+}
+
 /**
  * A function used by the progressThread to collect and calculate
  * statistics collected during the download and display them
@@ -414,13 +1260,62 @@ unsigned long PieceManager::bytesDownloaded()
 void PieceManager::trackProgress()
 {
     usleep(pow(10, 6));
-    while (!isComplete())
+    int previousCursor = 0;
+    bool stalled = false;
+    while (!isComplete() && !stopped)
     {
         displayProgressBar();
+        lock.lock();
         // Resets the number of pieces downloaded to 0
         piecesDownloadedInInterval = 0;
+        updatePeerRates();
+        // Counts the intervals in which data was being waited on at the read cursor
+        if (options.sequential && readCursor > 0)
+        {
+            if (readCursor == previousCursor)
+            {
+                if (!stalled)
+                    stallCount++;
+                stalled = true;
+                stalledSeconds += PROGRESS_DISPLAY_INTERVAL;
+            }
+            else
+                stalled = false;
+        }
+        previousCursor = readCursor;
+        lock.unlock();
+        size_t hashQueueDepth = verifier.queueDepth();
+        if (hashQueueDepth > 0)
+            LOG_F(INFO, "Hash queue depth: %zu", hashQueueDepth);
+        size_t writeQueueBytes = writer.queuedBytes();
+        if (writeQueueBytes > 0)
+            LOG_F(INFO, "Write queue: %.2f MB", (double) writeQueueBytes / BYTES_PER_MB);
+        budget.logUsage();
+        storage.closeIdleFiles();
         usleep(PROGRESS_DISPLAY_INTERVAL * pow(10, 6));
     }
+
+    lock.lock();
+    if (options.sequential)
+    {
+        for (auto const& [megabytes, seconds] : firstBytesTimes)
+            LOG_F(INFO, "Time to first %ld MB: %.2f s", megabytes, seconds);
+        LOG_F(INFO, "Stalls at the read cursor: %d (%d s in total)", stallCount, stalledSeconds);
+    }
+    double havesPerPiece = completedPieces.empty() ? 0 : (double) haveMessagesSent / (double) completedPieces.size();
+    LOG_F(INFO, "Have messages sent: %lu, suppressed: %lu (%.2f per completed piece)",
+          haveMessagesSent, haveMessagesSuppressed, havesPerPiece);
+    LOG_F(INFO, "Wasted %lu bytes on corrupt data (%lu pieces failed, %lu corrupt blocks), %zu peers banned",
+          wastedBytes, corruptPieces, corruptBlocks, bannedPeers.size());
+    struct rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    LOG_F(INFO, "Peak resident memory: %.2f MB", (double) usage.ru_maxrss / 1024);
+    lock.unlock();
+    verifier.logStatistics();
+    writer.logStatistics();
+    budget.logStatistics();
+    storage.logStatistics();
+    readCache.logStatistics();
 }
 
 /**
@@ -431,7 +1326,7 @@ void PieceManager::displayProgressBar()
 {
     std::stringstream info;
     lock.lock();
-    unsigned long downloadedPieces = havePieces.size();
+    unsigned long downloadedPieces = havePieces.count();
     unsigned long downloadedLength = pieceLength * piecesDownloadedInInterval;
 
     // Calculates the average download speed in the last PROGRESS_DISPLAY_INTERVAL in MB/s
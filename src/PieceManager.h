@@ -6,13 +6,22 @@
 #define BITTORRENTCLIENT_PIECEMANAGER_H
 
 #include <map>
+#include <set>
 #include <vector>
 #include <ctime>
+#include <chrono>
 #include <mutex>
-#include <fstream>
 #include <thread>
+#include <atomic>
 
 #include "Piece.h"
+#include "Storage.h"
+#include "PieceVerifier.h"
+#include "DiskWriter.h"
+#include "ReadCache.h"
+#include "MemoryBudget.h"
+#include "ResumeData.h"
+#include "Bitfield.h"
 #include "TorrentFileParser.h"
 
 
@@ -20,6 +29,55 @@ struct PendingRequest
 {
     Block* block;
     time_t timestamp;
+    // The peer from which the Block was last requested
+    std::string peerId;
+    // Whether the Block has also been requested from a second peer
+    bool duplicated;
+};
+
+/**
+ * A Block of a piece which failed verification, kept until the piece
+ * has been verified so that the peer which sent corrupt data can be
+ * identified.
+ */
+struct SuspectBlock
+{
+    int offset;
+    // The peer from which the Block was received
+    std::string peerId;
+    // The SHA1 hash of the data of the Block
+    std::string digest;
+};
+
+/**
+ * Options which control how the download is carried out.
+ */
+struct DownloadOptions
+{
+    // Downloads the pieces close to the read cursor (i.e. the first piece
+    // that has not been downloaded) first, so that the file can be
+    // processed while it is still being downloaded.
+    bool sequential = false;
+    // Writes every Block to disk as soon as it is received instead of
+    // keeping the Blocks of ongoing pieces in memory, and verifies the
+    // pieces by reading them back.
+    bool writeThrough = false;
+    // Maximum size in bytes of a write made by merging the writes to
+    // adjacent parts of the file, 0 not to merge writes
+    size_t writeCoalesceBytes = 1048576;
+    // Accesses the file through memory mappings instead of pwrite and pread
+    bool memoryMapped = false;
+    // How the disk space of the file is allocated before the download
+    Preallocation preallocation = sparseFile;
+    // Bypasses the page cache with O_DIRECT when accessing the file
+    bool directIo = false;
+    // Memory in bytes used to cache the pieces uploaded to the peers, 0
+    // to read every requested Block from disk
+    size_t readCacheBytes = 32 * 1048576;
+    // Memory in bytes used by the pieces from the moment they are started
+    // until they have been written, above which no new piece is started,
+    // 0 for no limit
+    size_t memoryBudgetBytes = 128 * 1048576;
 };
 
 /**
@@ -32,40 +90,129 @@ class PieceManager
 {
 private:
 
-    std::map<std::string, std::string> peers;
-    std::vector<Piece*> missingPieces;
+    std::map<std::string, Bitfield> peers;
+    // All the pieces of the Torrent, indexed by piece index
+    std::vector<Piece*> pieces;
+    // Pieces which have not been requested from any peer yet
+    Bitfield missingPieces;
     std::vector<Piece*> ongoingPieces;
-    std::vector<Piece*> havePieces;
+    // Pieces which have been downloaded and verified
+    Bitfield havePieces;
+    // Number of connected peers which have each piece
+    std::vector<int> pieceAvailability;
+    // Indices of the verified pieces in the order of completion
+    std::vector<int> completedPieces;
+    unsigned long haveMessagesSent = 0;
+    unsigned long haveMessagesSuppressed = 0;
+    const DownloadOptions options;
+
+    // BitTorrent v2: the pieces are checked against the Merkle tree of the
+    // file, and the hashes of their Blocks are requested from the peers
+    // so that a corrupt Block can be detected as soon as it arrives
+    bool useMerkleTree = false;
+    std::string piecesRoot;
+    size_t leavesPerPiece = 0;
+    std::map<int, time_t> hashRequests;
+    // Data which was downloaded and then discarded because it was corrupt
+    unsigned long wastedBytes = 0;
+    unsigned long corruptPieces = 0;
+    unsigned long corruptBlocks = 0;
+    // Smart-ban: the Blocks of the pieces which failed verification, by
+    // piece index, and the peers which turned out to have sent corrupt data
+    std::map<int, std::vector<SuspectBlock>> suspectBlocks;
+    std::map<std::string, int> peerCorruptBlocks;
+    std::set<std::string> bannedPeers;
+
+    // Streaming statistics and state. The read cursor is the first
+    // piece which has not been downloaded yet.
+    int readCursor = 0;
+    std::map<int, time_t> pieceDeadlines;
+    std::map<std::string, unsigned long> peerBytesInInterval;
+    std::map<std::string, double> peerDownloadRates;
+    std::chrono::steady_clock::time_point downloadStart;
+    std::vector<std::pair<long, double>> firstBytesTimes;
+    long nextMilestoneMB = 1;
+    int stallCount = 0;
+    int stalledSeconds = 0;
     std::vector<PendingRequest*> pendingRequests;
-    std::ofstream downloadedFile;
+    Storage storage;
+    // Records the pieces written to disk, so that a restarted download
+    // does not have to check the files again
+    ResumeData resumeData;
     // std::thread& progressTrackerThread;
     const long pieceLength;
+    // Total size of the files of the Torrent
+    const long fileSize;
     const TorrentFileParser& fileParser;
     const int maximumConnections;
     int piecesDownloadedInInterval = 0;
     time_t startingTime;
     int totalPieces{};
+    std::thread progressThread;
+    std::atomic<bool> stopped { false };
 
     // Uses a lock to prevent race condition
     std::mutex lock;
+    // The pieces recently uploaded or downloaded, to serve the requests of the peers
+    ReadCache readCache;
+    // Bounds the memory used by the pieces being downloaded
+    MemoryBudget budget;
+    // Writes the data to disk on a dedicated thread
+    DiskWriter writer;
+    // Verifies the completed Pieces on dedicated hasher threads
+    PieceVerifier verifier;
 
     std::vector<Piece*> initiatePieces();
+    long getPieceSize(int index) const;
+    void recheck(const std::string& downloadDirectory, const Bitfield& candidates);
+    void markDownloaded(const Bitfield& downloadedPieces);
+    void resumePartialPieces(const std::map<int, Bitfield>& partialPieces);
+    std::map<int, Bitfield> savePartialPieces();
+    void saveResumeData(const std::map<int, Bitfield>& partialPieces = {}, bool isStopped = false);
     Block* expiredRequest(std::string peerId);
     Block* nextOngoing(std::string peerId);
+    Block* nextUrgent(const std::string& peerId, bool canStartPiece);
+    Block* addPendingRequest(Block* block, const std::string& peerId);
     Piece* getRarestPiece(std::string peerId);
+    void startPiece(Piece* piece);
+    bool isUrgent(int pieceIndex) const;
+    bool isFastPeer(const std::string& peerId);
+    void advanceReadCursor();
+    void updatePeerRates();
     void write(Piece* piece);
+    void pieceVerified(Piece* piece, bool isHashMatching, unsigned generation);
+    void pieceWritten(Piece* piece, bool isWritten);
+    void blocksRejected(Piece* piece);
+    std::string blockDigest(Piece* piece, Block* block);
+    void identifyCorruptPeers(Piece* piece);
+    void recordCorruptBlock(const std::string& peerId);
     void displayProgressBar();
     void trackProgress();
 public:
-    explicit PieceManager(const TorrentFileParser& fileParser, const std::string& downloadPath, int maximumConnections);
+    explicit PieceManager(const TorrentFileParser& fileParser, const std::string& downloadDirectory, int maximumConnections,
+                          DownloadOptions options = DownloadOptions());
     ~PieceManager();
     bool isComplete();
+    void stopRequests();
+    void flush();
     void blockReceived(std::string peerId, int pieceIndex, int blockOffset, std::string data);
-    void addPeer(const std::string& peerId, std::string bitField);
+    void addPeer(const std::string& peerId, const std::string& bitField);
     void removePeer(const std::string& peerId);
     void updatePeer(const std::string& peerId, int index);
+    bool isInteresting(const std::string& peerId);
+    bool isBanned(const std::string& peerId);
+    std::string getBitField(size_t& completedCursor);
+    std::vector<int> piecesToAnnounce(const std::string& peerId, size_t& completedCursor);
     unsigned long bytesDownloaded();
+    unsigned long getWastedBytes();
     Block* nextRequest(std::string peerId);
+    bool readBlock(int pieceIndex, int blockOffset, int length, std::string& data);
+    bool hasMerkleTree() const;
+    const std::string& getPiecesRoot() const;
+    size_t getLeavesPerPiece() const;
+    int nextHashRequest(const std::string& peerId);
+    void hashesReceived(const std::string& peerId, int pieceIndex, const std::vector<std::string>& hashes);
+    void hashesRejected(int pieceIndex);
 };
 
 #endif //BITTORRENTCLIENT_PIECEMANAGER_H
@@ -0,0 +1,121 @@
+#include <utility>
+#include <loguru/loguru.hpp>
+
+#include "PieceVerifier.h"
+
+/**
+ * Starts the hasher threads.
+ * @param threadCount: number of hasher threads.
+ * @param releaseData: whether to free the data of the Blocks once hashed.
+ * @param onVerified: receives the result of the verification of each Piece,
+ * with the generation of the Piece which was verified.
+ * @param onRejected: receives the Pieces in which corrupt Blocks were found.
+ */
+PieceVerifier::PieceVerifier(int threadCount, bool releaseData, ResultCallback onVerified,
+                             RejectionCallback onRejected):
+    releaseData(releaseData), onVerified(std::move(onVerified)), onRejected(std::move(onRejected))
+{
+    for (int i = 0; i < threadCount; i++)
+        threads.emplace_back([this] { this->run(); });
+}
+
+/**
+ * Destructor of the PieceVerifier class. Stops the hasher threads.
+ */
+PieceVerifier::~PieceVerifier()
+{
+    stop();
+}
+
+/**
+ * Queues the hashing of the Blocks at the start of a Piece which have
+ * been retrieved. The Piece is verified once all its Blocks are hashed.
+ * @param piece: the Piece to which the Blocks belong.
+ * @param blockCount: number of Blocks at the start of the Piece that have
+ * been retrieved.
+ * @param generation: the generation of the Piece when these Blocks were
+ * retrieved.
+ */
+void PieceVerifier::submit(Piece* piece, size_t blockCount, unsigned generation)
+{
+    std::unique_lock<std::mutex> queueLock(lock);
+    jobs.push_back({ piece, blockCount, generation, std::chrono::steady_clock::now() });
+    maxQueueDepth = std::max(maxQueueDepth, jobs.size());
+    queueLock.unlock();
+    jobAvailable.notify_one();
+}
+
+/**
+ * Stops the hasher threads once they are done with their current job.
+ * The Pieces left in the queue are not verified.
+ */
+void PieceVerifier::stop()
+{
+    std::unique_lock<std::mutex> queueLock(lock);
+    stopping = true;
+    queueLock.unlock();
+    jobAvailable.notify_all();
+    for (std::thread& thread : threads)
+    {
+        if (thread.joinable())
+            thread.join();
+    }
+    threads.clear();
+}
+
+/**
+ * Returns the number of hashing jobs waiting in the queue.
+ */
+size_t PieceVerifier::queueDepth()
+{
+    std::lock_guard<std::mutex> queueLock(lock);
+    return jobs.size();
+}
+
+/**
+ * Logs the depth of the queue and the latency of the verification
+ * (i.e. the time between the arrival of the last Block of a Piece
+ * and its result).
+ */
+void PieceVerifier::logStatistics()
+{
+    std::lock_guard<std::mutex> queueLock(lock);
+    double averageLatency = verifiedPieces == 0 ? 0 : totalLatency / (double) verifiedPieces;
+    LOG_F(INFO, "Hash queue: %lu jobs, %lu pieces verified, maximum depth %zu, "
+                "latency %.2f ms on average, %.2f ms at most",
+          hashJobs, verifiedPieces, maxQueueDepth, averageLatency, maxLatency);
+}
+
+/**
+ * Main loop of a hasher thread. Hashes Blocks from the queue until
+ * the PieceVerifier is stopped, and verifies the Pieces whose Blocks
+ * have all been hashed.
+ */
+void PieceVerifier::run()
+{
+    while (true)
+    {
+        std::unique_lock<std::mutex> queueLock(lock);
+        jobAvailable.wait(queueLock, [this] { return stopping || !jobs.empty(); });
+        if (stopping)
+            return;
+        Job job = jobs.front();
+        jobs.pop_front();
+        hashJobs++;
+        queueLock.unlock();
+
+        HashingResult result = job.piece->hashBlocks(job.blockCount, job.generation, releaseData);
+        if (result == blocksRejected)
+            onRejected(job.piece);
+        if (result != blocksHashed || job.blockCount < job.piece->blocks.size())
+            continue;
+
+        onVerified(job.piece, job.piece->isHashMatching(), job.generation);
+        std::chrono::duration<double, std::milli> latency = std::chrono::steady_clock::now() - job.submitted;
+        queueLock.lock();
+        verifiedPieces++;
+        totalLatency += latency.count();
+        maxLatency = std::max(maxLatency, latency.count());
+        queueLock.unlock();
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef BITTORRENTCLIENT_PIECEVERIFIER_H
+#define BITTORRENTCLIENT_PIECEVERIFIER_H
+
+#include <deque>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+#include "Piece.h"
+
+/**
+ * A pool of hasher threads which hashes the Blocks of the ongoing
+ * Pieces as they arrive, so that the threads receiving data from peers
+ * never compute hashes. Once all the Blocks of a Piece have been hashed,
+ * the result of its verification is delivered through a callback
+ * called from the hasher thread. Blocks of v2 Pieces which do not match
+ * their leaf hash are reported through a second callback as soon as
+ * they are hashed.
+ */
+class PieceVerifier
+{
+public:
+    typedef std::function<void(Piece*, bool, unsigned)> ResultCallback;
+    typedef std::function<void(Piece*)> RejectionCallback;
+
+    explicit PieceVerifier(int threadCount, bool releaseData, ResultCallback onVerified,
+                           RejectionCallback onRejected);
+    ~PieceVerifier();
+    void submit(Piece* piece, size_t blockCount, unsigned generation);
+    void stop();
+    size_t queueDepth();
+    void logStatistics();
+
+private:
+    struct Job
+    {
+        Piece* piece;
+        // Number of Blocks at the start of the Piece to hash
+        size_t blockCount;
+        unsigned generation;
+        std::chrono::steady_clock::time_point submitted;
+    };
+
+    const bool releaseData;
+    const ResultCallback onVerified;
+    const RejectionCallback onRejected;
+    std::deque<Job> jobs;
+    std::vector<std::thread> threads;
+    bool stopping = false;
+
+    size_t maxQueueDepth = 0;
+    unsigned long verifiedPieces = 0;
+    unsigned long hashJobs = 0;
+    double totalLatency = 0;
+    double maxLatency = 0;
+
+    std::mutex lock;
+    std::condition_variable jobAvailable;
+
+    void run();
+};
+
+#endif //BITTORRENTCLIENT_PIECEVERIFIER_H
@@ -0,0 +1,117 @@
+#include <loguru/loguru.hpp>
+
+#include "ReadCache.h"
+
+#define BYTES_PER_MB 1048576
+
+/**
+ * @param capacity: maximum number of bytes of piece data kept in memory,
+ * 0 to disable the cache.
+ */
+ReadCache::ReadCache(size_t capacity): capacity(capacity) {}
+
+/**
+ * Retrieves the maximum number of bytes of piece data kept in memory.
+ */
+size_t ReadCache::getCapacity() const
+{
+    return capacity;
+}
+
+/**
+ * Retrieves the data of the given piece, or nullptr if it is not cached.
+ */
+std::shared_ptr<const std::string> ReadCache::get(int index)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    auto iter = cacheIndex.find(index);
+    if (iter == cacheIndex.end())
+    {
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    cachedPieces.splice(cachedPieces.begin(), cachedPieces, iter->second);
+    return iter->second->data;
+}
+
+/**
+ * Caches the data of the given piece, dropping the least recently used
+ * pieces to stay within the budget. A piece larger than the whole budget
+ * is not cached.
+ * @return the cached data, which is also returned if it was not cached.
+ */
+std::shared_ptr<const std::string> ReadCache::insert(int index, std::string data)
+{
+    auto pieceData = std::make_shared<const std::string>(std::move(data));
+    if (pieceData->size() > capacity)
+        return pieceData;
+    std::lock_guard<std::mutex> guard(lock);
+    auto iter = cacheIndex.find(index);
+    if (iter != cacheIndex.end())
+    {
+        cachedBytes -= iter->second->data->size();
+        cachedPieces.erase(iter->second);
+    }
+    while (!cachedPieces.empty() && cachedBytes + pieceData->size() > capacity)
+    {
+        cachedBytes -= cachedPieces.back().data->size();
+        cacheIndex.erase(cachedPieces.back().index);
+        cachedPieces.pop_back();
+    }
+    cachedPieces.push_front({ index, pieceData });
+    cacheIndex[index] = cachedPieces.begin();
+    cachedBytes += pieceData->size();
+    return pieceData;
+}
+
+/**
+ * Drops the given piece from the cache, e.g. when its data turned out
+ * not to be on disk.
+ */
+void ReadCache::erase(int index)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    auto iter = cacheIndex.find(index);
+    if (iter == cacheIndex.end())
+        return;
+    cachedBytes -= iter->second->data->size();
+    cachedPieces.erase(iter->second);
+    cacheIndex.erase(iter);
+}
+
+/**
+ * Records a read of 'length' bytes from disk to serve a request.
+ */
+void ReadCache::recordDiskRead(size_t length)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    diskReads++;
+    bytesRead += length;
+}
+
+/**
+ * Records a Block of 'length' bytes sent to a peer.
+ */
+void ReadCache::recordUpload(size_t length)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    bytesUploaded += length;
+}
+
+/**
+ * Logs the hit rate of the cache, and the number of disk reads made per
+ * MB of data uploaded to the peers.
+ */
+void ReadCache::logStatistics()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (bytesUploaded == 0)
+        return;
+    double hitRate = hits + misses == 0 ? 0 : (double) hits / (double) (hits + misses) * 100;
+    double uploadedMegabytes = (double) bytesUploaded / BYTES_PER_MB;
+    LOG_F(INFO, "Uploaded %.2f MB: read cache %lu hits, %lu misses (%.2f%% hit rate), "
+                "%lu disk reads (%.2f per uploaded MB, %.2f MB read)",
+          uploadedMegabytes, hits, misses, hitRate, diskReads, (double) diskReads / uploadedMegabytes,
+          (double) bytesRead / BYTES_PER_MB);
+}
@@ -0,0 +1,52 @@
+#ifndef BITTORRENTCLIENT_READCACHE_H
+#define BITTORRENTCLIENT_READCACHE_H
+
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+/**
+ * A cache of the data of whole pieces, used to serve the Blocks requested
+ * by the peers. Peers request the Blocks of a piece one after the other,
+ * so the piece is read from disk once, on the first request, and the
+ * following requests are served from memory. The least recently used
+ * pieces are dropped when the cached data exceeds the budget.
+ * The data is shared with the readers, so that a piece dropped while a
+ * Block is being copied out of it stays valid until the copy is done.
+ */
+class ReadCache
+{
+private:
+    struct CachedPiece
+    {
+        int index;
+        std::shared_ptr<const std::string> data;
+    };
+
+    const size_t capacity;
+    size_t cachedBytes = 0;
+    // Most recently used first
+    std::list<CachedPiece> cachedPieces;
+    std::unordered_map<int, std::list<CachedPiece>::iterator> cacheIndex;
+    std::mutex lock;
+
+    unsigned long hits = 0;
+    unsigned long misses = 0;
+    unsigned long diskReads = 0;
+    unsigned long bytesRead = 0;
+    unsigned long bytesUploaded = 0;
+
+public:
+    explicit ReadCache(size_t capacity);
+    size_t getCapacity() const;
+    std::shared_ptr<const std::string> get(int index);
+    std::shared_ptr<const std::string> insert(int index, std::string data);
+    void erase(int index);
+    void recordDiskRead(size_t length);
+    void recordUpload(size_t length);
+    void logStatistics();
+};
+
+#endif //BITTORRENTCLIENT_READCACHE_H
@@ -0,0 +1,268 @@
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <bencode/bencoding.h>
+#include <loguru/loguru.hpp>
+
+#include "ResumeData.h"
+
+#define RESUME_JOURNAL_MAX_ENTRIES 1024
+#define RESUME_JOURNAL_BATCH 16                         // pieces synchronised and journaled at once
+#define RESUME_JOURNAL_INTERVAL std::chrono::seconds(5) // maximum age of a batch
+#define JOURNAL_ENTRY_SIZE 4
+
+/**
+ * @param downloadDirectory: directory in which the files are downloaded.
+ * @param name: name of the Torrent, i.e. of the downloaded file or directory.
+ * @param infoHash: info hash of the Torrent, which the resume data must match.
+ */
+ResumeData::ResumeData(const std::string& downloadDirectory, const std::string& name, std::string infoHash):
+    resumePath(downloadDirectory + name + ".resume"), journalPath(resumePath + ".journal"),
+    infoHash(std::move(infoHash)) {}
+
+/**
+ * Destructor of the ResumeData class. Closes the journal.
+ */
+ResumeData::~ResumeData()
+{
+    if (journalFd >= 0)
+        close(journalFd);
+}
+
+/**
+ * Reads the resume data, if it exists and matches the Torrent and the
+ * files on disk.
+ * @param fileStates: size and modification time of each file, as found
+ * before the download started.
+ * @param pieces: set to the pieces which have been downloaded, according
+ * to the snapshot and, if the files have not been modified since, the
+ * journal. Its size is the number of pieces.
+ * @param uncheckedPieces: set to the pieces of the journal which must be
+ * checked again, as the download was interrupted. Its size is the number
+ * of pieces.
+ * @param partialPieces: set to the Blocks on disk of each piece which had
+ * not been completed, by piece index.
+ * @return true if the resume data can be trusted.
+ */
+bool ResumeData::load(const std::vector<FileState>& fileStates, Bitfield& pieces, Bitfield& uncheckedPieces,
+                      std::map<int, Bitfield>& partialPieces)
+{
+    std::ifstream resumeFile(resumePath, std::ifstream::binary);
+    if (!resumeFile)
+        return false;
+    std::stringstream content;
+    content << resumeFile.rdbuf();
+
+    std::shared_ptr<bencoding::BDictionary> snapshot;
+    try
+    {
+        snapshot = std::dynamic_pointer_cast<bencoding::BDictionary>(
+            std::shared_ptr<bencoding::BItem>(bencoding::decode(content.str())));
+    }
+    catch (const std::exception& e)
+    {
+        LOG_F(ERROR, "Ignoring the malformed resume data in %s [%s]", resumePath.c_str(), e.what());
+        return false;
+    }
+    if (!snapshot)
+        return false;
+    auto infoHashItem = std::dynamic_pointer_cast<bencoding::BString>(snapshot->getValue("info hash"));
+    auto fileList = std::dynamic_pointer_cast<bencoding::BList>(snapshot->getValue("files"));
+    auto piecesItem = std::dynamic_pointer_cast<bencoding::BString>(snapshot->getValue("pieces"));
+    if (!infoHashItem || infoHashItem->value() != infoHash || !fileList || fileList->size() != fileStates.size() ||
+        !piecesItem || piecesItem->value().size() != (pieces.size() + 7) / 8)
+    {
+        LOG_F(INFO, "The resume data in %s does not match the Torrent", resumePath.c_str());
+        return false;
+    }
+
+    // Without a clean stop, the files have been written to since the
+    // snapshot was taken, so only their sizes are compared
+    auto stoppedItem = std::dynamic_pointer_cast<bencoding::BInteger>(snapshot->getValue("stopped"));
+    bool isStopped = stoppedItem && stoppedItem->value() == 1;
+    size_t fileIndex = 0;
+    for (const auto& item : *fileList)
+    {
+        auto fileDictionary = std::dynamic_pointer_cast<bencoding::BDictionary>(item);
+        auto lengthItem = fileDictionary ?
+            std::dynamic_pointer_cast<bencoding::BInteger>(fileDictionary->getValue("length")) : nullptr;
+        auto timeItem = fileDictionary ?
+            std::dynamic_pointer_cast<bencoding::BInteger>(fileDictionary->getValue("mtime")) : nullptr;
+        const FileState& fileState = fileStates[fileIndex++];
+        if (!lengthItem || !timeItem || lengthItem->value() != fileState.size ||
+            (isStopped && timeItem->value() != fileState.modificationTime))
+        {
+            LOG_F(INFO, "The files have been modified since the resume data in %s was saved", resumePath.c_str());
+            return false;
+        }
+    }
+
+    pieces = Bitfield::fromBytes(piecesItem->value(), pieces.size());
+    auto partialList = std::dynamic_pointer_cast<bencoding::BList>(snapshot->getValue("partial pieces"));
+    if (partialList)
+    {
+        for (const auto& item : *partialList)
+        {
+            auto pieceDictionary = std::dynamic_pointer_cast<bencoding::BDictionary>(item);
+            if (!pieceDictionary)
+                continue;
+            auto indexItem = std::dynamic_pointer_cast<bencoding::BInteger>(pieceDictionary->getValue("index"));
+            auto countItem = std::dynamic_pointer_cast<bencoding::BInteger>(pieceDictionary->getValue("blocks"));
+            auto blocksItem = std::dynamic_pointer_cast<bencoding::BString>(pieceDictionary->getValue("retrieved"));
+            if (indexItem && countItem && blocksItem && indexItem->value() >= 0 &&
+                indexItem->value() < (long) pieces.size() && countItem->value() >= 0 &&
+                blocksItem->value().size() == (size_t) (countItem->value() + 7) / 8)
+                partialPieces[(int) indexItem->value()] = Bitfield::fromBytes(blocksItem->value(),
+                                                                              countItem->value());
+        }
+    }
+    if (isStopped)
+    {
+        readJournal(pieces);
+        LOG_F(INFO, "Resume data: %zu pieces in the snapshot and the journal", pieces.count());
+    }
+    else
+    {
+        readJournal(uncheckedPieces);
+        uncheckedPieces = uncheckedPieces.andNot(pieces);
+        LOG_F(INFO, "Resume data: %zu pieces in the snapshot, and %zu pieces in the journal to check again "
+                    "as the download was interrupted", pieces.count(), uncheckedPieces.count());
+    }
+    return true;
+}
+
+/**
+ * Adds the pieces listed in the journal to the given BitField. A partial
+ * entry at the end, left by an interrupted append, is ignored.
+ */
+void ResumeData::readJournal(Bitfield& pieces)
+{
+    std::ifstream journal(journalPath, std::ifstream::binary);
+    char entry[JOURNAL_ENTRY_SIZE];
+    size_t entries = 0;
+    while (journal.read(entry, JOURNAL_ENTRY_SIZE))
+    {
+        uint32_t index;
+        memcpy(&index, entry, JOURNAL_ENTRY_SIZE);
+        index = ntohl(index);
+        if (index < pieces.size())
+            pieces.set(index);
+        entries++;
+    }
+    LOG_F(INFO, "Read %zu entries from %s", entries, journalPath.c_str());
+}
+
+/**
+ * Records a piece which has been written to disk, to be appended to the
+ * journal with the next batch.
+ * @return true once the batch should be appended with journalPieces(),
+ * i.e. once it holds RESUME_JOURNAL_BATCH pieces or is older than
+ * RESUME_JOURNAL_INTERVAL.
+ */
+bool ResumeData::pieceCompleted(int index)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (journalFd < 0)
+        return false;
+    if (completedPieces.empty())
+        batchStart = std::chrono::steady_clock::now();
+    completedPieces.push_back(index);
+    return completedPieces.size() >= RESUME_JOURNAL_BATCH ||
+           std::chrono::steady_clock::now() - batchStart >= RESUME_JOURNAL_INTERVAL;
+}
+
+/**
+ * Appends the recorded pieces to the journal, with a single write. The
+ * data of the pieces must have been synchronised to disk before, so that
+ * a journaled piece survives a crash of the system.
+ * @return true once the journal should be compacted with save().
+ */
+bool ResumeData::journalPieces()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (journalFd < 0 || completedPieces.empty())
+        return false;
+    std::vector<uint32_t> entries;
+    for (int index : completedPieces)
+        entries.push_back(htonl(index));
+    ssize_t length = (ssize_t) (entries.size() * JOURNAL_ENTRY_SIZE);
+    completedPieces.clear();
+    // A partial entry left by a failed append is ignored when reading
+    if (::write(journalFd, entries.data(), length) != length)
+    {
+        LOG_F(ERROR, "Failed to append to %s [%s]", journalPath.c_str(), strerror(errno));
+        return false;
+    }
+    journalEntries += entries.size();
+    return journalEntries >= RESUME_JOURNAL_MAX_ENTRIES;
+}
+
+/**
+ * Writes a new snapshot of the resume data and empties the journal. The
+ * snapshot is written to a temporary file which then replaces the previous
+ * one, so that a valid snapshot exists at all times. The data of the given
+ * pieces must already be on disk.
+ * @param pieces: the pieces which have been downloaded.
+ * @param partialPieces: the Blocks on disk of the pieces which have not
+ * been completed, by piece index.
+ * @param fileStates: current size and modification time of each file.
+ * @param isStopped: whether the download has stopped, after which the
+ * files must not be modified until it is resumed.
+ */
+void ResumeData::save(const Bitfield& pieces, const std::map<int, Bitfield>& partialPieces,
+                      const std::vector<FileState>& fileStates, bool isStopped)
+{
+    using namespace bencoding;
+    std::shared_ptr<BList> fileList = BList::create();
+    for (const FileState& fileState : fileStates)
+    {
+        fileList->push_back(BDictionary::create({
+            { BString::create("length"), BInteger::create(fileState.size) },
+            { BString::create("mtime"), BInteger::create(fileState.modificationTime) }
+        }));
+    }
+    std::shared_ptr<BList> partialList = BList::create();
+    for (const auto& entry : partialPieces)
+    {
+        partialList->push_back(BDictionary::create({
+            { BString::create("index"), BInteger::create(entry.first) },
+            { BString::create("blocks"), BInteger::create((long) entry.second.size()) },
+            { BString::create("retrieved"), BString::create(entry.second.toBytes()) }
+        }));
+    }
+    std::shared_ptr<BDictionary> snapshot = BDictionary::create();
+    (*snapshot)[BString::create("info hash")] = BString::create(infoHash);
+    (*snapshot)[BString::create("files")] = fileList;
+    (*snapshot)[BString::create("pieces")] = BString::create(pieces.toBytes());
+    (*snapshot)[BString::create("partial pieces")] = partialList;
+    (*snapshot)[BString::create("stopped")] = BInteger::create(isStopped ? 1 : 0);
+    std::string content = encode(snapshot);
+
+    std::lock_guard<std::mutex> guard(lock);
+    std::string temporaryPath = resumePath + ".tmp";
+    int fd = open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool isWritten = fd >= 0 && ::write(fd, content.data(), content.size()) == (ssize_t) content.size() &&
+                     fdatasync(fd) == 0;
+    if (fd >= 0)
+        close(fd);
+    if (!isWritten || rename(temporaryPath.c_str(), resumePath.c_str()) < 0)
+    {
+        LOG_F(ERROR, "Failed to save the resume data to %s [%s]", resumePath.c_str(), strerror(errno));
+        return;
+    }
+
+    // The entries of the journal, and the pieces not journaled yet, are
+    // all in the new snapshot
+    completedPieces.clear();
+    if (journalFd >= 0)
+        close(journalFd);
+    journalFd = open(journalPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (journalFd < 0)
+        LOG_F(ERROR, "Cannot open %s [%s]", journalPath.c_str(), strerror(errno));
+    journalEntries = 0;
+}
@@ -0,0 +1,60 @@
+#ifndef BITTORRENTCLIENT_RESUMEDATA_H
+#define BITTORRENTCLIENT_RESUMEDATA_H
+
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "Bitfield.h"
+#include "Storage.h"
+
+/**
+ * The fast-resume data of a download, kept next to the downloaded files
+ * so that a restarted download does not have to check them again.
+ * It is made of two files:
+ * - <name>.resume: a bencoded snapshot holding the info hash, the size
+ *   and modification time of each file, and the BitField of the pieces
+ *   which had been written to disk when the snapshot was taken. When the
+ *   download is stopped, it also holds the Blocks of the pieces which
+ *   were being downloaded, whose data has been written at their offsets.
+ * - <name>.resume.journal: the indices of the pieces completed since the
+ *   snapshot, appended as 4-byte big-endian integers, so that the whole
+ *   BitField is not rewritten for every piece. The pieces are appended
+ *   in batches, once their data has been synchronised to disk.
+ * The journal is compacted into a new snapshot once it holds
+ * RESUME_JOURNAL_MAX_ENTRIES pieces, and when the download stops.
+ * After a clean stop, the resume data is only trusted if the files have
+ * not been modified since, i.e. if their sizes and modification times
+ * match the snapshot. After the download was interrupted, the files have
+ * been written to since the snapshot: the pieces of the snapshot are
+ * still trusted, and those of the journal are checked again.
+ */
+class ResumeData
+{
+private:
+    const std::string resumePath;
+    const std::string journalPath;
+    const std::string infoHash;
+    int journalFd = -1;
+    size_t journalEntries = 0;
+    // Pieces completed since the last batch was appended to the journal
+    std::vector<int> completedPieces;
+    std::chrono::steady_clock::time_point batchStart;
+    std::mutex lock;
+
+    void readJournal(Bitfield& pieces);
+
+public:
+    explicit ResumeData(const std::string& downloadDirectory, const std::string& name, std::string infoHash);
+    ~ResumeData();
+    bool load(const std::vector<FileState>& fileStates, Bitfield& pieces, Bitfield& uncheckedPieces,
+              std::map<int, Bitfield>& partialPieces);
+    bool pieceCompleted(int index);
+    bool journalPieces();
+    void save(const Bitfield& pieces, const std::map<int, Bitfield>& partialPieces,
+              const std::vector<FileState>& fileStates, bool isStopped = false);
+};
+
+#endif //BITTORRENTCLIENT_RESUMEDATA_H
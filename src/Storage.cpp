@@ -0,0 +1,759 @@
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <utility>
+#include <algorithm>
+#include <climits>
+#include <mutex>
+#include <csignal>
+#include <csetjmp>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/statvfs.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+
+#include "Storage.h"
+
+#define MAX_OPEN_FILES 256
+#define FILE_IDLE_TIME std::chrono::seconds(30)
+#define MMAP_WINDOW_SIZE (256L * 1024 * 1024) // 256 MB, a multiple of the page size
+#define MMAP_MAX_WINDOWS 16                   // i.e. at most 4 GB of address space
+#define ZERO_FILL_CHUNK_SIZE 1048576          // 1 MB
+#define BYTES_PER_MB 1048576
+#define DIRECT_IO_ALIGNMENT 4096L             // alignment of the offsets, lengths and buffers of direct I/O
+#define DIRECT_IO_POOLED_BUFFERS 8
+
+// Set while a thread copies data to or from a mapping, so that a SIGBUS
+// raised by the copy (e.g. when the disk is full) ends the copy instead
+// of the process
+static thread_local sigjmp_buf* mappingFault = nullptr;
+
+static void handleBusError(int signal)
+{
+    if (mappingFault)
+        siglongjmp(*mappingFault, 1);
+    std::signal(signal, SIG_DFL);
+    std::raise(signal);
+}
+
+/**
+ * Copies data from or to a mapping, returning false instead of crashing
+ * if the copy raises a SIGBUS. Kept apart from its callers, so that none
+ * of their local variables is live across the sigsetjmp.
+ */
+static bool copyGuarded(char* destination, const char* source, size_t length)
+{
+    sigjmp_buf fault;
+    if (sigsetjmp(fault, 1) != 0)
+    {
+        mappingFault = nullptr;
+        return false;
+    }
+    mappingFault = &fault;
+    memcpy(destination, source, length);
+    mappingFault = nullptr;
+    return true;
+}
+
+/**
+ * Opens or creates the destination files, with the directories which
+ * contain them, sets their sizes to the sizes specified in the Torrent
+ * file, and allocates their disk space according to the given policy.
+ * Any existing content of the files is kept, so that it can be checked
+ * and the download resumed.
+ * @param downloadDirectory: directory in which the files are created.
+ * @param torrentFiles: the files of the Torrent, in the order of their data.
+ * @param memoryMapped: whether to access the files through memory mappings.
+ * Mapped files are always allocated up front, as running out of disk space
+ * while writing to a mapping raises a SIGBUS.
+ * @param preallocation: how the disk space of the files is allocated.
+ * @param directIo: whether to bypass the page cache with O_DIRECT.
+ */
+Storage::Storage(const std::string& downloadDirectory, const std::vector<TorrentFile>& torrentFiles,
+                 bool memoryMapped, Preallocation preallocation, bool directIo):
+    files(torrentFiles.size()), fileCache(MAX_OPEN_FILES, directIo ? O_DIRECT : 0), memoryMapped(memoryMapped),
+    directIo(directIo), bufferPool(DIRECT_IO_ALIGNMENT, DIRECT_IO_POOLED_BUFFERS)
+{
+    // The files are constructed in place, as their atomic flag cannot be
+    // moved
+    fileOffsets.reserve(torrentFiles.size());
+    for (size_t i = 0; i < torrentFiles.size(); i++)
+    {
+        const TorrentFile& torrentFile = torrentFiles[i];
+        StorageFile& file = files[i];
+        file.path = downloadDirectory + torrentFile.path;
+        file.offset = torrentFile.offset;
+        file.length = torrentFile.length;
+        file.isPadding = torrentFile.isPadding;
+        fileOffsets.push_back(torrentFile.offset);
+        totalSize = torrentFile.offset + torrentFile.length;
+    }
+
+    if (memoryMapped)
+    {
+        for (StorageFile& file : files)
+            file.windows.assign((file.length + MMAP_WINDOW_SIZE - 1) / MMAP_WINDOW_SIZE, nullptr);
+        static std::once_flag handlerInstalled;
+        std::call_once(handlerInstalled, []
+        {
+            struct sigaction action {};
+            action.sa_handler = handleBusError;
+            sigemptyset(&action.sa_mask);
+            sigaction(SIGBUS, &action, nullptr);
+        });
+    }
+
+    if (memoryMapped && preallocation == sparseFile)
+        preallocation = allocatedFile;
+    long requiredSize = 0;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        if (files[i].isPadding)
+            continue;
+        openFile(files[i], downloadDirectory, torrentFiles[i].path);
+        requiredSize += std::max(0L, files[i].length - files[i].allocatedSize);
+    }
+    auto firstFile = std::find_if(files.begin(), files.end(), [](const StorageFile& file) { return !file.isPadding; });
+    if (directIo && firstFile != files.end())
+    {
+        int fd = open(firstFile->path.c_str(), O_RDONLY | O_DIRECT);
+        if (fd < 0)
+            throw std::runtime_error("Cannot open " + firstFile->path + " for direct I/O [" + strerror(errno) + "]");
+        close(fd);
+    }
+    checkFreeSpace(downloadDirectory, requiredSize);
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        if (!files[i].isPadding)
+            preallocate(i, preallocation);
+    }
+}
+
+/**
+ * Destructor of the Storage class. Unmaps the files; the file cache closes
+ * them.
+ */
+Storage::~Storage()
+{
+    for (auto const& [fileIndex, window] : mappedWindows)
+        unmapWindow(fileIndex, window);
+}
+
+/**
+ * Opens or creates the given file, after creating the directories on its
+ * path, and sets its size. The file is closed again: it is only kept open
+ * in the file cache, while it is being accessed.
+ * @param relativePath: path of the file relative to the download directory.
+ */
+void Storage::openFile(StorageFile& file, const std::string& downloadDirectory, const std::string& relativePath)
+{
+    for (size_t separator = relativePath.find('/'); separator != std::string::npos;
+         separator = relativePath.find('/', separator + 1))
+    {
+        std::string directory = downloadDirectory + relativePath.substr(0, separator);
+        if (mkdir(directory.c_str(), 0755) < 0 && errno != EEXIST)
+            throw std::runtime_error("Cannot create " + directory + " [" + strerror(errno) + "]");
+    }
+
+    int fd = open(file.path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        throw std::runtime_error("Cannot open " + file.path + " [" + strerror(errno) + "]");
+    struct stat fileStatus {};
+    if (fstat(fd, &fileStatus) < 0 || ftruncate(fd, file.length) < 0)
+    {
+        std::string error = strerror(errno);
+        close(fd);
+        throw std::runtime_error("Cannot resize " + file.path + " [" + error + "]");
+    }
+    close(fd);
+    file.initialState = { (long) fileStatus.st_size,
+                          (long) fileStatus.st_mtim.tv_sec * 1000000000L + fileStatus.st_mtim.tv_nsec };
+    file.existingSize = std::min((long) fileStatus.st_size, file.length);
+    file.allocatedSize = (long) fileStatus.st_blocks * 512;
+    if (file.offset == 0 && fileStatus.st_blksize > 0)
+        blockSize = fileStatus.st_blksize;
+}
+
+/**
+ * Allocates the disk space of the given file according to the policy.
+ */
+void Storage::preallocate(size_t fileIndex, Preallocation preallocation)
+{
+    StorageFile& file = files[fileIndex];
+    if (file.length == 0)
+        return;
+    if (preallocation == allocatedFile)
+    {
+        FileCache::FileHandle handle = fileCache.open(fileIndex, file.path, true);
+        int error = posix_fallocate(handle.fd(), 0, file.length);
+        if (error == ENOSPC)
+            throw std::runtime_error("Not enough disk space for " + file.path + " [" + strerror(error) + "]");
+        // Otherwise the file system cannot allocate space, and the file stays sparse
+    }
+    else if (preallocation == zeroFilledFile && file.existingSize < file.length)
+    {
+        // The existing part of the file is kept as it may hold downloaded data
+        std::string zeros(ZERO_FILL_CHUNK_SIZE, '\0');
+        for (long offset = file.existingSize; offset < file.length; offset += ZERO_FILL_CHUNK_SIZE)
+        {
+            iovec buffer { &zeros[0], (size_t) std::min((long) ZERO_FILL_CHUNK_SIZE, file.length - offset) };
+            writeFile(fileIndex, offset, { buffer });
+        }
+    }
+}
+
+/**
+ * Throws if the file system of the files has less than the given number
+ * of bytes available, so that a full disk is reported before the download
+ * starts rather than midway. Even sparse files are checked.
+ */
+void Storage::checkFreeSpace(const std::string& downloadDirectory, long requiredSize)
+{
+    struct statvfs fileSystemStatus {};
+    std::string directory = downloadDirectory.empty() ? "." : downloadDirectory;
+    if (requiredSize <= 0 || statvfs(directory.c_str(), &fileSystemStatus) < 0)
+        return;
+    long availableSize = (long) (fileSystemStatus.f_bavail * fileSystemStatus.f_frsize);
+    if (availableSize < requiredSize)
+        throw std::runtime_error("Not enough disk space in " + directory + " (" +
+                                 std::to_string(requiredSize / BYTES_PER_MB) + " MB needed, " +
+                                 std::to_string(availableSize / BYTES_PER_MB) + " MB available)");
+}
+
+/**
+ * Finds the file which holds the given offset of the stream of data: the
+ * last file starting at or before it, so that empty files are skipped.
+ */
+size_t Storage::findFile(long offset) const
+{
+    if (offset < 0 || offset > totalSize || files.empty())
+        throw std::runtime_error("Out of bounds access at offset " + std::to_string(offset));
+    auto next = std::upper_bound(fileOffsets.begin(), fileOffsets.end(), offset);
+    return next - fileOffsets.begin() - 1;
+}
+
+/**
+ * Returns the mapping of the given window of a file, mapping it first if
+ * needed. The least recently used window is unmapped when too many
+ * windows are mapped. Must be called with the exclusive lock held.
+ */
+char* Storage::mapWindow(size_t fileIndex, size_t window)
+{
+    StorageFile& file = files[fileIndex];
+    if (file.windows[window])
+    {
+        touchWindow(fileIndex, window);
+        return file.windows[window];
+    }
+    if (mappedWindows.size() >= MMAP_MAX_WINDOWS)
+    {
+        unmapWindow(mappedWindows.back().first, mappedWindows.back().second);
+        mappedWindows.pop_back();
+    }
+    long start = (long) window * MMAP_WINDOW_SIZE;
+    size_t length = std::min(MMAP_WINDOW_SIZE, file.length - start);
+    // The mapping stays valid once the file is closed
+    FileCache::FileHandle handle = fileCache.open(fileIndex, file.path, true);
+    void* mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, handle.fd(), start);
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error("Cannot map " + file.path + " [" + strerror(errno) + "]");
+    // The pieces arrive in no particular order, so reading ahead is wasted
+    madvise(mapping, length, MADV_RANDOM);
+    file.windows[window] = (char*) mapping;
+    mappedWindows.emplace_front(fileIndex, window);
+    return file.windows[window];
+}
+
+/**
+ * Moves a mapped window to the front of the windows, as the most recently
+ * used one. Must be called with the exclusive lock, or with the shared
+ * lock and the recency lock held.
+ */
+void Storage::touchWindow(size_t fileIndex, size_t window)
+{
+    auto position = std::find(mappedWindows.begin(), mappedWindows.end(), std::make_pair(fileIndex, window));
+    if (position != mappedWindows.end() && position != mappedWindows.begin())
+        mappedWindows.splice(mappedWindows.begin(), mappedWindows, position);
+}
+
+/**
+ * Unmaps the given window of a file. The kernel writes the data back to
+ * disk even after the window has been unmapped.
+ */
+void Storage::unmapWindow(size_t fileIndex, size_t window)
+{
+    StorageFile& file = files[fileIndex];
+    long start = (long) window * MMAP_WINDOW_SIZE;
+    munmap(file.windows[window], std::min(MMAP_WINDOW_SIZE, file.length - start));
+    file.windows[window] = nullptr;
+}
+
+/**
+ * Copies data between the mappings of a file and the given buffer.
+ * The written data is left for the kernel to write back (see flush).
+ * @param offset: offset in the file.
+ */
+void Storage::copyMapped(size_t fileIndex, long offset, char* buffer, size_t length, bool isWrite)
+{
+    StorageFile& file = files[fileIndex];
+    while (length > 0)
+    {
+        size_t window = offset / MMAP_WINDOW_SIZE;
+        long windowOffset = offset % MMAP_WINDOW_SIZE;
+        size_t chunkLength = std::min(length, (size_t) (MMAP_WINDOW_SIZE - windowOffset));
+
+        std::shared_lock<std::shared_mutex> sharedLock(mappingLock);
+        char* mapping = file.windows[window];
+        if (!mapping)
+        {
+            // Maps the window under the exclusive lock, and then goes back
+            // to the shared lock, under which the window cannot be unmapped
+            sharedLock.unlock();
+            std::unique_lock<std::shared_mutex> exclusiveLock(mappingLock);
+            mapWindow(fileIndex, window);
+            exclusiveLock.unlock();
+            continue;
+        }
+        std::unique_lock<std::mutex> orderLock(recencyLock);
+        touchWindow(fileIndex, window);
+        orderLock.unlock();
+
+        bool isCopied = isWrite ? copyGuarded(mapping + windowOffset, buffer, chunkLength)
+                                : copyGuarded(buffer, mapping + windowOffset, chunkLength);
+        if (!isCopied)
+            throw std::runtime_error("Failed to access the mapping of " + file.path + " at offset " +
+                                     std::to_string(offset) + " (is the disk full?)");
+
+        buffer += chunkLength;
+        offset += (long) chunkLength;
+        length -= chunkLength;
+    }
+}
+
+/**
+ * Writes the given buffers one after the other to a file, starting at
+ * the given offset of the file, with as few pwritev calls as possible.
+ */
+void Storage::writeFile(size_t fileIndex, long offset, std::vector<iovec> buffers)
+{
+    StorageFile& file = files[fileIndex];
+    file.isWritten = true;
+    if (memoryMapped)
+    {
+        for (const iovec& buffer : buffers)
+        {
+            copyMapped(fileIndex, offset, (char*) buffer.iov_base, buffer.iov_len, true);
+            offset += (long) buffer.iov_len;
+        }
+        return;
+    }
+    if (directIo)
+    {
+        writeDirect(fileIndex, offset, buffers);
+        return;
+    }
+    FileCache::FileHandle handle = fileCache.open(fileIndex, file.path, true);
+    size_t first = 0;
+    while (first < buffers.size())
+    {
+        int count = (int) std::min(buffers.size() - first, (size_t) IOV_MAX);
+        ssize_t bytesWritten = pwritev(handle.fd(), &buffers[first], count, offset);
+        if (bytesWritten < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error("Failed to write to " + file.path + " [" + strerror(errno) + "]");
+        }
+        offset += bytesWritten;
+        // Skips the buffers which have been written, and the written part
+        // of the next one after a short write
+        while (first < buffers.size() && (size_t) bytesWritten >= buffers[first].iov_len)
+            bytesWritten -= (ssize_t) buffers[first++].iov_len;
+        if (first < buffers.size())
+        {
+            buffers[first].iov_base = (char*) buffers[first].iov_base + bytesWritten;
+            buffers[first].iov_len -= bytesWritten;
+        }
+    }
+}
+
+/**
+ * Reads 'length' bytes at the given offset of a file into the buffer.
+ */
+void Storage::readFile(size_t fileIndex, long offset, char* buffer, size_t length)
+{
+    StorageFile& file = files[fileIndex];
+    if (memoryMapped)
+    {
+        copyMapped(fileIndex, offset, buffer, length, false);
+        return;
+    }
+    if (directIo)
+    {
+        readDirect(fileIndex, offset, buffer, length);
+        return;
+    }
+    FileCache::FileHandle handle = fileCache.open(fileIndex, file.path, false);
+    while (length > 0)
+    {
+        ssize_t bytesRead = pread(handle.fd(), buffer, length, offset);
+        if (bytesRead < 0 && errno == EINTR)
+            continue;
+        if (bytesRead <= 0)
+            throw std::runtime_error("Failed to read from " + file.path + " at offset " + std::to_string(offset));
+        buffer += bytesRead;
+        offset += bytesRead;
+        length -= bytesRead;
+    }
+}
+
+/**
+ * Writes the given buffers one after the other to a file opened with
+ * O_DIRECT. The data is copied to an aligned buffer covering whole blocks:
+ * the partial blocks at both ends of the range are read from the file
+ * first, so that the data around the range is kept, and the file is
+ * truncated back to its size if its last block was written past the end.
+ * Two writes sharing a block must therefore not be made at the same time,
+ * which holds as all the writes are made by the DiskWriter.
+ * @param offset: offset in the file.
+ */
+void Storage::writeDirect(size_t fileIndex, long offset, const std::vector<iovec>& buffers)
+{
+    StorageFile& file = files[fileIndex];
+    size_t length = 0;
+    for (const iovec& buffer : buffers)
+        length += buffer.iov_len;
+    long start = offset / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+    long end = (offset + (long) length + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+    long lastBlock = end - DIRECT_IO_ALIGNMENT;
+    AlignedBufferPool::Buffer alignedBuffer = bufferPool.acquire(end - start);
+    FileCache::FileHandle handle = fileCache.open(fileIndex, file.path, true);
+
+    // Read-modify-write of the partial blocks
+    if (start < offset)
+        readBlocks(handle.fd(), file.path, alignedBuffer.data(), DIRECT_IO_ALIGNMENT, start);
+    if (offset + (long) length < end && (lastBlock > start || start == offset))
+        readBlocks(handle.fd(), file.path, alignedBuffer.data() + (lastBlock - start), DIRECT_IO_ALIGNMENT, lastBlock);
+    char* position = alignedBuffer.data() + (offset - start);
+    for (const iovec& buffer : buffers)
+    {
+        memcpy(position, buffer.iov_base, buffer.iov_len);
+        position += buffer.iov_len;
+    }
+
+    size_t bytesWritten = 0;
+    while (bytesWritten < (size_t) (end - start))
+    {
+        ssize_t written = pwrite(handle.fd(), alignedBuffer.data() + bytesWritten,
+                                 (end - start) - bytesWritten, start + (long) bytesWritten);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written < 0)
+            throw std::runtime_error("Failed to write to " + file.path + " [" + strerror(errno) + "]");
+        bytesWritten += written;
+    }
+    if (end > file.length && ftruncate(handle.fd(), file.length) < 0)
+        throw std::runtime_error("Cannot resize " + file.path + " [" + strerror(errno) + "]");
+}
+
+/**
+ * Reads 'length' bytes at the given offset of a file opened with O_DIRECT,
+ * through an aligned buffer covering the whole blocks of the range.
+ */
+void Storage::readDirect(size_t fileIndex, long offset, char* buffer, size_t length)
+{
+    StorageFile& file = files[fileIndex];
+    long start = offset / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+    long end = (offset + (long) length + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+    AlignedBufferPool::Buffer alignedBuffer = bufferPool.acquire(end - start);
+    FileCache::FileHandle handle = fileCache.open(fileIndex, file.path, false);
+    size_t bytesRead = readBlocks(handle.fd(), file.path, alignedBuffer.data(), end - start, start);
+    if (bytesRead < (offset - start) + length)
+        throw std::runtime_error("Failed to read from " + file.path + " at offset " + std::to_string(offset));
+    memcpy(buffer, alignedBuffer.data() + (offset - start), length);
+}
+
+/**
+ * Reads whole blocks from a file opened with O_DIRECT into an aligned
+ * buffer, up to the end of the file. The rest of the buffer is zeroed.
+ * @return the number of bytes read.
+ */
+size_t Storage::readBlocks(int fd, const std::string& path, char* buffer, size_t length, long offset)
+{
+    size_t bytesRead = 0;
+    while (bytesRead < length)
+    {
+        ssize_t chunkLength = pread(fd, buffer + bytesRead, length - bytesRead, offset + (long) bytesRead);
+        if (chunkLength < 0 && errno == EINTR)
+            continue;
+        if (chunkLength < 0)
+            throw std::runtime_error("Failed to read from " + path + " [" + strerror(errno) + "]");
+        bytesRead += chunkLength;
+        // A read which ends within a block has reached the end of the file
+        if (chunkLength == 0 || bytesRead % DIRECT_IO_ALIGNMENT != 0)
+            break;
+    }
+    memset(buffer + bytesRead, 0, length - bytesRead);
+    return bytesRead;
+}
+
+/**
+ * Writes the given data at the given offset of the stream of data.
+ */
+void Storage::write(long offset, const char* data, size_t length)
+{
+    write(offset, { { const_cast<char*>(data), length } });
+}
+
+/**
+ * Writes the given buffers one after the other, starting at the given
+ * offset of the stream of data. The buffers are split at the boundaries
+ * of the files, and each file is written with a single pwritev.
+ */
+void Storage::write(long offset, std::vector<iovec> buffers)
+{
+    size_t fileIndex = findFile(offset);
+    size_t first = 0;
+    // Number of bytes of buffers[first] which have already been taken
+    size_t taken = 0;
+    while (first < buffers.size())
+    {
+        if (fileIndex >= files.size())
+            throw std::runtime_error("Out of bounds write at offset " + std::to_string(offset));
+        const StorageFile& file = files[fileIndex];
+        long fileOffset = offset - file.offset;
+        size_t remaining = file.length - fileOffset;
+        std::vector<iovec> fileBuffers;
+        size_t length = 0;
+        while (first < buffers.size() && length < remaining)
+        {
+            size_t chunkLength = std::min(buffers[first].iov_len - taken, remaining - length);
+            fileBuffers.push_back({ (char*) buffers[first].iov_base + taken, chunkLength });
+            length += chunkLength;
+            taken += chunkLength;
+            if (taken == buffers[first].iov_len)
+            {
+                first++;
+                taken = 0;
+            }
+        }
+        // Empty buffers at the end of a file are skipped
+        while (first < buffers.size() && buffers[first].iov_len == 0)
+            first++;
+        if (!file.isPadding && length > 0)
+            writeFile(fileIndex, fileOffset, std::move(fileBuffers));
+        offset += (long) length;
+        fileIndex++;
+    }
+}
+
+/**
+ * Reads 'length' bytes at the given offset of the stream of data into the
+ * buffer, from as many files as it spans.
+ */
+void Storage::read(long offset, char* buffer, size_t length)
+{
+    size_t fileIndex = findFile(offset);
+    while (length > 0)
+    {
+        if (fileIndex >= files.size())
+            throw std::runtime_error("Out of bounds read at offset " + std::to_string(offset));
+        const StorageFile& file = files[fileIndex];
+        long fileOffset = offset - file.offset;
+        size_t chunkLength = std::min(length, (size_t) (file.length - fileOffset));
+        if (file.isPadding)
+            memset(buffer, 0, chunkLength);
+        else if (chunkLength > 0)
+            readFile(fileIndex, fileOffset, buffer, chunkLength);
+        buffer += chunkLength;
+        offset += (long) chunkLength;
+        length -= chunkLength;
+        fileIndex++;
+    }
+}
+
+/**
+ * Lets the kernel know that the given part of the stream of data will be
+ * read soon, so that it is read into the page cache in the background.
+ */
+void Storage::readAhead(long offset, size_t length)
+{
+    size_t fileIndex = findFile(offset);
+    while (length > 0 && fileIndex < files.size())
+    {
+        const StorageFile& file = files[fileIndex];
+        long fileOffset = offset - file.offset;
+        size_t chunkLength = std::min(length, (size_t) (file.length - fileOffset));
+        if (!file.isPadding && chunkLength > 0)
+        {
+            FileCache::FileHandle handle = fileCache.open(fileIndex, file.path, false);
+            posix_fadvise(handle.fd(), fileOffset, (off_t) chunkLength, POSIX_FADV_WILLNEED);
+        }
+        offset += (long) chunkLength;
+        length -= chunkLength;
+        fileIndex++;
+    }
+}
+
+/**
+ * Waits until all the data written so far is on disk: the windows which
+ * are still mapped are synchronised with msync, and every file written to
+ * since the last flush with fdatasync, which also covers the data written
+ * through windows which have since been unmapped. Must not be called
+ * while data is being written.
+ */
+void Storage::flush()
+{
+    if (memoryMapped)
+    {
+        std::unique_lock<std::shared_mutex> exclusiveLock(mappingLock);
+        for (auto const& [fileIndex, window] : mappedWindows)
+        {
+            StorageFile& file = files[fileIndex];
+            long start = (long) window * MMAP_WINDOW_SIZE;
+            if (msync(file.windows[window], std::min(MMAP_WINDOW_SIZE, file.length - start), MS_SYNC) < 0)
+                throw std::runtime_error("Failed to flush " + file.path + " [" + strerror(errno) + "]");
+        }
+    }
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        StorageFile& file = files[i];
+        // Cleared before syncing, so that a file written to in the meantime
+        // is synchronised again by the next flush
+        if (!file.isWritten.exchange(false))
+            continue;
+        FileCache::FileHandle handle = fileCache.open(i, file.path, true);
+        if (fdatasync(handle.fd()) < 0)
+        {
+            file.isWritten = true;
+            throw std::runtime_error("Failed to flush " + file.path + " [" + strerror(errno) + "]");
+        }
+    }
+}
+
+/**
+ * Closes the files which have not been accessed for FILE_IDLE_TIME.
+ */
+void Storage::closeIdleFiles()
+{
+    fileCache.closeIdle(FILE_IDLE_TIME);
+}
+
+/**
+ * Logs the hit rate of the file cache.
+ */
+void Storage::logStatistics()
+{
+    fileCache.logStatistics();
+}
+
+/**
+ * Retrieves the total size of the files before they were opened.
+ */
+long Storage::getExistingSize() const
+{
+    long existingSize = 0;
+    for (const StorageFile& file : files)
+        existingSize += file.existingSize;
+    return existingSize;
+}
+
+/**
+ * Retrieves the size and modification time of each file as they were
+ * before the files were opened, resized and preallocated.
+ */
+std::vector<FileState> Storage::getInitialFileStates() const
+{
+    std::vector<FileState> fileStates;
+    for (const StorageFile& file : files)
+        fileStates.push_back(file.initialState);
+    return fileStates;
+}
+
+/**
+ * Retrieves the current size and modification time of each file. Padding
+ * files, which do not exist, have a size and modification time of 0.
+ */
+std::vector<FileState> Storage::getFileStates() const
+{
+    std::vector<FileState> fileStates;
+    for (const StorageFile& file : files)
+    {
+        struct stat fileStatus {};
+        if (file.isPadding || stat(file.path.c_str(), &fileStatus) < 0)
+            fileStates.push_back({ 0, 0 });
+        else
+            fileStates.push_back({ (long) fileStatus.st_size,
+                                   (long) fileStatus.st_mtim.tv_sec * 1000000000L + fileStatus.st_mtim.tv_nsec });
+    }
+    return fileStates;
+}
+
+/**
+ * Counts the extents of the files with the FIEMAP ioctl, i.e. the number
+ * of contiguous runs of disk blocks which make them up: a measure of
+ * their fragmentation.
+ * @return the number of extents, or -1 if the file system does not
+ * support FIEMAP.
+ */
+long Storage::countExtents()
+{
+    long extents = 0;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        const StorageFile& file = files[i];
+        if (file.isPadding)
+            continue;
+        FileCache::FileHandle handle = fileCache.open(i, file.path, false);
+        struct fiemap extentMap {};
+        extentMap.fm_length = FIEMAP_MAX_OFFSET;
+        extentMap.fm_flags = FIEMAP_FLAG_SYNC;
+        // With no room for the extents, only their number is retrieved
+        extentMap.fm_extent_count = 0;
+        if (ioctl(handle.fd(), FS_IOC_FIEMAP, &extentMap) < 0)
+            return -1;
+        extents += extentMap.fm_mapped_extents;
+    }
+    return extents;
+}
+
+/**
+ * Measures how much of the data of the files is in the page cache, with
+ * mincore on a read-only mapping of each file.
+ * @return the size in bytes, or -1 if it cannot be measured.
+ */
+long Storage::getCachedSize()
+{
+    long pageSize = sysconf(_SC_PAGESIZE);
+    long cachedSize = 0;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        const StorageFile& file = files[i];
+        if (file.isPadding || file.length == 0)
+            continue;
+        FileCache::FileHandle handle = fileCache.open(i, file.path, false);
+        void* mapping = mmap(nullptr, file.length, PROT_READ, MAP_SHARED, handle.fd(), 0);
+        if (mapping == MAP_FAILED)
+            return -1;
+        std::vector<unsigned char> residentPages((file.length + pageSize - 1) / pageSize);
+        int result = mincore(mapping, file.length, residentPages.data());
+        munmap(mapping, file.length);
+        if (result < 0)
+            return -1;
+        for (unsigned char residentPage : residentPages)
+            cachedSize += (residentPage & 1) ? pageSize : 0;
+    }
+    return cachedSize;
+}
+
+/**
+ * Retrieves the preferred size of the writes to the file system.
+ */
+size_t Storage::getBlockSize() const
+{
+    return blockSize;
+}
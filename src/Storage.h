@@ -0,0 +1,134 @@
+#ifndef BITTORRENTCLIENT_STORAGE_H
+#define BITTORRENTCLIENT_STORAGE_H
+
+#include <list>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <shared_mutex>
+#include <sys/uio.h>
+
+#include "FileCache.h"
+#include "AlignedBufferPool.h"
+#include "TorrentFile.h"
+
+/**
+ * How the disk space of the file is allocated before the download starts.
+ */
+enum Preallocation
+{
+    // The file is only resized, and its blocks are allocated as the pieces
+    // are written, in whatever order they arrive
+    sparseFile = 0,
+    // The blocks are reserved up front with fallocate, without being written
+    allocatedFile = 1,
+    // Zeros are written to the part of the file which did not exist yet
+    zeroFilledFile = 2
+};
+
+/**
+ * The size and modification time (in nanoseconds) of a file on disk, with
+ * which changes made to the file between two runs are detected.
+ */
+struct FileState
+{
+    long size;
+    long modificationTime;
+};
+
+/**
+ * Gives access to the files being downloaded, as a single stream of data
+ * in which each file starts where the previous one ends. An access to the
+ * stream is split into one access per file it spans, the file holding a
+ * given offset being found with a binary search on the offsets of the files.
+ * Data is written to and read from explicit offsets with pwrite and pread,
+ * so the Storage can be used from several threads at once without any
+ * locking. The files are only kept open while they are accessed, in a
+ * FileCache of at most MAX_OPEN_FILES descriptors. Alternatively, the files are memory-mapped in windows of
+ * MMAP_WINDOW_SIZE bytes, at most MMAP_MAX_WINDOWS of which are mapped
+ * at a time, and the data is copied to and from the mappings.
+ * With direct I/O, the files are opened with O_DIRECT so that the data
+ * bypasses the page cache, and is copied through aligned buffers.
+ */
+class Storage
+{
+private:
+    struct StorageFile
+    {
+        std::string path;
+        long offset;
+        long length;
+        // Padding files are not created: writes to them are dropped and
+        // reads return zeros
+        bool isPadding;
+        // Whether the file has been written to since the last flush. Set by
+        // the writing threads and cleared by flush
+        std::atomic<bool> isWritten { false };
+        // Size of the file before it was opened, i.e. 0 if it did not exist
+        long existingSize = 0;
+        // Disk space already allocated to the file when it was opened
+        long allocatedSize = 0;
+        // State of the file before it was opened and resized
+        FileState initialState { 0, 0 };
+        // Memory-mapped backend: the mapping of each window of the file,
+        // or nullptr if it is not mapped
+        std::vector<char*> windows;
+    };
+
+    std::vector<StorageFile> files;
+    // Offset of each file in the stream of data, in the order of the files
+    std::vector<long> fileOffsets;
+    long totalSize = 0;
+    // Preferred size of the writes to the file system
+    size_t blockSize = 4096;
+    FileCache fileCache;
+
+    // Memory-mapped backend: the mapped windows as (file, window) pairs,
+    // most recently used first. The windows are only unmapped under the
+    // exclusive lock, and a window used under the shared lock is moved to
+    // the front of the list under the recency lock.
+    const bool memoryMapped;
+    std::list<std::pair<size_t, size_t>> mappedWindows;
+    std::shared_mutex mappingLock;
+    std::mutex recencyLock;
+
+    // Direct I/O: every access covers whole blocks of DIRECT_IO_ALIGNMENT
+    // bytes, from buffers aligned on the same boundary
+    const bool directIo;
+    AlignedBufferPool bufferPool;
+
+    void openFile(StorageFile& file, const std::string& downloadDirectory, const std::string& relativePath);
+    void preallocate(size_t fileIndex, Preallocation preallocation);
+    void checkFreeSpace(const std::string& downloadDirectory, long requiredSize);
+    size_t findFile(long offset) const;
+    void writeFile(size_t fileIndex, long offset, std::vector<iovec> buffers);
+    void readFile(size_t fileIndex, long offset, char* buffer, size_t length);
+    char* mapWindow(size_t fileIndex, size_t window);
+    void touchWindow(size_t fileIndex, size_t window);
+    void unmapWindow(size_t fileIndex, size_t window);
+    void copyMapped(size_t fileIndex, long offset, char* buffer, size_t length, bool isWrite);
+    void writeDirect(size_t fileIndex, long offset, const std::vector<iovec>& buffers);
+    void readDirect(size_t fileIndex, long offset, char* buffer, size_t length);
+    size_t readBlocks(int fd, const std::string& path, char* buffer, size_t length, long offset);
+
+public:
+    explicit Storage(const std::string& downloadDirectory, const std::vector<TorrentFile>& torrentFiles,
+                     bool memoryMapped = false, Preallocation preallocation = sparseFile, bool directIo = false);
+    ~Storage();
+    void write(long offset, const char* data, size_t length);
+    void write(long offset, std::vector<iovec> buffers);
+    void read(long offset, char* buffer, size_t length);
+    void readAhead(long offset, size_t length);
+    void flush();
+    void closeIdleFiles();
+    void logStatistics();
+    long getExistingSize() const;
+    std::vector<FileState> getInitialFileStates() const;
+    std::vector<FileState> getFileStates() const;
+    size_t getBlockSize() const;
+    long countExtents();
+    long getCachedSize();
+};
+
+#endif //BITTORRENTCLIENT_STORAGE_H
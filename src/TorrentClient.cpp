@@ -5,6 +5,8 @@
 #include <random>
 #include <iostream>
 #include <thread>
+#include <atomic>
+#include <csignal>
 #include <bencode/bencoding.h>
 #include <loguru/loguru.hpp>
 
@@ -13,10 +15,27 @@
 #include "TorrentFileParser.h"
 #include "PeerRetriever.h"
 #include "PeerConnection.h"
+#include "PieceChecker.h"
+#include "MerkleTree.h"
+#include "TorrentCreator.h"
 
 #define PORT 8080
 #define PEER_QUERY_INTERVAL 60 // 1 minute
 
+// Set when the user asks the download to stop, e.g. with Ctrl-C
+static std::atomic<bool> interrupted { false };
+
+/**
+ * Stops the download gracefully on the first SIGINT or SIGTERM, so that
+ * the downloaded data and the resume data are saved. A second signal
+ * terminates the process right away.
+ */
+static void handleInterruption(int signal)
+{
+    interrupted = true;
+    std::signal(signal, SIG_DFL);
+}
+
 TorrentClient::TorrentClient(const int threadNum, bool enableLogging, std::string logFilePath): threadNum(threadNum)
 {
     // Generate a random 20-byte peer Id for the client as per the convention described
@@ -52,8 +71,10 @@ TorrentClient::~TorrentClient() = default;
  * Download the file as per the content of the given Torrent file.
  * @param torrentFilePath: path to the Torrent file.
  * @param downloadPath: directory of the file when it is finished (i.e. the destination directory).
+ * @param options: options which control how the download is carried out.
  */
-void TorrentClient::downloadFile(const std::string& torrentFilePath, const std::string& downloadDirectory)
+void TorrentClient::downloadFile(const std::string& torrentFilePath, const std::string& downloadDirectory,
+                                 const DownloadOptions& options)
 {
     // Parse Torrent file
     std::cout << "Parsing Torrent file " + torrentFilePath + "..." << std::endl;
@@ -65,16 +86,17 @@ void TorrentClient::downloadFile(const std::string& torrentFilePath, const std::
 
     std::string filename = torrentFileParser.getFileName();
     std::string downloadPath = downloadDirectory + filename;
-    PieceManager pieceManager(torrentFileParser, downloadPath, threadNum);
+    PieceManager pieceManager(torrentFileParser, downloadDirectory, threadNum, options);
 
     // Adds threads to the thread pool
     for (int i = 0; i < threadNum; i++)
     {
-        PeerConnection connection(&queue, peerId, infoHash, &pieceManager);
-        connections.push_back(&connection);
-        std::thread thread(&PeerConnection::start, connection);
-        threadPool.push_back(std::move(thread));
+        auto connection = new PeerConnection(&queue, peerId, infoHash, &pieceManager);
+        connections.push_back(connection);
+        threadPool.emplace_back(&PeerConnection::start, connection);
     }
+    std::signal(SIGINT, handleInterruption);
+    std::signal(SIGTERM, handleInterruption);
 
     auto lastPeerQuery = (time_t) (-1);
 
@@ -82,7 +104,7 @@ void TorrentClient::downloadFile(const std::string& torrentFilePath, const std::
 
     while (true)
     {
-        if (pieceManager.isComplete())
+        if (pieceManager.isComplete() || interrupted)
             break;
 
         time_t currentTime = std::time(nullptr);
@@ -104,13 +126,69 @@ void TorrentClient::downloadFile(const std::string& torrentFilePath, const std::
         }
     }
 
+    pieceManager.stopRequests();
     terminate();
 
+    pieceManager.flush();
     if (pieceManager.isComplete())
     {
         std::cout << "Download completed!" << std::endl;
         std::cout << "File downloaded to " << downloadPath << std::endl;
     }
+    else
+        std::cout << std::endl << "Download interrupted, " << pieceManager.bytesDownloaded() / 1048576
+                  << " MB saved to " << downloadPath << std::endl;
+}
+
+/**
+ * Verifies the pieces of the files which have already been downloaded,
+ * without connecting to any peer.
+ * @param torrentFilePath: path to the Torrent file.
+ * @param downloadDirectory: directory in which the files were downloaded.
+ */
+void TorrentClient::checkFile(const std::string& torrentFilePath, const std::string& downloadDirectory)
+{
+    std::cout << "Parsing Torrent file " + torrentFilePath + "..." << std::endl;
+    TorrentFileParser torrentFileParser(torrentFilePath);
+    std::string downloadPath = downloadDirectory + torrentFileParser.getFileName();
+    long fileSize = torrentFileParser.getFileSize();
+    long pieceLength = torrentFileParser.getPieceLength();
+    std::vector<std::string> pieceHashes;
+    size_t leafWidth = 0;
+    if (torrentFileParser.hasMerkleTree())
+    {
+        pieceHashes = torrentFileParser.getPieceLayer();
+        leafWidth = MerkleTree::leavesPerPiece(pieceLength, fileSize);
+    }
+    else
+        pieceHashes = torrentFileParser.splitPieceHashes();
+
+    PieceChecker checker(downloadDirectory, torrentFileParser.getFiles(), pieceLength, pieceHashes,
+                         (int) std::thread::hardware_concurrency(), leafWidth);
+    Bitfield validPieces = checker.check();
+    std::cout << validPieces.count() << " / " << pieceHashes.size() << " pieces of " << downloadPath
+              << " are valid" << std::endl;
+}
+
+/**
+ * Creates the Torrent file of a file or a directory, hashing the pieces
+ * on several threads.
+ * @param sourcePath: path of the file or directory to share.
+ * @param torrentFilePath: path of the Torrent file to write.
+ * @param announce: announce URL of the tracker, left out if empty.
+ * @param pieceLength: length of a piece in bytes.
+ * @param hybrid: whether to include the BitTorrent v2 hashes.
+ * @param hasherThreads: number of threads hashing the pieces, 0 for one per core.
+ */
+void TorrentClient::createTorrent(const std::string& sourcePath, const std::string& torrentFilePath,
+                                  const std::string& announce, long pieceLength, bool hybrid, int hasherThreads)
+{
+    if (hasherThreads <= 0)
+        hasherThreads = (int) std::thread::hardware_concurrency();
+    std::cout << "Creating Torrent file " << torrentFilePath << " for " << sourcePath << "..." << std::endl;
+    TorrentCreator creator(sourcePath, pieceLength, hasherThreads, hybrid);
+    creator.create(torrentFilePath, announce);
+    std::cout << "Torrent file written to " << torrentFilePath << std::endl;
 }
 
 /**
@@ -135,4 +213,7 @@ void TorrentClient::terminate()
     }
 
     threadPool.clear();
+    for (PeerConnection* connection : connections)
+        delete connection;
+    connections.clear();
 }
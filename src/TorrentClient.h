@@ -22,7 +22,11 @@ public:
     explicit TorrentClient(int threadNum = 5, bool enableLogging = true, std::string logFilePath = "logs/client.log");
     ~TorrentClient();
     void terminate();
-    void downloadFile(const std::string& torrentFilePath, const std::string& downloadDirectory);
+    void downloadFile(const std::string& torrentFilePath, const std::string& downloadDirectory,
+                      const DownloadOptions& options = DownloadOptions());
+    void checkFile(const std::string& torrentFilePath, const std::string& downloadDirectory);
+    void createTorrent(const std::string& sourcePath, const std::string& torrentFilePath, const std::string& announce,
+                       long pieceLength, bool hybrid, int hasherThreads);
 };
 
 #endif //BITTORRENTCLIENT_TORRENTCLIENT_H
@@ -0,0 +1,383 @@
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <bencode/bencoding.h>
+#include <crypto/sha256_engine.h>
+#include <loguru/loguru.hpp>
+
+#include "TorrentCreator.h"
+#include "MerkleTree.h"
+
+#define CREATE_PROGRESS_INTERVAL 100 // 0.1 sec
+#define BYTES_PER_GB 1e9
+
+/**
+ * @param sourcePath: path of the file or directory to share.
+ * @param pieceLength: length of a piece in bytes, a power of two of at least 16 KiB.
+ * @param threadCount: number of threads hashing the pieces.
+ * @param hybrid: whether to include the BitTorrent v2 hashes.
+ */
+TorrentCreator::TorrentCreator(std::string sourcePath, long pieceLength, int threadCount, bool hybrid):
+    sourcePath(std::move(sourcePath)), pieceLength(pieceLength), threadCount(std::max(threadCount, 1)),
+    hybrid(hybrid)
+{
+    if (pieceLength < MERKLE_LEAF_SIZE || (pieceLength & (pieceLength - 1)) != 0)
+        throw std::runtime_error("The piece length must be a power of two of at least 16 KiB");
+}
+
+/**
+ * Destructor of the TorrentCreator class. Unmaps the files.
+ */
+TorrentCreator::~TorrentCreator()
+{
+    unmapFiles();
+}
+
+/**
+ * Hashes the file or the files in the directory, and writes the
+ * resulting Torrent file. The hashing speed is displayed in stdout.
+ * @param torrentFilePath: path of the Torrent file to write.
+ * @param announce: announce URL of the tracker, left out if empty.
+ */
+void TorrentCreator::create(const std::string& torrentFilePath, const std::string& announce)
+{
+    listFiles();
+    if (totalLength == 0)
+        throw std::runtime_error("Cannot create a Torrent for " + sourcePath + " [No data to share]");
+    mapFiles();
+
+    totalPieces = (totalLength + pieceLength - 1) / pieceLength;
+    pieceHashes.assign(totalPieces, std::string());
+    if (hybrid)
+        pieceRoots.assign(totalPieces, std::string());
+    zeros.assign(pieceLength, '\0');
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threadCount; i++)
+        threads.emplace_back([this] { this->hashPieces(); });
+
+    std::unique_lock<std::mutex> progressLock(lock);
+    while (hashedPieces < totalPieces)
+    {
+        hashingDone.wait_for(progressLock, std::chrono::milliseconds(CREATE_PROGRESS_INTERVAL));
+        displayProgress(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    progressLock.unlock();
+    for (std::thread& thread : threads)
+        thread.join();
+    std::cout << std::endl;
+    double elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    unmapFiles();
+
+    std::ofstream torrentFile(torrentFilePath, std::ofstream::binary | std::ofstream::trunc);
+    if (!torrentFile)
+        throw std::runtime_error("Cannot write " + torrentFilePath + " [" + strerror(errno) + "]");
+    torrentFile << encodeTorrent(announce);
+    torrentFile.close();
+
+    std::stringstream info;
+    info << "Hashed " << std::fixed << std::setprecision(2) << (double) totalLength / BYTES_PER_GB << " GB in ";
+    info << elapsedSeconds << " s (" << (double) totalLength / elapsedSeconds / BYTES_PER_GB << " GB/s) with ";
+    info << threadCount << " threads";
+    std::cout << info.str() << std::endl;
+    LOG_F(INFO, "%s: %zu files, %zu pieces%s", info.str().c_str(), files.size(), totalPieces,
+          hybrid ? " (hybrid)" : "");
+}
+
+/**
+ * Lists the files to share, sorted by path, and lays them out in the
+ * stream of data hashed into pieces.
+ */
+void TorrentCreator::listFiles()
+{
+    std::filesystem::path source = std::filesystem::path(sourcePath).lexically_normal();
+    if (!source.has_filename())
+        source = source.parent_path();
+    if (!std::filesystem::exists(source))
+        throw std::runtime_error("Cannot create a Torrent for " + sourcePath + " [No such file or directory]");
+    name = source.filename().string();
+    isDirectory = std::filesystem::is_directory(source);
+
+    files.clear();
+    if (!isDirectory)
+        files.push_back({ { name }, source.string(), (long) std::filesystem::file_size(source), 0, 0, nullptr });
+    else
+    {
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(source))
+        {
+            if (!entry.is_regular_file())
+                continue;
+            SourceFile file { {}, entry.path().string(), (long) entry.file_size(), 0, 0, nullptr };
+            for (const auto& component : std::filesystem::relative(entry.path(), source))
+                file.path.push_back(component.string());
+            files.push_back(std::move(file));
+        }
+        // The same order as the keys of the v2 file tree
+        std::sort(files.begin(), files.end(), [](const SourceFile& a, const SourceFile& b)
+        {
+            return a.path < b.path;
+        });
+    }
+
+    totalLength = 0;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        SourceFile& file = files[i];
+        file.offset = totalLength;
+        // In hybrid Torrents, every file but the last starts on a piece boundary
+        if (hybrid && i + 1 < files.size() && file.length % pieceLength != 0)
+            file.padding = pieceLength - file.length % pieceLength;
+        totalLength += file.length + file.padding;
+    }
+}
+
+/**
+ * Maps the files into memory, read-only.
+ */
+void TorrentCreator::mapFiles()
+{
+    for (SourceFile& file : files)
+    {
+        if (file.length == 0)
+            continue;
+        int fd = open(file.fullPath.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Cannot open " + file.fullPath + " [" + strerror(errno) + "]");
+        void* mapping = mmap(nullptr, file.length, PROT_READ, MAP_SHARED, fd, 0);
+        // The mapping stays valid after the file is closed
+        close(fd);
+        if (mapping == MAP_FAILED)
+            throw std::runtime_error("Cannot map " + file.fullPath + " [" + strerror(errno) + "]");
+        madvise(mapping, file.length, MADV_SEQUENTIAL);
+        file.data = (const unsigned char*) mapping;
+    }
+}
+
+/**
+ * Unmaps the files which have been mapped.
+ */
+void TorrentCreator::unmapFiles()
+{
+    for (SourceFile& file : files)
+    {
+        if (file.data)
+            munmap((void*) file.data, file.length);
+        file.data = nullptr;
+    }
+}
+
+/**
+ * Main loop of a hashing thread. Claims a few consecutive pieces at a
+ * time, so that they can be hashed together in the lanes of the
+ * multi-buffer SHA1, until all pieces have been claimed.
+ */
+void TorrentCreator::hashPieces()
+{
+    const size_t batchSize = SHA1MultiBuffer::lanes();
+    while (true)
+    {
+        size_t first = nextPiece.fetch_add(batchSize);
+        if (first >= totalPieces)
+            return;
+        size_t last = std::min(first + batchSize, totalPieces);
+
+        std::vector<std::vector<SHA1Span>> messages;
+        for (size_t index = first; index < last; index++)
+            messages.push_back(pieceSpans(index));
+        std::vector<std::array<unsigned char, SHA1_DIGEST_LENGTH>> digests;
+        SHA1MultiBuffer::hash(messages, digests);
+
+        // Each thread fills in its own pieces, so no locking is needed
+        for (size_t index = first; index < last; index++)
+        {
+            pieceHashes[index].assign((const char*) digests[index - first].data(), SHA1_DIGEST_LENGTH);
+            if (hybrid)
+                pieceRoots[index] = pieceRoot(index);
+        }
+        hashedPieces += last - first;
+        if (hashedPieces >= totalPieces)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            hashingDone.notify_one();
+        }
+    }
+}
+
+/**
+ * Finds the spans of memory which make up the given piece: parts of one
+ * or more files, and the zeros of the padding files.
+ */
+std::vector<SHA1Span> TorrentCreator::pieceSpans(size_t index) const
+{
+    long start = (long) index * pieceLength;
+    long end = std::min(start + pieceLength, totalLength);
+    // The last file which starts at or before the piece
+    auto file = std::upper_bound(files.begin(), files.end(), start, [](long position, const SourceFile& file)
+    {
+        return position < file.offset;
+    }) - 1;
+
+    std::vector<SHA1Span> spans;
+    for (; file != files.end() && file->offset < end; file++)
+    {
+        long dataStart = std::max(start, file->offset);
+        long dataEnd = std::min(end, file->offset + file->length);
+        if (dataStart < dataEnd)
+            spans.push_back({ file->data + (dataStart - file->offset), (size_t) (dataEnd - dataStart) });
+        long paddingEnd = std::min(end, file->offset + file->length + file->padding);
+        long paddingStart = std::max(start, file->offset + file->length);
+        if (paddingStart < paddingEnd)
+            spans.push_back({ zeros.data(), (size_t) (paddingEnd - paddingStart) });
+    }
+    return spans;
+}
+
+/**
+ * Computes the root of the subtree of the given piece in the Merkle tree
+ * of its file. In hybrid Torrents, a piece never spans several files.
+ * @return the root, or an empty string for a piece of padding only.
+ */
+std::string TorrentCreator::pieceRoot(size_t index) const
+{
+    long start = (long) index * pieceLength;
+    auto file = std::upper_bound(files.begin(), files.end(), start, [](long position, const SourceFile& file)
+    {
+        return position < file.offset;
+    }) - 1;
+    long end = std::min(start + pieceLength, file->offset + file->length);
+    if (start >= end)
+        return std::string();
+
+    std::vector<std::string> leafHashes;
+    for (long leaf = start; leaf < end; leaf += MERKLE_LEAF_SIZE)
+        leafHashes.push_back(MerkleTree::hashLeaf((const char*) file->data + (leaf - file->offset),
+                                                  std::min((long) MERKLE_LEAF_SIZE, end - leaf)));
+    return MerkleTree::root(leafHashes, MerkleTree::leavesPerPiece(pieceLength, file->length),
+                            std::string(SHA256_DIGEST_LENGTH, '\0'));
+}
+
+/**
+ * Builds the bencoded Torrent file from the hashes of the pieces.
+ */
+std::string TorrentCreator::encodeTorrent(const std::string& announce) const
+{
+    using namespace bencoding;
+    std::shared_ptr<BDictionary> info = BDictionary::create();
+    (*info)[BString::create("name")] = BString::create(name);
+    (*info)[BString::create("piece length")] = BInteger::create(pieceLength);
+    std::string pieces;
+    pieces.reserve(totalPieces * SHA1_DIGEST_LENGTH);
+    for (const std::string& hash : pieceHashes)
+        pieces += hash;
+    (*info)[BString::create("pieces")] = BString::create(pieces);
+
+    if (!isDirectory)
+        (*info)[BString::create("length")] = BInteger::create(files[0].length);
+    else
+    {
+        std::shared_ptr<BList> fileList = BList::create();
+        for (const SourceFile& file : files)
+        {
+            std::shared_ptr<BList> path = BList::create();
+            for (const std::string& component : file.path)
+                path->push_back(BString::create(component));
+            fileList->push_back(BDictionary::create({
+                { BString::create("length"), BInteger::create(file.length) },
+                { BString::create("path"), path }
+            }));
+            if (file.padding > 0)
+            {
+                std::shared_ptr<BList> paddingPath = BList::create({
+                    BString::create(".pad"), BString::create(std::to_string(file.padding))
+                });
+                fileList->push_back(BDictionary::create({
+                    { BString::create("attr"), BString::create("p") },
+                    { BString::create("length"), BInteger::create(file.padding) },
+                    { BString::create("path"), paddingPath }
+                }));
+            }
+        }
+        (*info)[BString::create("files")] = fileList;
+    }
+
+    std::shared_ptr<BDictionary> torrent = BDictionary::create();
+    if (!announce.empty())
+        (*torrent)[BString::create("announce")] = BString::create(announce);
+    (*torrent)[BString::create("created by")] = BString::create("BitTorrentClient");
+    (*torrent)[BString::create("creation date")] = BInteger::create(std::time(nullptr));
+
+    if (hybrid)
+    {
+        (*info)[BString::create("meta version")] = BInteger::create(2);
+        std::shared_ptr<BDictionary> fileTree = BDictionary::create();
+        std::shared_ptr<BDictionary> pieceLayers = BDictionary::create();
+        for (const SourceFile& file : files)
+        {
+            // Finds or creates the directories of the file in the tree
+            std::shared_ptr<BDictionary> node = fileTree;
+            for (const std::string& component : file.path)
+            {
+                std::shared_ptr<BItem>& child = (*node)[BString::create(component)];
+                if (!child)
+                    child = BDictionary::create();
+                node = std::dynamic_pointer_cast<BDictionary>(child);
+            }
+            std::shared_ptr<BDictionary> properties = BDictionary::create();
+            (*properties)[BString::create("length")] = BInteger::create(file.length);
+            (*node)[BString::create("")] = properties;
+            if (file.length == 0)
+                continue;
+
+            size_t firstPiece = file.offset / pieceLength;
+            size_t pieceCount = (file.length + pieceLength - 1) / pieceLength;
+            std::string piecesRoot = pieceRoots[firstPiece];
+            if (pieceCount > 1)
+            {
+                std::vector<std::string> layer(pieceRoots.begin() + firstPiece,
+                                               pieceRoots.begin() + firstPiece + pieceCount);
+                size_t width = 1;
+                while (width < pieceCount)
+                    width *= 2;
+                piecesRoot = MerkleTree::root(layer, width,
+                                              MerkleTree::paddingHash(MerkleTree::leavesPerPiece(pieceLength, file.length)));
+                std::string layerHashes;
+                for (const std::string& hash : layer)
+                    layerHashes += hash;
+                (*pieceLayers)[BString::create(piecesRoot)] = BString::create(layerHashes);
+            }
+            (*properties)[BString::create("pieces root")] = BString::create(piecesRoot);
+        }
+        (*info)[BString::create("file tree")] = fileTree;
+        (*torrent)[BString::create("piece layers")] = pieceLayers;
+    }
+
+    (*torrent)[BString::create("info")] = info;
+    return encode(torrent);
+}
+
+/**
+ * Outputs the number of pieces hashed so far and the hashing speed in stdout.
+ */
+void TorrentCreator::displayProgress(double elapsedSeconds)
+{
+    size_t hashed = std::min(hashedPieces.load(), totalPieces);
+    double hashedBytes = std::min((double) hashed * (double) pieceLength, (double) totalLength);
+    std::stringstream info;
+    info << "[Hashing: " << hashed << " / " << totalPieces << " pieces, ";
+    info << std::fixed << std::setprecision(2) << hashedBytes / elapsedSeconds / BYTES_PER_GB << " GB/s]";
+    std::cout << "\r" << info.str() << std::flush;
+}
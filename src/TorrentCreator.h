@@ -0,0 +1,74 @@
+#ifndef BITTORRENTCLIENT_TORRENTCREATOR_H
+#define BITTORRENTCLIENT_TORRENTCREATOR_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <crypto/sha1_multi_buffer.h>
+
+/**
+ * Creates the Torrent file of a single file or of a directory.
+ * The files are mapped into memory and their pieces are hashed in
+ * parallel by several threads, each taking a few consecutive pieces
+ * at a time. Pieces may span several files, as the files are treated
+ * as a single stream of data in the order of their paths.
+ * Hybrid Torrents also carry the BitTorrent v2 (BEP 52) Merkle trees:
+ * each file then starts on a piece boundary, the gaps being filled by
+ * padding files (BEP 47) in the v1 file list.
+ */
+class TorrentCreator
+{
+private:
+    struct SourceFile
+    {
+        // Components of the path of the file, relative to the source directory
+        std::vector<std::string> path;
+        std::string fullPath;
+        long length;
+        // Position of the file in the stream of data hashed into pieces
+        long offset;
+        // Length of the padding file which follows the file (hybrid only)
+        long padding;
+        const unsigned char* data;
+    };
+
+    const std::string sourcePath;
+    const long pieceLength;
+    const int threadCount;
+    const bool hybrid;
+
+    std::string name;
+    bool isDirectory = false;
+    std::vector<SourceFile> files;
+    long totalLength = 0;
+    size_t totalPieces = 0;
+    // Zeros, hashed in place of the padding files
+    std::string zeros;
+
+    // The 20-byte SHA1 hash of each piece, and for hybrid Torrents the
+    // root of its subtree in the Merkle tree of the file it belongs to
+    std::vector<std::string> pieceHashes;
+    std::vector<std::string> pieceRoots;
+    std::atomic<size_t> nextPiece { 0 };
+    std::atomic<size_t> hashedPieces { 0 };
+    std::mutex lock;
+    std::condition_variable hashingDone;
+
+    void listFiles();
+    void mapFiles();
+    void unmapFiles();
+    void hashPieces();
+    std::vector<SHA1Span> pieceSpans(size_t index) const;
+    std::string pieceRoot(size_t index) const;
+    std::string encodeTorrent(const std::string& announce) const;
+    void displayProgress(double elapsedSeconds);
+
+public:
+    explicit TorrentCreator(std::string sourcePath, long pieceLength, int threadCount, bool hybrid);
+    ~TorrentCreator();
+    void create(const std::string& torrentFilePath, const std::string& announce);
+};
+
+#endif //BITTORRENTCLIENT_TORRENTCREATOR_H
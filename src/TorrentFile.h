@@ -0,0 +1,24 @@
+#ifndef BITTORRENTCLIENT_TORRENTFILE_H
+#define BITTORRENTCLIENT_TORRENTFILE_H
+
+#include <string>
+
+/**
+ * One of the files of a Torrent. The pieces of the Torrent are taken from
+ * the files as a single stream of data, in the order of the file list, so
+ * a piece may span several files.
+ */
+struct TorrentFile
+{
+    // Path of the file relative to the download directory, including the
+    // name of the Torrent, with '/' as the separator
+    std::string path;
+    long length;
+    // Position of the first byte of the file in the stream of data
+    long offset;
+    // Padding files (BEP 47) only align the next file on a piece boundary:
+    // they are made of zeros and are not created on disk
+    bool isPadding;
+};
+
+#endif //BITTORRENTCLIENT_TORRENTFILE_H
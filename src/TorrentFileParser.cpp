@@ -7,13 +7,19 @@
 #include <stdexcept>
 #include <cassert>
 #include <bencode/BItem.h>
+#include <bencode/BList.h>
+#include <bencode/BString.h>
+#include <bencode/BInteger.h>
 #include <bencode/Decoder.h>
 #include <bencode/bencoding.h>
 #include <crypto/sha1.h>
+#include <crypto/sha256_engine.h>
 #include <loguru/loguru.hpp>
 
 #include "TorrentFileParser.h"
+#include "MerkleTree.h"
 #define HASH_LEN 20
+#define V2_INFO_HASH_LEN 20 // The SHA-256 info hash is truncated in the handshake
 
 /**
  * Constructor of the class TorrentFileParser. Takes in
@@ -51,13 +57,29 @@ std::shared_ptr<bencoding::BItem> TorrentFileParser::get(std::string key) const
  * The description of what the info hash is can be found in the following post:
  * https://stackoverflow.com/questions/28348678/what-exactly-is-the-info-hash-in-a-torrent-file.
  * The sha1 function comes from http://www.zedwood.com/article/cpp-sha1-function.
+ * A v2-only Torrent is identified by the SHA-256 hash of its info dictionary
+ * instead, truncated to 20 bytes. Hybrid Torrents keep their v1 info hash.
  */
 std::string TorrentFileParser::getInfoHash() const
 {
     std::shared_ptr<bencoding::BItem> infoDictionary = get("info");
     std::string infoString = bencoding::encode(infoDictionary);
-    std::string sha1Hash = sha1(infoString);
-    return sha1Hash;
+    if (getMetaVersion() < 2 || get("pieces"))
+    {
+        std::string sha1Hash = sha1(infoString);
+        return sha1Hash;
+    }
+
+    static const char hexDigits[] = "0123456789abcdef";
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    SHA256Engine::hash(infoString.data(), infoString.size(), digest);
+    std::string sha256Hash;
+    for (int i = 0; i < V2_INFO_HASH_LEN; i++)
+    {
+        sha256Hash.push_back(hexDigits[digest[i] >> 4]);
+        sha256Hash.push_back(hexDigits[digest[i] & 15]);
+    }
+    return sha256Hash;
 }
 
 /**
@@ -81,9 +103,108 @@ std::vector<std::string> TorrentFileParser::splitPieceHashes() const {
 }
 
 /**
- * Retrieves the total size of the file to be downloaded.
+ * Retrieves the info dictionary of the Torrent file.
+ */
+std::shared_ptr<bencoding::BDictionary> TorrentFileParser::getInfo() const
+{
+    auto info = std::dynamic_pointer_cast<bencoding::BDictionary>(get("info"));
+    if (!info)
+        throw std::runtime_error("Torrent file is malformed. [File does not contain key 'info']");
+    return info;
+}
+
+/**
+ * Checks if the Torrent has several files, listed in 'files' (v1 and
+ * hybrid Torrents) or in 'file tree' (v2-only Torrents).
+ */
+bool TorrentFileParser::isMultiFile() const
+{
+    std::shared_ptr<bencoding::BDictionary> info = getInfo();
+    for (const auto& item : *info)
+    {
+        if (item.first->value() == "files")
+            return true;
+        if (item.first->value() == "length")
+            return false;
+    }
+    // A v2-only Torrent with a single file has a single entry in its file
+    // tree, whose key is the name of the Torrent
+    auto fileTree = std::dynamic_pointer_cast<bencoding::BDictionary>(info->getValue("file tree"));
+    if (!fileTree || fileTree->size() != 1)
+        return true;
+    auto entry = std::dynamic_pointer_cast<bencoding::BDictionary>(fileTree->begin()->second);
+    return !entry || entry->size() != 1 || entry->begin()->first->value() != "";
+}
+
+/**
+ * Checks that a component of the path of a file cannot be used to write
+ * outside of the download directory.
+ */
+static void checkPathComponent(const std::string& component)
+{
+    if (component.empty() || component == "." || component == ".." || component.find('/') != std::string::npos)
+        throw std::runtime_error("Torrent file is malformed. [Invalid file path component '" + component + "']");
+}
+
+/**
+ * Retrieves the files of the Torrent, in the order in which their data
+ * appears in the pieces. A single-file Torrent has a single file named
+ * after the Torrent, and the files of a multi-file Torrent are in the
+ * directory named after it.
+ */
+std::vector<TorrentFile> TorrentFileParser::getFiles() const
+{
+    std::string name = getFileName();
+    checkPathComponent(name);
+    if (!isMultiFile())
+        return { { name, getFileSize(), 0, false } };
+
+    auto fileList = std::dynamic_pointer_cast<bencoding::BList>(getInfo()->getValue("files"));
+    if (!fileList)
+        throw std::runtime_error("Multi-file Torrents without a v1 file list are not supported.");
+    std::vector<TorrentFile> files;
+    files.reserve(fileList->size());
+    long offset = 0;
+    for (const auto& item : *fileList)
+    {
+        auto fileDictionary = std::dynamic_pointer_cast<bencoding::BDictionary>(item);
+        if (!fileDictionary)
+            throw std::runtime_error("Torrent file is malformed. [Invalid entry in 'files']");
+        auto lengthItem = std::dynamic_pointer_cast<bencoding::BInteger>(fileDictionary->getValue("length"));
+        auto pathList = std::dynamic_pointer_cast<bencoding::BList>(fileDictionary->getValue("path"));
+        if (!lengthItem || lengthItem->value() < 0 || !pathList || pathList->size() == 0)
+            throw std::runtime_error("Torrent file is malformed. [Invalid entry in 'files']");
+
+        TorrentFile file;
+        file.path = name;
+        for (const auto& componentItem : *pathList)
+        {
+            auto component = std::dynamic_pointer_cast<bencoding::BString>(componentItem);
+            if (!component)
+                throw std::runtime_error("Torrent file is malformed. [Invalid entry in 'files']");
+            checkPathComponent(component->value());
+            file.path += "/" + component->value();
+        }
+        file.length = lengthItem->value();
+        file.offset = offset;
+        auto attributes = std::dynamic_pointer_cast<bencoding::BString>(fileDictionary->getValue("attr"));
+        file.isPadding = attributes && attributes->value().find('p') != std::string::npos;
+        offset += file.length;
+        files.push_back(std::move(file));
+    }
+    return files;
+}
+
+/**
+ * Retrieves the total size of the data to be downloaded, i.e. the sum of
+ * the sizes of all the files.
  */
 long TorrentFileParser::getFileSize() const {
+    if (isMultiFile())
+    {
+        std::vector<TorrentFile> files = getFiles();
+        return files.empty() ? 0 : files.back().offset + files.back().length;
+    }
     std::shared_ptr<bencoding::BItem> fileSizeItem = get("length");
     if (!fileSizeItem)
         throw std::runtime_error("Torrent file is malformed. [File does not contain key 'length']");
@@ -103,8 +224,8 @@ long TorrentFileParser::getPieceLength() const {
 }
 
 /**
- * Retrieves the file name of the file to download. Assuming there is
- * only one downloadable file.
+ * Retrieves the name of the Torrent: the name of the file to download,
+ * or of the directory which contains the files of a multi-file Torrent.
  */
 std::string TorrentFileParser::getFileName() const
 {
@@ -126,3 +247,93 @@ std::string TorrentFileParser::getAnnounce() const
     std::string announce = std::dynamic_pointer_cast<bencoding::BString>(announceItem)->value();
     return announce;
 }
+
+
+/**
+ * Retrieves the version of the meta-info format: 2 for BitTorrent v2
+ * and hybrid Torrents (BEP 52), 1 otherwise.
+ */
+int TorrentFileParser::getMetaVersion() const
+{
+    std::shared_ptr<bencoding::BItem> versionItem = get("meta version");
+    if (!versionItem)
+        return 1;
+    auto version = std::dynamic_pointer_cast<bencoding::BInteger>(versionItem);
+    if (!version)
+        throw std::runtime_error("Torrent file is malformed. [Key 'meta version' is not an integer]");
+    return (int) version->value();
+}
+
+/**
+ * Checks if the Torrent file carries the Merkle tree root of the file
+ * (i.e. whether the pieces can be verified block by block). Only
+ * single-file Torrents are verified with their Merkle tree: the pieces of
+ * multi-file hybrid Torrents are checked with their SHA1 hash instead.
+ */
+bool TorrentFileParser::hasMerkleTree() const
+{
+    return getMetaVersion() >= 2 && get("pieces root") != nullptr && !isMultiFile();
+}
+
+/**
+ * Retrieves the 32-byte root of the Merkle tree of the file from the
+ * 'file tree' of a v2 Torrent. Assuming there is only one downloadable file.
+ */
+std::string TorrentFileParser::getPiecesRoot() const
+{
+    std::shared_ptr<bencoding::BItem> rootItem = get("pieces root");
+    if (!rootItem)
+        throw std::runtime_error("Torrent file is malformed. [File does not contain key 'pieces root']");
+    auto rootString = std::dynamic_pointer_cast<bencoding::BString>(rootItem);
+    if (!rootString)
+        throw std::runtime_error("Torrent file is malformed. [Key 'pieces root' is not a string]");
+    std::string piecesRoot = rootString->value();
+    if (piecesRoot.size() != SHA256_DIGEST_LENGTH)
+        throw std::runtime_error("Torrent file is malformed. [Invalid 'pieces root']");
+    return piecesRoot;
+}
+
+/**
+ * Retrieves the piece layer of the file (i.e. the 32-byte root of the
+ * subtree of each piece) from 'piece layers', and checks it against the
+ * root of the file. A file which fits in a single piece has no piece
+ * layer, in which case its root is returned as the hash of its piece.
+ */
+std::vector<std::string> TorrentFileParser::getPieceLayer() const
+{
+    std::string piecesRoot = getPiecesRoot();
+    long fileSize = getFileSize();
+    long pieceLength = getPieceLength();
+    if (fileSize <= pieceLength)
+        return { piecesRoot };
+
+    auto layers = std::dynamic_pointer_cast<bencoding::BDictionary>(get("piece layers"));
+    if (!layers)
+        throw std::runtime_error("Torrent file is malformed. [File does not contain key 'piece layers']");
+    std::string layer;
+    for (const auto& item : *layers)
+    {
+        if (item.first->value() != piecesRoot)
+            continue;
+        auto layerString = std::dynamic_pointer_cast<bencoding::BString>(item.second);
+        if (!layerString)
+            throw std::runtime_error("Torrent file is malformed. [Piece layer is not a string]");
+        layer = layerString->value();
+    }
+
+    size_t piecesCount = (fileSize + pieceLength - 1) / pieceLength;
+    if (layer.size() != piecesCount * SHA256_DIGEST_LENGTH)
+        throw std::runtime_error("Torrent file is malformed. [Missing or truncated piece layer]");
+    std::vector<std::string> pieceHashes;
+    pieceHashes.reserve(piecesCount);
+    for (size_t i = 0; i < piecesCount; i++)
+        pieceHashes.push_back(layer.substr(i * SHA256_DIGEST_LENGTH, SHA256_DIGEST_LENGTH));
+
+    size_t width = 1;
+    while (width < piecesCount)
+        width *= 2;
+    std::string padding = MerkleTree::paddingHash(MerkleTree::leavesPerPiece(pieceLength, fileSize));
+    if (MerkleTree::root(pieceHashes, width, padding) != piecesRoot)
+        throw std::runtime_error("Torrent file is malformed. [Piece layer does not match 'pieces root']");
+    return pieceHashes;
+}
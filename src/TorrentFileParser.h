@@ -8,6 +8,8 @@
 #include <vector>
 #include <bencode/BDictionary.h>
 
+#include "TorrentFile.h"
+
 using byte = unsigned char;
 /**
  * A class that parses a given Torrent file by using the bencoding library in following repo:
@@ -22,15 +24,22 @@ class TorrentFileParser
 {
 private:
     std::shared_ptr<bencoding::BDictionary> root;
+    std::shared_ptr<bencoding::BDictionary> getInfo() const;
 public:
     explicit TorrentFileParser(const std::string& filePath);
     long getFileSize() const;
     long getPieceLength() const;
     std::string getFileName() const;
+    bool isMultiFile() const;
+    std::vector<TorrentFile> getFiles() const;
     std::string getAnnounce() const;
     std::shared_ptr<bencoding::BItem> get(std::string key) const;
     std::string getInfoHash() const;
     std::vector<std::string> splitPieceHashes() const;
+    int getMetaVersion() const;
+    bool hasMerkleTree() const;
+    std::string getPiecesRoot() const;
+    std::vector<std::string> getPieceLayer() const;
 };
 
 
@@ -158,6 +158,9 @@ std::string receiveData(const int sock, uint32_t bufferSize)
         for (char i : buffer)
             messageLengthStr += i;
         uint32_t messageLength = bytesToInt(messageLengthStr);
+        // Keep-alive messages have no content
+        if (!messageLength)
+            return reply;
         bufferSize = messageLength;
     }
 
@@ -182,7 +185,8 @@ std::string receiveData(const int sock, uint32_t bufferSize)
         {
             throw std::runtime_error("Read timeout from socket " + std::to_string(sock));
         }
-        bytesRead = recv(sock, buffer, bufferSize, 0);
+        // Only the rest of the message is read, the next message stays in the socket
+        bytesRead = recv(sock, buffer, bytesToRead, 0);
 
         if (bytesRead <= 0)
             throw std::runtime_error("Failed to receive data from socket " + std::to_string(sock));
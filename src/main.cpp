@@ -12,6 +12,20 @@ int main(int argc, const char* argv[])
             ("t,torrent-file", "Path to the Torrent file", cxxopts::value<std::string>())
             ("o,output-dir", "The output directory to which the file will be downloaded", cxxopts::value<std::string>())
             ("n,thread-num", "Number of downloading threads to use", cxxopts::value<int>()->default_value("5"))
+            ("s,sequential", "Download the pieces in order so that the file can be used while downloading", cxxopts::value<bool>()->default_value("false"))
+            ("w,write-through", "Write each block to disk as soon as it is received", cxxopts::value<bool>()->default_value("false"))
+            ("write-coalesce", "Largest write in KiB made by merging the writes of adjacent pieces (0: no merging)", cxxopts::value<size_t>()->default_value("1024"))
+            ("mmap", "Access the downloaded file through memory mappings instead of pwrite and pread", cxxopts::value<bool>()->default_value("false"))
+            ("direct", "Bypass the page cache with direct I/O (O_DIRECT) when accessing the downloaded file", cxxopts::value<bool>()->default_value("false"))
+            ("preallocate", "How to allocate the disk space of the file: sparse, fallocate or full (zero-fill)", cxxopts::value<std::string>()->default_value("sparse"))
+            ("read-cache", "Memory in MiB used to cache the pieces uploaded to the peers (0: no caching)", cxxopts::value<size_t>()->default_value("32"))
+            ("memory-budget", "Memory in MiB for the pieces being downloaded, hashed and written, above which no new piece is started (0: no limit)", cxxopts::value<size_t>()->default_value("128"))
+            ("c,check", "Only verify the pieces of a file which has already been downloaded", cxxopts::value<bool>()->default_value("false"))
+            ("create", "Create the Torrent file given with -t for a file or directory", cxxopts::value<std::string>())
+            ("a,announce", "Announce URL of the Torrent file to create", cxxopts::value<std::string>()->default_value(""))
+            ("p,piece-length", "Piece length in KiB of the Torrent file to create", cxxopts::value<long>()->default_value("256"))
+            ("hybrid", "Include BitTorrent v2 hashes in the Torrent file to create", cxxopts::value<bool>()->default_value("false"))
+            ("j,hasher-threads", "Number of threads hashing the Torrent file to create (0: one per core)", cxxopts::value<int>()->default_value("0"))
             ("l,logging", "Enable logging", cxxopts::value<bool>()->default_value("false"))
             ("f,log-file", "Path to the log file", cxxopts::value<std::string>()->default_value("../logs/client.log"))
             ("h,help", "Print arguments and their descriptions")
@@ -27,16 +41,45 @@ int main(int argc, const char* argv[])
         int threadNum = parsedOptions["thread-num"].as<int>();
         bool enableLogging = parsedOptions["logging"].as<bool>();
         std::string logFile = parsedOptions["log-file"].as<std::string>();
+        DownloadOptions downloadOptions;
+        downloadOptions.sequential = parsedOptions["sequential"].as<bool>();
+        downloadOptions.writeThrough = parsedOptions["write-through"].as<bool>();
+        downloadOptions.memoryMapped = parsedOptions["mmap"].as<bool>();
+        downloadOptions.directIo = parsedOptions["direct"].as<bool>();
+        if (downloadOptions.directIo && downloadOptions.memoryMapped)
+            throw std::invalid_argument("Direct I/O cannot be used with memory mappings");
+        downloadOptions.writeCoalesceBytes = parsedOptions["write-coalesce"].as<size_t>() * 1024;
+        downloadOptions.readCacheBytes = parsedOptions["read-cache"].as<size_t>() * 1048576;
+        downloadOptions.memoryBudgetBytes = parsedOptions["memory-budget"].as<size_t>() * 1048576;
+        std::string preallocation = parsedOptions["preallocate"].as<std::string>();
+        if (preallocation == "fallocate")
+            downloadOptions.preallocation = allocatedFile;
+        else if (preallocation == "full")
+            downloadOptions.preallocation = zeroFilledFile;
+        else if (preallocation != "sparse")
+            throw std::invalid_argument("Unknown preallocation policy: " + preallocation);
 
         if (!parsedOptions.count("torrent-file"))
             throw std::invalid_argument("Path torrentFilePath a Torrent file has torrentFilePath be specified!");
+        std::string torrentFilePath = parsedOptions["torrent-file"].as<std::string>();
+        if (parsedOptions.count("create"))
+        {
+            TorrentClient torrentClient(threadNum, enableLogging, logFile);
+            torrentClient.createTorrent(parsedOptions["create"].as<std::string>(), torrentFilePath,
+                                        parsedOptions["announce"].as<std::string>(),
+                                        parsedOptions["piece-length"].as<long>() * 1024,
+                                        parsedOptions["hybrid"].as<bool>(), parsedOptions["hasher-threads"].as<int>());
+            return 0;
+        }
+
         if (!parsedOptions.count("output-dir"))
             throw std::invalid_argument("An output directory has torrentFilePath be specified!");
-
-        std::string torrentFilePath = parsedOptions["torrent-file"].as<std::string>();
         std::string outputDir = parsedOptions["output-dir"].as<std::string>();
         TorrentClient torrentClient(threadNum, enableLogging, logFile);
-        torrentClient.downloadFile(torrentFilePath, outputDir);
+        if (parsedOptions["check"].as<bool>())
+            torrentClient.checkFile(torrentFilePath, outputDir);
+        else
+            torrentClient.downloadFile(torrentFilePath, outputDir, downloadOptions);
     }
     catch (std::exception& e)
     {
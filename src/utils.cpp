@@ -76,27 +76,6 @@ std::string hexEncode(const std::string& input)
 }
 
 
-/**
- * Checks if the bit at the given index of a BitField string is set to
- * 1 or not.
- */
-bool hasPiece(const std::string& bitField, int index)
-{
-    int byteIndex = floor(index / 8);
-    int offset = index % 8;
-    return (bitField[byteIndex] >> (7 - offset) & 1) != 0;
-}
-
-/**
- * Sets the given index of the Bitfield to 1.
- */
-void setPiece(std::string& bitField, int index)
-{
-    int byteIndex = floor(index / 8);
-    int offset = index % 8;
-    bitField[byteIndex] |= (1 << (7 - offset));
-}
-
 /**
  * Converts a series of bytes in a string format to an integer.
  */
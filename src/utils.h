@@ -11,10 +11,6 @@ std::string hexDecode(const std::string& value);
 
 std::string hexEncode(const std::string& input);
 
-bool hasPiece(const std::string& bitField, int index);
-
-void setPiece(std::string& bitField, int index);
-
 int bytesToInt(std::string bytes);
 
 std::string formatTime(long seconds);